@@ -0,0 +1,240 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "token.hpp"
+#include "error.hpp"
+#include "tokenize.hpp"
+#include "parser.hpp"
+#include "codegen.hpp"
+#include "varaibles.hpp"
+#include "perfcounters.hpp"
+
+
+// Corpus generators, each one stressing something different. Size is the number of statements, constructs or
+// terms the corpus is made of, and every corpus is a valid program
+std::string statements_corpus(size_t size) {
+    std::stringstream source;
+    source << "mut x: int64 = 0;\n";
+    for (size_t index = 0; index < size; index++) {
+        source << "x = x + " << index % 1000 << ";\n";
+    }
+    source << "exit(x);\n";
+
+    return source.str();
+}
+
+// Nests ifs and whiles 32 deep, over and over
+std::string nesting_corpus(size_t size) {
+    const size_t depth = 32;
+    std::stringstream source;
+    source << "mut x: int64 = 0;\n";
+    for (size_t block = 0; block < std::max<size_t>(size / depth, 1); block++) {
+        for (size_t level = 0; level < depth; level++) {
+            source << std::string(level * 4, ' ') << (level % 2 == 0 ? "if (x < " : "while (x < ") << level + 1 << ") {\n";
+        }
+        source << std::string(depth * 4, ' ') << "x = x + 1;\n";
+        for (size_t level = depth; level > 0; level--) {
+            source << std::string((level - 1) * 4, ' ') << "}\n";
+        }
+    }
+    source << "exit(x);\n";
+
+    return source.str();
+}
+
+// Statements with 64 terms each, mixing precedence levels
+std::string expressions_corpus(size_t size) {
+    const size_t width = 64;
+    const char *operators[] = { " + ", " * ", " - ", " & ", " | ", " ^ " };
+    std::stringstream source;
+    source << "mut a: int64 = 3;\nmut b: int64 = 5;\nmut x: int64 = 0;\n";
+    for (size_t statement = 0; statement < std::max<size_t>(size / width, 1); statement++) {
+        source << "x = a";
+        for (size_t term = 1; term < width; term++) {
+            source << operators[(statement + term) % 6] << (term % 3 == 0 ? "b" : term % 3 == 1 ? "(a + 1)" : "7");
+        }
+        source << ";\n";
+    }
+    source << "exit(x);\n";
+
+    return source.str();
+}
+
+// Thousands of distinct variables, all live in the same scope
+std::string identifiers_corpus(size_t size) {
+    std::stringstream source;
+    for (size_t index = 0; index < size; index++) {
+        source << "mut variable" << index << ": int64 = " << index % 100 << ";\n";
+    }
+    source << "mut x: int64 = 0;\n";
+    for (size_t index = 0; index < size; index += 7) {
+        source << "x = x + variable" << index << ";\n";
+    }
+    source << "exit(x);\n";
+
+    return source.str();
+}
+
+struct Shape {
+    std::string name;
+    std::function<std::string(size_t)> generate;
+};
+
+const std::vector<Shape> shapes = {
+    { "statements", statements_corpus },
+    { "nesting", nesting_corpus },
+    { "expressions", expressions_corpus },
+    { "identifiers", identifiers_corpus },
+};
+
+
+struct PhaseResult {
+    std::string name;
+    double median_seconds = 0;
+    CounterSample counters{}; // Per run
+};
+
+// Runs a phase the given number of times, setting it up again outside of the timed part before every run
+PhaseResult measure(const std::string &name, size_t repeat, const PerfCounters &perf,
+                    const std::function<std::function<void()>()> &setup) {
+    std::vector<double> seconds;
+    CounterSample total{};
+    for (size_t run = 0; run < repeat; run++) {
+        std::function<void()> phase = setup();
+        perf.start();
+        auto start = std::chrono::steady_clock::now();
+        phase();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        CounterSample sample = perf.stop();
+        seconds.push_back(elapsed.count());
+        total.instructions += sample.instructions;
+        total.cycles += sample.cycles;
+        total.cache_misses += sample.cache_misses;
+    }
+    std::sort(seconds.begin(), seconds.end());
+
+    return { .name = name, .median_seconds = seconds[seconds.size() / 2],
+             .counters = { .instructions = total.instructions / repeat, .cycles = total.cycles / repeat,
+                           .cache_misses = total.cache_misses / repeat } };
+}
+
+void print_phase(std::ostream &out, const PhaseResult &phase, size_t bytes, size_t tokens, bool counters) {
+    out << "        \"" << phase.name << "\": { \"median_seconds\": " << phase.median_seconds
+        << ", \"mb_per_second\": " << static_cast<double>(bytes) / 1e6 / phase.median_seconds
+        << ", \"tokens_per_second\": " << static_cast<double>(tokens) / phase.median_seconds;
+    if (counters) {
+        out << ", \"instructions\": " << phase.counters.instructions << ", \"cycles\": " << phase.counters.cycles
+            << ", \"cache_misses\": " << phase.counters.cache_misses;
+    }
+    else {
+        out << ", \"instructions\": null, \"cycles\": null, \"cache_misses\": null";
+    }
+    out << " }";
+}
+
+
+int main(int argc, char **argv) {
+    std::optional<std::string> only_shape;
+    size_t size = 2000;
+    size_t repeat = 5;
+    std::optional<std::string> output_file;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--shape=", 8) == 0) {
+            only_shape = argv[arg] + 8;
+        }
+        else if (strncmp(argv[arg], "--size=", 7) == 0) {
+            size = std::stoul(argv[arg] + 7);
+        }
+        else if (strncmp(argv[arg], "--repeat=", 9) == 0) {
+            repeat = std::max<size_t>(std::stoul(argv[arg] + 9), 1);
+        }
+        else if (strncmp(argv[arg], "--output=", 9) == 0) {
+            output_file = argv[arg] + 9;
+        }
+        else {
+            std::cerr << "usage: cer_bench [--shape=statements|nesting|expressions|identifiers] [--size=N] [--repeat=N] "
+                      << "[--output=file.json]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (only_shape.has_value() && std::none_of(shapes.begin(), shapes.end(), [&](const Shape &shape) { return shape.name == only_shape; })) {
+        std::cerr << "cer_bench: unknown shape '" << only_shape.value() << "'" << std::endl;
+        return 1;
+    }
+
+    PerfCounters perf;
+    if (!perf.available()) {
+        std::cerr << "cer_bench: hardware counters are not available, reporting times only" << std::endl;
+    }
+
+    std::stringstream json;
+    json << "{\n    \"size\": " << size << ",\n    \"repeat\": " << repeat << ",\n    \"corpora\": [\n";
+    bool first = true;
+    for (const Shape &shape : shapes) {
+        if (only_shape.has_value() && only_shape.value() != shape.name) {
+            continue;
+        }
+
+        const std::string source = shape.generate(size);
+        const std::string filename = shape.name + ".crm";
+        std::vector<Token> tokens = Tokenizer(source, filename).tokenize();
+        Parser parser(tokens, filename);
+        std::pair<Node::Program, Variables> program;
+        try {
+            program = parser.parse_program();
+        }
+        catch (const std::bad_alloc&) {
+            std::cerr << "cer_bench: the " << shape.name << " corpus doesn't fit in the parser's arena, try a smaller --size" << std::endl;
+            return 1;
+        }
+        if (parser.diagnostics().has_errors()) {
+            std::cerr << "cer_bench: the " << shape.name << " corpus doesn't compile" << std::endl;
+            return 1;
+        }
+
+        std::vector<PhaseResult> phases;
+        phases.push_back(measure("tokenize", repeat, perf, [&]() {
+            auto tokenizer = std::make_shared<Tokenizer>(source, filename);
+            return std::function<void()>([tokenizer]() { (void)tokenizer->tokenize(); });
+        }));
+        phases.push_back(measure("parse", repeat, perf, [&]() {
+            auto run_parser = std::make_shared<Parser>(tokens, filename);
+            return std::function<void()>([run_parser]() { (void)run_parser->parse_program(); });
+        }));
+        phases.push_back(measure("codegen", repeat, perf, [&]() {
+            auto generator = std::make_shared<CodeGenerator>(program.first, program.second);
+            return std::function<void()>([generator]() { (void)generator->generate_program(); });
+        }));
+
+        json << (first ? "" : ",\n") << "        { \"shape\": \"" << shape.name << "\", \"bytes\": " << source.size()
+             << ", \"tokens\": " << tokens.size() << ", \"ast_nodes\": " << parser.nodes() << ", \"phases\": {\n";
+        for (size_t index = 0; index < phases.size(); index++) {
+            json << (index == 0 ? "" : ",\n") << "    ";
+            print_phase(json, phases[index], source.size(), tokens.size(), perf.available());
+        }
+        json << "\n        } }";
+        first = false;
+    }
+    json << "\n    ]\n}\n";
+
+    if (output_file.has_value()) {
+        std::ofstream(output_file.value()) << json.str();
+    }
+    else {
+        std::cout << json.str();
+    }
+
+    return 0;
+}
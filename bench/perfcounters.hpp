@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+struct CounterSample {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t cache_misses = 0;
+};
+
+// Hardware counters read as one group, so they cover exactly the same instructions. They count either the
+// calling thread between start and stop, or another process from its next exec on. Containers and kernels with
+// perf_event_paranoid set high don't allow them, and everything still runs without
+class PerfCounters {
+    public:
+        PerfCounters() : PerfCounters(0, false) {}
+
+        // For a child that is waiting to exec, counting starts when it does and stops when it exits
+        static PerfCounters for_exec(pid_t pid) {
+            return PerfCounters(pid, true);
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        PerfCounters(PerfCounters &&other) noexcept : m_leader(other.m_leader)
+                                                    , m_instructions(other.m_instructions)
+                                                    , m_cache_misses(other.m_cache_misses) {
+            other.m_leader = other.m_instructions = other.m_cache_misses = -1;
+        }
+
+        ~PerfCounters() {
+            close_all();
+        }
+
+        [[nodiscard]] bool available() const {
+            return m_leader >= 0;
+        }
+
+        void start() const {
+            if (available()) {
+                ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+        }
+
+        [[nodiscard]] CounterSample stop() const {
+            if (available()) {
+                ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            }
+
+            return read_values();
+        }
+
+        // The values come in the order the counters were opened in
+        [[nodiscard]] CounterSample read_values() const {
+            if (!available()) {
+                return {};
+            }
+
+            struct { uint64_t count; uint64_t values[3]; } group{};
+            if (read(m_leader, &group, sizeof(group)) != sizeof(group)) {
+                return {};
+            }
+
+            return { .instructions = group.values[1], .cycles = group.values[0], .cache_misses = group.values[2] };
+        }
+
+    private:
+        int m_leader = -1;
+        int m_instructions = -1;
+        int m_cache_misses = -1;
+
+        PerfCounters(pid_t pid, bool on_exec) {
+            m_leader = open_counter(PERF_COUNT_HW_CPU_CYCLES, pid, -1, on_exec);
+            if (m_leader < 0) {
+                return;
+            }
+            m_instructions = open_counter(PERF_COUNT_HW_INSTRUCTIONS, pid, m_leader, on_exec);
+            m_cache_misses = open_counter(PERF_COUNT_HW_CACHE_MISSES, pid, m_leader, on_exec);
+            if (m_instructions < 0 || m_cache_misses < 0) {
+                close_all();
+            }
+        }
+
+        static int open_counter(uint64_t config, pid_t pid, int group, bool on_exec) {
+            perf_event_attr attributes{};
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.size = sizeof(attributes);
+            attributes.config = config;
+            attributes.disabled = group == -1 ? 1 : 0;
+            attributes.enable_on_exec = on_exec && group == -1 ? 1 : 0;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_GROUP;
+
+            return static_cast<int>(syscall(SYS_perf_event_open, &attributes, pid, -1, group, 0));
+        }
+
+        void close_all() {
+            for (int *counter : { &m_cache_misses, &m_instructions, &m_leader }) {
+                if (*counter >= 0) {
+                    close(*counter);
+                    *counter = -1;
+                }
+            }
+        }
+};
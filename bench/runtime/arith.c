@@ -0,0 +1,12 @@
+// Multiplies, divides and adds through a linear congruential generator
+#include <stdint.h>
+
+int main(void) {
+    int64_t x = 12345;
+    int64_t sum = 0;
+    for (int64_t i = 0; i < 20000000; i = i + 1) {
+        x = (x * 1103515245 + 12345) % 2147483648;
+        sum = sum + x / 7 - i * 3;
+    }
+    return (int)(sum % 256);
+}
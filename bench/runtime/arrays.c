@@ -0,0 +1,26 @@
+// Whole array arithmetic on int32 arrays that stay in the L1 cache, wrapping on overflow like cer does
+#include <stdint.h>
+
+int32_t a[1024];
+int32_t b[1024];
+int32_t c[1024];
+
+int main(void) {
+    for (int64_t i = 0; i < 1024; i = i + 1) {
+        a[i] = i;
+        b[i] = 3 * i + 1;
+    }
+    for (int64_t r = 0; r < 100000; r = r + 1) {
+        for (int i = 0; i < 1024; i++) {
+            c[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]) ^ c[i];
+        }
+        for (int i = 0; i < 1024; i++) {
+            a[i] = (int32_t)((uint32_t)c[i] - (uint32_t)a[i]) ^ b[i];
+        }
+    }
+    int64_t sum = 0;
+    for (int64_t i = 0; i < 1024; i = i + 1) {
+        sum = sum + (int64_t)c[i] * 3 + a[i];
+    }
+    return (int)(sum / 1024 % 256);
+}
@@ -0,0 +1,14 @@
+// Shifts, xors and population counts of a xorshift generator
+#include <stdint.h>
+
+int main(void) {
+    int64_t s = 88172645463325252;
+    int64_t acc = 0;
+    for (int64_t i = 0; i < 20000000; i = i + 1) {
+        s = s ^ (int64_t)((uint64_t)s << 13);
+        s = s ^ ((s >> 7) & 144115188075855871);
+        s = s ^ (int64_t)((uint64_t)s << 17);
+        acc = acc + __builtin_popcountll((uint64_t)(s & 4294967295)) + (s & ~acc & 255);
+    }
+    return (int)(acc % 256);
+}
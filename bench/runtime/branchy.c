@@ -0,0 +1,30 @@
+// A decision tree over hashed values, with one branch the predictor can learn and several it can't
+#include <stdint.h>
+
+int main(void) {
+    int64_t a = 0;
+    int64_t b = 0;
+    int64_t c = 0;
+    int64_t d = 0;
+    for (int64_t i = 0; i < 20000000; i = i + 1) {
+        int64_t v = (i * 2654435761) % 1000;
+        if (v < 500) {
+            if (v < 250) {
+                a = a + 1;
+            }
+            else {
+                b = b + v;
+            }
+        }
+        else if (v < 900) {
+            c = c ^ v;
+        }
+        else {
+            d = d + 3;
+        }
+        if (i % 1024 == 0) {
+            d = d + 1;
+        }
+    }
+    return (int)((a + b + c + d) % 256);
+}
@@ -0,0 +1,21 @@
+// Eight workers adding hashed values into shared totals under conditions, where every add has to be atomic.
+// The totals are checked against the same sums taken on one thread
+#include <stdint.h>
+
+int main(void) {
+    int64_t small = 0;
+    int64_t balance = 0;
+    for (int64_t i = 0; i < 16000000; i = i + 1) {
+        int64_t v = (i * 2654435761) % 997;
+        if (v < 300) {
+            small = small + v;
+        }
+        if (v % 2 == 0) {
+            balance = balance + 3;
+        }
+        else {
+            balance = balance - 1;
+        }
+    }
+    return (int)((small + balance) % 256);
+}
@@ -0,0 +1,234 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "perfcounters.hpp"
+
+#ifndef CER_BENCH_KERNELS
+#define CER_BENCH_KERNELS "bench/runtime"
+#endif
+
+
+// Every kernel is a .crm program with a C twin next to it that computes the same thing and exits with the same code
+const std::vector<std::string> kernels = { "arith", "bitwise", "branchy", "arrays", "reduce" };
+
+struct Variant {
+    std::string name;
+    std::string binary;
+};
+
+struct Measurement {
+    int exit_code = -1;
+    uint64_t median = 0; // Cycles, or nanoseconds when the counters aren't available
+};
+
+
+// Runs the binary once, pinned to the core when one is given. The child waits on a pipe until the counters are
+// attached to it, and they only start counting at its exec, so neither fork nor the wait is measured
+std::optional<std::pair<int, uint64_t>> run_once(const std::string &binary, std::optional<int> core, bool &counters) {
+    int release[2];
+    if (pipe(release) != 0) {
+        return {};
+    }
+
+    pid_t child = fork();
+    if (child < 0) {
+        return {};
+    }
+    if (child == 0) {
+        close(release[1]);
+        if (core.has_value()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(core.value(), &cpus);
+            sched_setaffinity(0, sizeof(cpus), &cpus);
+        }
+        char go;
+        (void)read(release[0], &go, 1);
+        close(release[0]);
+        execl(binary.c_str(), binary.c_str(), nullptr);
+        _exit(127);
+    }
+
+    close(release[0]);
+    PerfCounters perf = PerfCounters::for_exec(child);
+    counters = perf.available();
+    auto start = std::chrono::steady_clock::now();
+    close(release[1]);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    if (!WIFEXITED(status)) {
+        return {};
+    }
+
+    uint64_t cost = counters ? perf.read_values().cycles : static_cast<uint64_t>(elapsed.count());
+    return std::make_pair(WEXITSTATUS(status), cost);
+}
+
+std::optional<Measurement> measure(const std::string &binary, size_t runs, std::optional<int> core, bool &counters) {
+    std::vector<uint64_t> costs;
+    int exit_code = -1;
+    for (size_t run = 0; run < runs; run++) {
+        std::optional<std::pair<int, uint64_t>> result = run_once(binary, core, counters);
+        if (!result.has_value()) {
+            return {};
+        }
+        exit_code = result->first;
+        costs.push_back(result->second);
+    }
+    std::sort(costs.begin(), costs.end());
+
+    return Measurement{ .exit_code = exit_code, .median = costs[costs.size() / 2] };
+}
+
+bool build(const std::string &command) {
+    if (system(command.c_str()) != 0) {
+        std::cerr << "runtime_bench: '" << command << "' failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    std::string cer = (std::filesystem::absolute(argv[0]).parent_path() / "cer").string();
+    std::string cc = "cc";
+    std::string cer_flags;
+    std::string kernel_dir = CER_BENCH_KERNELS;
+    std::optional<std::string> only_kernel;
+    std::optional<int> core;
+    size_t runs = 11;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--cer=", 6) == 0) {
+            cer = std::filesystem::absolute(argv[arg] + 6).string();
+        }
+        else if (strncmp(argv[arg], "--cc=", 5) == 0) {
+            cc = argv[arg] + 5;
+        }
+        else if (strncmp(argv[arg], "--cer-flags=", 12) == 0) {
+            cer_flags = argv[arg] + 12;
+        }
+        else if (strncmp(argv[arg], "--kernels=", 10) == 0) {
+            kernel_dir = argv[arg] + 10;
+        }
+        else if (strncmp(argv[arg], "--kernel=", 9) == 0) {
+            only_kernel = argv[arg] + 9;
+        }
+        else if (strncmp(argv[arg], "--core=", 7) == 0) {
+            core = std::stoi(argv[arg] + 7);
+        }
+        else if (strncmp(argv[arg], "--runs=", 7) == 0) {
+            runs = std::max<size_t>(std::stoul(argv[arg] + 7), 1);
+        }
+        else {
+            std::cerr << "usage: cer_runtime_bench [--kernel=name] [--runs=N] [--core=N] [--cer=path] [--cer-flags=flags] "
+                      << "[--cc=compiler] [--kernels=dir]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (only_kernel.has_value() && std::find(kernels.begin(), kernels.end(), only_kernel.value()) == kernels.end()) {
+        std::cerr << "runtime_bench: unknown kernel '" << only_kernel.value() << "'" << std::endl;
+        return 1;
+    }
+
+    char work_template[] = "/tmp/cer_runtime_bench.XXXXXX";
+    if (mkdtemp(work_template) == nullptr) {
+        std::cerr << "runtime_bench: can't create a work directory" << std::endl;
+        return 1;
+    }
+    const std::filesystem::path work = work_template;
+    const std::filesystem::path sources = std::filesystem::absolute(kernel_dir);
+
+    bool counters = false;
+    bool failed = false;
+    std::vector<std::vector<std::string>> rows;
+    for (const std::string &kernel : kernels) {
+        if (only_kernel.has_value() && only_kernel.value() != kernel) {
+            continue;
+        }
+
+        // cer writes its out.asm and out.o to the working directory, so it runs inside the work directory
+        const std::string crm = (sources / (kernel + ".crm")).string();
+        const std::string c = (sources / (kernel + ".c")).string();
+        std::vector<Variant> variants = {
+            { "cer", (work / (kernel + "_cer")).string() },
+            { "cc -O0", (work / (kernel + "_O0")).string() },
+            { "cc -O2", (work / (kernel + "_O2")).string() },
+        };
+        if (!build("cd " + work.string() + " && " + cer + " " + cer_flags + " -o " + variants[0].binary + " " + crm)
+         || !build(cc + " -O0 -o " + variants[1].binary + " " + c)
+         || !build(cc + " -O2 -o " + variants[2].binary + " " + c)) {
+            failed = true;
+            continue;
+        }
+
+        std::vector<Measurement> measurements;
+        for (const Variant &variant : variants) {
+            std::optional<Measurement> measurement = measure(variant.binary, runs, core, counters);
+            if (!measurement.has_value()) {
+                std::cerr << "runtime_bench: " << kernel << " built by " << variant.name << " didn't exit normally" << std::endl;
+                failed = true;
+                break;
+            }
+            measurements.push_back(measurement.value());
+        }
+        if (measurements.size() != variants.size()) {
+            continue;
+        }
+
+        // A fast wrong answer isn't worth reporting
+        if (measurements[0].exit_code != measurements[1].exit_code || measurements[0].exit_code != measurements[2].exit_code) {
+            std::cerr << "runtime_bench: " << kernel << " exits with " << measurements[0].exit_code << " built by cer, but "
+                      << measurements[1].exit_code << " and " << measurements[2].exit_code << " built by " << cc << std::endl;
+            failed = true;
+            continue;
+        }
+
+        auto ratio = [](uint64_t value, uint64_t reference) {
+            std::stringstream text;
+            text << std::fixed << std::setprecision(2) << static_cast<double>(value) / static_cast<double>(std::max<uint64_t>(reference, 1)) << "x";
+            return text.str();
+        };
+        rows.push_back({ kernel, std::to_string(measurements[0].median), std::to_string(measurements[1].median),
+                         std::to_string(measurements[2].median), ratio(measurements[0].median, measurements[1].median),
+                         ratio(measurements[0].median, measurements[2].median) });
+    }
+    std::filesystem::remove_all(work);
+
+    if (!counters) {
+        std::cerr << "runtime_bench: hardware counters are not available, reporting wall time in nanoseconds" << std::endl;
+    }
+    const std::string unit = counters ? " cycles" : " ns";
+    const std::vector<std::string> header = { "kernel", "cer" + unit, "-O0" + unit, "-O2" + unit, "cer/-O0", "cer/-O2" };
+    std::cout << std::left << std::setw(10) << header[0] << std::right;
+    for (size_t column = 1; column < header.size(); column++) {
+        std::cout << std::setw(16) << header[column];
+    }
+    std::cout << std::endl;
+    for (const std::vector<std::string> &row : rows) {
+        std::cout << std::left << std::setw(10) << row[0] << std::right;
+        for (size_t column = 1; column < row.size(); column++) {
+            std::cout << std::setw(16) << row[column];
+        }
+        std::cout << std::endl;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -3,11 +3,14 @@
 #include <cstddef>
 #include <memory>
 #include <utility>
+#include <vector>
+#include <mutex>
+#include <type_traits>
 
 class ArenaAllocator {
     public:
         explicit ArenaAllocator(size_t max_num_bytes) : m_size { max_num_bytes }
-                                                      , m_buffer { new std::byte[max_num_bytes] }
+                                                      , m_buffer { take_buffer(max_num_bytes) }
                                                       , m_offset { m_buffer } {
 
         }
@@ -16,7 +19,9 @@ class ArenaAllocator {
 
         ArenaAllocator(ArenaAllocator&& other) noexcept : m_size { std::exchange(other.m_size, 0) }
                                                         , m_buffer { std::exchange(other.m_buffer, nullptr) }
-                                                        , m_offset { std::exchange(other.m_offset, nullptr) } {
+                                                        , m_offset { std::exchange(other.m_offset, nullptr) }
+                                                        , m_allocations { std::exchange(other.m_allocations, 0) }
+                                                        , m_destructors { std::exchange(other.m_destructors, nullptr) } {
 
         }
 
@@ -24,33 +29,103 @@ class ArenaAllocator {
             std::swap(m_size, other.m_size);
             std::swap(m_buffer, other.m_buffer);
             std::swap(m_offset, other.m_offset);
+            std::swap(m_allocations, other.m_allocations);
+            std::swap(m_destructors, other.m_destructors);
             return *this;
         }
 
-        template <typename type> [[nodiscard]] type* alloc()
-        {
-            size_t remaining_num_bytes = m_size - static_cast<size_t>(m_offset - m_buffer);
-            auto pointer = static_cast<void*>(m_offset);
-            const auto aligned_address = std::align(alignof(type), sizeof(type), pointer, remaining_num_bytes);
-            if (aligned_address == nullptr) {
-                throw std::bad_alloc {};
-            }
-            m_offset = static_cast<std::byte*>(aligned_address) + sizeof(type);
-            return static_cast<type*>(aligned_address);
+        // Nodes hold tokens and vectors, so they have to be constructed before the parser assigns to them
+        template <typename type> [[nodiscard]] type* alloc() {
+            return emplace<type>();
         }
 
+        // Objects that own memory, like the vectors and strings of nodes, are destroyed with the arena, so a long
+        // running process doesn't leak them on every compile
         template <typename type, typename... Args> [[nodiscard]] type* emplace(Args&&... args) {
-            const auto allocated_memory = alloc<type>();
-            return new (allocated_memory) type { std::forward<Args>(args)... };
+            const auto allocated_memory = allocate<type>();
+            type *object = new (allocated_memory) type { std::forward<Args>(args)... };
+            m_allocations++;
+            if constexpr (!std::is_trivially_destructible_v<type>) {
+                m_destructors = new (allocate<Destructor>()) Destructor {
+                    .object = object,
+                    .destroy = [](void *pointer) { static_cast<type*>(pointer)->~type(); },
+                    .next = m_destructors,
+                };
+            }
+            return object;
         }
 
+        // Bytes handed out so far, alignment padding included
+        [[nodiscard]] size_t used() const {
+            return static_cast<size_t>(m_offset - m_buffer);
+        }
+
+        [[nodiscard]] size_t allocations() const {
+            return m_allocations;
+        }
 
         ~ArenaAllocator() {
-            delete[] m_buffer;
+            // Newest first, the reverse of the order they were made in
+            for (const Destructor *destructor = m_destructors; destructor != nullptr; destructor = destructor->next) {
+                destructor->destroy(destructor->object);
+            }
+            give_back(m_buffer, m_size);
         }
 
     private:
+        // Lives in the arena next to the object it destroys
+        struct Destructor {
+            void *object;
+            void (*destroy)(void*);
+            const Destructor *next;
+        };
+
+        // Buffers of arenas that are gone, kept for the next arena of the same size. A long running process like
+        // cer --server then parses into memory that is already mapped instead of faulting in new pages every compile
+        inline static std::mutex spare_mutex;
+        inline static std::vector<std::pair<std::byte*, size_t>> spare_buffers;
+        static constexpr size_t max_spare_buffers = 4;
+
         size_t m_size{};
         std::byte* m_buffer{};
         std::byte* m_offset{};
+        size_t m_allocations{};
+        const Destructor *m_destructors{};
+
+        static std::byte* take_buffer(size_t size) {
+            std::lock_guard<std::mutex> lock(spare_mutex);
+            for (auto spare = spare_buffers.begin(); spare != spare_buffers.end(); spare++) {
+                if (spare->second == size) {
+                    std::byte *buffer = spare->first;
+                    spare_buffers.erase(spare);
+                    return buffer;
+                }
+            }
+
+            return new std::byte[size];
+        }
+
+        static void give_back(std::byte *buffer, size_t size) {
+            if (buffer == nullptr) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(spare_mutex);
+            if (spare_buffers.size() < max_spare_buffers) {
+                spare_buffers.emplace_back(buffer, size);
+            }
+            else {
+                delete[] buffer;
+            }
+        }
+
+        template <typename type> [[nodiscard]] void* allocate() {
+            size_t remaining_num_bytes = m_size - static_cast<size_t>(m_offset - m_buffer);
+            auto pointer = static_cast<void*>(m_offset);
+            const auto aligned_address = std::align(alignof(type), sizeof(type), pointer, remaining_num_bytes);
+            if (aligned_address == nullptr) {
+                throw std::bad_alloc {};
+            }
+            m_offset = static_cast<std::byte*>(aligned_address) + sizeof(type);
+            return aligned_address;
+        }
 };
\ No newline at end of file
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <vector>
+#include <variant>
+#include <optional>
+
+#include "token.hpp"
+
+
+// The tree the parser builds, and the binary AST reader builds again from a file
+namespace Node {
+    struct Expression;
+    struct Statement;
+    struct StmtIfNext;
+
+    struct TermInt {
+        Token int_lit;
+    };
+
+    struct TermBool {
+        Token bool_lit;
+    };
+
+    struct TermIdent {
+        Token identifier;
+    };
+
+    struct TermExpr {
+        Expression *expr;
+    };
+
+    struct TermCall {
+        Token identifier;
+        std::vector<Expression*> args;
+    };
+
+    struct TermIndex {
+        Token identifier;
+        Expression *index{};
+    };
+
+    // A call to a function the compiler provides itself, like popcount
+    struct TermBuiltin {
+        Token identifier;
+        std::vector<Expression*> args;
+    };
+
+    struct BitNot {
+        Expression *expr;
+    };
+
+    struct Term {
+        std::variant<TermInt*, TermBool*, TermIdent*, TermExpr*, TermCall*, TermIndex*, TermBuiltin*, BitNot*> var;
+    };
+
+    struct BinAdd {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BinSubtract {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BinMultiply {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BinDivide {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BinModulus {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BitAnd{
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BitOr {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BitXor {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct ShiftLeft {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct ShiftRight {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpEqual {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpNotEqual {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpLess {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpLessEqual {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpGreater {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct CmpGreaterEqual {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct LogicAnd {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct LogicOr {
+        Expression *left_side;
+        Expression *right_side;
+    };
+
+    struct BinExpr {
+        std::variant<BinAdd*, BinSubtract*, BinMultiply*, BinDivide*, BinModulus*, BitAnd*, BitOr*, BitXor*,
+                     ShiftLeft*, ShiftRight*, CmpEqual*, CmpNotEqual*, CmpLess*, CmpLessEqual*, CmpGreater*, CmpGreaterEqual*,
+                     LogicAnd*, LogicOr*> bin_expr;
+    };
+
+    struct Expression {
+        std::variant<Term*, BinExpr*> var;
+    };
+
+    struct StmtExit {
+        Expression *expr;
+    };
+
+    // Writes the value in decimal and a newline to stdout
+    struct StmtPrint {
+        Expression *expr;
+    };
+
+    struct StmtMut {
+        Token identifier;
+        Token type{ .type = TokenType::int64 };
+        std::optional<Expression*> expr{};
+        std::optional<size_t> length{}; // Arrays only
+    };
+
+    struct StmtIdent {
+        Token identifier;
+        Expression *expr{};
+    };
+
+    // Assignment to a single element of an array
+    struct StmtIndex {
+        Token identifier;
+        Expression *index{};
+        Expression *expr{};
+    };
+
+    // Assignment to every element of an array from an elementwise expression over arrays of the same shape
+    struct StmtArray {
+        Token identifier;
+        Expression *expr{};
+    };
+
+    struct Scope {
+        std::vector<Statement*> stmts;
+    };
+
+    struct StmtElif {
+        Expression *expr{};
+        Scope *scope{};
+        std::optional<StmtIfNext*> next;
+    };
+
+    struct StmtElse {
+        Scope *scope{};
+    };
+
+    struct StmtIfNext {
+        std::variant<StmtElif*, StmtElse*> var;
+    };
+
+    struct StmtIf {
+        Expression *expr{};
+        Scope *scope{};
+        std::optional<StmtIfNext*> next;
+    };
+
+    struct StmtWhile {
+        Expression *expr{};
+        Scope *scope{};
+    };
+
+    struct StmtFor {
+        std::optional<Statement*> init;
+        std::optional<Expression*> expr;
+        std::optional<StmtIdent*> step;
+        Scope *scope{};
+    };
+
+    struct StmtCall {
+        TermCall *call{};
+    };
+
+    struct StmtReturn {
+        Token token;
+        std::optional<Expression*> expr;
+    };
+
+    // A scope whose cycles and entries are counted under a name, regions with the same name share their counts
+    struct StmtProfile {
+        Token name;
+        Scope *scope{};
+    };
+
+    // A scope run once on each of a number of threads, which worker() tells apart. It ends when every thread is done
+    struct StmtParallel {
+        Expression *count{};
+        Scope *scope{};
+    };
+
+    struct Statement {
+        std::variant<StmtExit*, StmtMut*, StmtIdent*, Scope*, StmtIf*, StmtWhile*, StmtFor*, StmtCall*, StmtReturn*,
+                     StmtIndex*, StmtArray*, StmtProfile*, StmtPrint*, StmtParallel*> var;
+        int line_no{}; // Line of the statement's first token
+    };
+
+    struct Parameter {
+        Token identifier;
+        Token type;
+    };
+
+    struct Function {
+        Token identifier;
+        std::vector<Parameter> params;
+        std::optional<Token> return_type;
+        Scope *scope{};
+    };
+
+    struct Program {
+        std::vector<Statement*> statements;
+        std::vector<Function*> functions;
+    };
+}
@@ -0,0 +1,1069 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ast.hpp"
+#include "error.hpp"
+#include "xxhash.hpp"
+#include "semantics.hpp"
+#include "arenaallocator.hpp"
+
+
+// The binary AST --emit=ast-bin writes, which cer compiles without tokenizing or parsing the source again.
+//
+// The file is little endian 32 bit words. It starts with a header of the magic, the format version, the offset of
+// the program record, the hash of the source it was parsed from, the name of that source, the size of the file and
+// a checksum of the rest.
+// Every node after it is a record at a 4 byte aligned offset, and refers to the nodes under it by their offset from
+// the start of the file, 0 when there is none. Nothing in the file depends on where it is mapped, and records are
+// written children first, so every reference points back towards the start of the file. Strings are shared, every
+// other record has exactly one node referring to it.
+//
+// Records, in words:
+//   string       length, then the bytes, padded to a whole word
+//   token        type, line, column, string or 0, then the value of an integer literal in two words, low first
+//   expression   kind, then for a term (kind is the index in Node::Term):
+//                  int, bool, identifier      token
+//                  parentheses, ~             expression
+//                  call, builtin              token, count, expressions
+//                  index                      token, index expression
+//                and for a binary operation (kind is 8 plus the index in Node::BinExpr) left, right
+//   statement    kind (the index in Node::Statement), line, then:
+//                  exit                       expression
+//                  mut                        token, type token, expression, has length, length
+//                  assignment                 token, expression
+//                  scope                      scope
+//                  if                         expression, scope, else
+//                  while                      expression, scope
+//                  for                        statement, expression, step, scope
+//                  call                       expression, which is a call
+//                  return                     token, expression
+//                  element assignment         token, index expression, expression
+//                  array assignment           token, expression
+//                  profile                    token, scope
+//                  print                      expression
+//                  parallel                   expression, scope
+//   scope        count, statements
+//   else         0 and expression, scope, else for an elif, 1 and scope for an else
+//   step         token, expression
+//   function     token, has return type, return type token, count, parameter tokens in pairs, scope
+//   program      count, statements, count, functions
+struct AstFormat {
+    static constexpr char magic[8] = { 'C', 'E', 'R', 'A', 'S', 'T', '\0', '\0' };
+    // Goes up whenever the records change, older files are refused rather than misread
+    static constexpr uint32_t version = 4;
+    // Kinds of expression records, a call is also what a call statement refers to
+    static constexpr uint32_t call_kind = 4;
+    static constexpr uint32_t binary_kind = 8;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t program;
+        uint64_t source_hash;
+        uint32_t filename;
+        uint32_t size;
+        uint64_t checksum; // XXH64 of everything after the header
+    };
+};
+
+
+class AstWriter {
+    public:
+        [[nodiscard]] static std::string write(const Node::Program &program, uint64_t source_hash, const std::string &filename) {
+            AstWriter writer;
+            writer.m_words.resize(sizeof(AstFormat::Header) / sizeof(uint32_t));
+            const uint32_t filename_offset = writer.string(filename);
+            const uint32_t program_offset = writer.program(program);
+
+            AstFormat::Header header{};
+            std::memcpy(header.magic, AstFormat::magic, sizeof(header.magic));
+            header.version = AstFormat::version;
+            header.program = program_offset;
+            header.source_hash = source_hash;
+            header.filename = filename_offset;
+            header.size = static_cast<uint32_t>(writer.m_words.size() * sizeof(uint32_t));
+            header.checksum = XXHash64::hash(reinterpret_cast<const std::byte*>(writer.m_words.data()) + sizeof(header),
+                                             header.size - sizeof(header));
+            std::memcpy(writer.m_words.data(), &header, sizeof(header));
+
+            return { reinterpret_cast<const char*>(writer.m_words.data()), header.size };
+        }
+
+    private:
+        std::vector<uint32_t> m_words;
+        std::map<std::string, uint32_t> m_strings; // Identifiers repeat a lot, each one is written once
+
+        uint32_t record(const std::vector<uint32_t> &words) {
+            const auto offset = static_cast<uint32_t>(m_words.size() * sizeof(uint32_t));
+            m_words.insert(m_words.end(), words.begin(), words.end());
+            return offset;
+        }
+
+        uint32_t string(const std::string &text) {
+            if (auto written = m_strings.find(text); written != m_strings.end()) {
+                return written->second;
+            }
+            std::vector<uint32_t> words((text.size() + sizeof(uint32_t) - 1) / sizeof(uint32_t) + 1);
+            words[0] = static_cast<uint32_t>(text.size());
+            std::memcpy(&words[1], text.data(), text.size());
+
+            return m_strings[text] = record(words);
+        }
+
+        void token(std::vector<uint32_t> &words, const Token &token) {
+            words.push_back(static_cast<uint32_t>(token.type));
+            words.push_back(static_cast<uint32_t>(token.line_no));
+            words.push_back(static_cast<uint32_t>(token.column_no));
+            words.push_back(token.value.has_value() ? string(token.value.value()) : 0);
+            words.push_back(static_cast<uint32_t>(static_cast<uint64_t>(token.int_value)));
+            words.push_back(static_cast<uint32_t>(static_cast<uint64_t>(token.int_value) >> 32));
+        }
+
+        void expressions(std::vector<uint32_t> &words, const std::vector<Node::Expression*> &args) {
+            std::vector<uint32_t> offsets;
+            for (const Node::Expression *arg : args) {
+                offsets.push_back(expression(arg));
+            }
+            words.push_back(static_cast<uint32_t>(offsets.size()));
+            words.insert(words.end(), offsets.begin(), offsets.end());
+        }
+
+        uint32_t expression(const Node::Expression *expression_node) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression_node->var)) {
+                const auto kind = static_cast<uint32_t>(AstFormat::binary_kind + (*binary_expression)->bin_expr.index());
+                return std::visit([&](const auto *operation) {
+                    const uint32_t left = expression(operation->left_side);
+                    const uint32_t right = expression(operation->right_side);
+                    return record({ kind, left, right });
+                }, (*binary_expression)->bin_expr);
+            }
+
+            const Node::Term *term = std::get<Node::Term*>(expression_node->var);
+            std::vector<uint32_t> words = { static_cast<uint32_t>(term->var.index()) };
+            struct TermVisitor {
+                AstWriter &writer;
+                std::vector<uint32_t> &words;
+
+                void operator() (const Node::TermInt *int_term) const {
+                    writer.token(words, int_term->int_lit);
+                }
+
+                void operator() (const Node::TermBool *bool_term) const {
+                    writer.token(words, bool_term->bool_lit);
+                }
+
+                void operator() (const Node::TermIdent *identifier_term) const {
+                    writer.token(words, identifier_term->identifier);
+                }
+
+                void operator() (const Node::TermExpr *expression_term) const {
+                    words.push_back(writer.expression(expression_term->expr));
+                }
+
+                void operator() (const Node::TermCall *call_term) const {
+                    writer.token(words, call_term->identifier);
+                    writer.expressions(words, call_term->args);
+                }
+
+                void operator() (const Node::TermIndex *index_term) const {
+                    writer.token(words, index_term->identifier);
+                    words.push_back(writer.expression(index_term->index));
+                }
+
+                void operator() (const Node::TermBuiltin *builtin_term) const {
+                    writer.token(words, builtin_term->identifier);
+                    writer.expressions(words, builtin_term->args);
+                }
+
+                void operator() (const Node::BitNot *bit_not) const {
+                    words.push_back(writer.expression(bit_not->expr));
+                }
+            };
+            std::visit(TermVisitor{ .writer = *this, .words = words }, term->var);
+
+            return record(words);
+        }
+
+        uint32_t optional_expression(const std::optional<Node::Expression*> &expression_node) {
+            return expression_node.has_value() ? expression(expression_node.value()) : 0;
+        }
+
+        uint32_t scope(const Node::Scope *scope_node) {
+            std::vector<uint32_t> offsets;
+            for (const Node::Statement *statement_node : scope_node->stmts) {
+                offsets.push_back(statement(statement_node));
+            }
+            std::vector<uint32_t> words = { static_cast<uint32_t>(offsets.size()) };
+            words.insert(words.end(), offsets.begin(), offsets.end());
+
+            return record(words);
+        }
+
+        uint32_t if_next(const std::optional<Node::StmtIfNext*> &next) {
+            if (!next.has_value()) {
+                return 0;
+            }
+            if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                const uint32_t condition = expression((*elif_statement)->expr);
+                const uint32_t body = scope((*elif_statement)->scope);
+                const uint32_t rest = if_next((*elif_statement)->next);
+                return record({ 0, condition, body, rest });
+            }
+
+            return record({ 1, scope(std::get<Node::StmtElse*>(next.value()->var)->scope) });
+        }
+
+        uint32_t statement(const Node::Statement *statement_node) {
+            std::vector<uint32_t> words = { static_cast<uint32_t>(statement_node->var.index()),
+                                            static_cast<uint32_t>(statement_node->line_no) };
+            struct StatementVisitor {
+                AstWriter &writer;
+                std::vector<uint32_t> &words;
+
+                void operator() (const Node::StmtExit *exit_statement) const {
+                    words.push_back(writer.expression(exit_statement->expr));
+                }
+
+                void operator() (const Node::StmtPrint *print_statement) const {
+                    words.push_back(writer.expression(print_statement->expr));
+                }
+
+                void operator() (const Node::StmtMut *mut_statement) const {
+                    const uint32_t value = writer.optional_expression(mut_statement->expr);
+                    writer.token(words, mut_statement->identifier);
+                    writer.token(words, mut_statement->type);
+                    words.push_back(value);
+                    words.push_back(mut_statement->length.has_value());
+                    words.push_back(static_cast<uint32_t>(mut_statement->length.value_or(0)));
+                }
+
+                void operator() (const Node::StmtIdent *identifier_statement) const {
+                    const uint32_t value = writer.expression(identifier_statement->expr);
+                    writer.token(words, identifier_statement->identifier);
+                    words.push_back(value);
+                }
+
+                void operator() (const Node::Scope *scope) const {
+                    words.push_back(writer.scope(scope));
+                }
+
+                void operator() (const Node::StmtIf *if_statement) const {
+                    const uint32_t condition = writer.expression(if_statement->expr);
+                    const uint32_t body = writer.scope(if_statement->scope);
+                    const uint32_t rest = writer.if_next(if_statement->next);
+                    words.insert(words.end(), { condition, body, rest });
+                }
+
+                void operator() (const Node::StmtWhile *while_statement) const {
+                    const uint32_t condition = writer.expression(while_statement->expr);
+                    const uint32_t body = writer.scope(while_statement->scope);
+                    words.insert(words.end(), { condition, body });
+                }
+
+                void operator() (const Node::StmtFor *for_statement) const {
+                    const uint32_t init = for_statement->init.has_value() ? writer.statement(for_statement->init.value()) : 0;
+                    const uint32_t condition = writer.optional_expression(for_statement->expr);
+                    uint32_t step = 0;
+                    if (for_statement->step.has_value()) {
+                        std::vector<uint32_t> step_words;
+                        const uint32_t value = writer.expression(for_statement->step.value()->expr);
+                        writer.token(step_words, for_statement->step.value()->identifier);
+                        step_words.push_back(value);
+                        step = writer.record(step_words);
+                    }
+                    const uint32_t body = writer.scope(for_statement->scope);
+                    words.insert(words.end(), { init, condition, step, body });
+                }
+
+                void operator() (const Node::StmtCall *call_statement) const {
+                    std::vector<uint32_t> call_words = { AstFormat::call_kind };
+                    writer.token(call_words, call_statement->call->identifier);
+                    writer.expressions(call_words, call_statement->call->args);
+                    words.push_back(writer.record(call_words));
+                }
+
+                void operator() (const Node::StmtReturn *return_statement) const {
+                    const uint32_t value = writer.optional_expression(return_statement->expr);
+                    writer.token(words, return_statement->token);
+                    words.push_back(value);
+                }
+
+                void operator() (const Node::StmtIndex *index_statement) const {
+                    const uint32_t index = writer.expression(index_statement->index);
+                    const uint32_t value = writer.expression(index_statement->expr);
+                    writer.token(words, index_statement->identifier);
+                    words.insert(words.end(), { index, value });
+                }
+
+                void operator() (const Node::StmtArray *array_statement) const {
+                    const uint32_t value = writer.expression(array_statement->expr);
+                    writer.token(words, array_statement->identifier);
+                    words.push_back(value);
+                }
+
+                void operator() (const Node::StmtProfile *profile_statement) const {
+                    const uint32_t body = writer.scope(profile_statement->scope);
+                    writer.token(words, profile_statement->name);
+                    words.push_back(body);
+                }
+
+                void operator() (const Node::StmtParallel *parallel_statement) const {
+                    const uint32_t count = writer.expression(parallel_statement->count);
+                    const uint32_t body = writer.scope(parallel_statement->scope);
+                    words.insert(words.end(), { count, body });
+                }
+            };
+            std::visit(StatementVisitor{ .writer = *this, .words = words }, statement_node->var);
+
+            return record(words);
+        }
+
+        uint32_t function(const Node::Function *function_node) {
+            const uint32_t body = scope(function_node->scope);
+            std::vector<uint32_t> words;
+            token(words, function_node->identifier);
+            words.push_back(function_node->return_type.has_value());
+            token(words, function_node->return_type.value_or(Token{}));
+            words.push_back(static_cast<uint32_t>(function_node->params.size()));
+            for (const Node::Parameter &parameter : function_node->params) {
+                token(words, parameter.identifier);
+                token(words, parameter.type);
+            }
+            words.push_back(body);
+
+            return record(words);
+        }
+
+        uint32_t program(const Node::Program &program_node) {
+            std::vector<uint32_t> statements;
+            for (const Node::Statement *statement_node : program_node.statements) {
+                statements.push_back(statement(statement_node));
+            }
+            std::vector<uint32_t> functions;
+            for (const Node::Function *function_node : program_node.functions) {
+                functions.push_back(function(function_node));
+            }
+            std::vector<uint32_t> words = { static_cast<uint32_t>(statements.size()) };
+            words.insert(words.end(), statements.begin(), statements.end());
+            words.push_back(static_cast<uint32_t>(functions.size()));
+            words.insert(words.end(), functions.begin(), functions.end());
+
+            return record(words);
+        }
+};
+
+
+// Maps a binary AST with a single mmap and rebuilds the tree straight from the mapping into an arena, without the
+// tokenizer or the parser. The mapping stays until the reader goes, and so does the tree, like the parser's. The
+// checksum turns away damaged files, and every offset is still checked against the file and has to point back
+// towards its start, so no file can make the reader run off the mapping or go round in a loop. The tree is then put
+// through the same semantic checks as the parser puts a source through, since code generation relies on them and a
+// file cer didn't write may not pass them
+class AstReader {
+    public:
+        explicit AstReader(const std::string &filename) : m_filename(filename)
+                                                        , m_allocator(1024 * 1024 * 4) {
+            int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            struct stat status{};
+            if (fstat(fd, &status) == 0 && status.st_size > 0) {
+                void *mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    m_data = static_cast<const std::byte*>(mapping);
+                    m_size = static_cast<size_t>(status.st_size);
+                }
+            }
+            close(fd);
+        }
+        AstReader(const AstReader&) = delete;
+        AstReader& operator=(const AstReader&) = delete;
+
+        ~AstReader() {
+            if (m_data != nullptr) {
+                munmap(const_cast<std::byte*>(m_data), m_size);
+            }
+        }
+
+        [[nodiscard]] std::optional<Node::Program> read() {
+            if (m_data == nullptr) {
+                m_diagnostics.error(m_filename, "can't map the AST file", 1, 1, "the whole file");
+                return {};
+            }
+            AstFormat::Header header{};
+            if (m_size < sizeof(header)) {
+                return corrupt("it is too short");
+            }
+            std::memcpy(&header, m_data, sizeof(header));
+            if (std::memcmp(header.magic, AstFormat::magic, sizeof(header.magic)) != 0) {
+                return corrupt("it is not a Cerium AST");
+            }
+            if (header.version != AstFormat::version) {
+                return corrupt("it is version " + std::to_string(header.version) + " of the format, expected "
+                               + std::to_string(AstFormat::version));
+            }
+            if (header.size != m_size) {
+                return corrupt("it is cut short");
+            }
+            if (XXHash64::hash(m_data + sizeof(header), m_size - sizeof(header)) != header.checksum) {
+                return corrupt("it has been damaged");
+            }
+            m_source_hash = header.source_hash;
+
+            try {
+                m_source_filename = string(header.filename, m_size);
+                m_read.assign(m_size / sizeof(uint32_t), false);
+                Node::Program program_node = program(header.program);
+                check(program_node);
+                return program_node;
+            }
+            catch (const Corrupt &corrupt_file) {
+                return corrupt(corrupt_file.reason);
+            }
+        }
+
+        // Of the source the AST was parsed from, which profiles and -g line information refer to
+        [[nodiscard]] uint64_t source_hash() const {
+            return m_source_hash;
+        }
+
+        [[nodiscard]] const std::string& source_filename() const {
+            return m_source_filename;
+        }
+
+        [[nodiscard]] size_t nodes() const {
+            return m_allocator.allocations();
+        }
+
+        [[nodiscard]] const Diagnostics& diagnostics() const {
+            return m_diagnostics;
+        }
+
+    private:
+        struct Corrupt {
+            std::string reason;
+        };
+
+        const std::string m_filename;
+        const std::byte *m_data = nullptr;
+        size_t m_size = 0;
+        uint64_t m_source_hash = 0;
+        std::string m_source_filename;
+        ArenaAllocator m_allocator;
+        Diagnostics m_diagnostics;
+        std::vector<bool> m_read; // Records already read, by word
+
+        std::optional<Node::Program> corrupt(const std::string &reason) {
+            m_diagnostics.error(m_filename, "not a usable AST file, " + reason, 1, 1, "the whole file");
+            return {};
+        }
+
+        // A record starting at the offset, which has to be below the one referring to it
+        [[nodiscard]] size_t checked(uint32_t offset, size_t parent) const {
+            if (offset < sizeof(AstFormat::Header) || offset >= parent || offset % sizeof(uint32_t) != 0) {
+                throw Corrupt{ "a node refers to offset " + std::to_string(offset) };
+            }
+
+            return offset;
+        }
+
+        // A record other than a string, which only one node may refer to. Nodes sharing records would be read as
+        // many times as they are referred to, which a small file could make grow without bound
+        [[nodiscard]] size_t node(uint32_t offset, size_t parent) {
+            const size_t cursor = checked(offset, parent);
+            if (m_read[cursor / sizeof(uint32_t)]) {
+                throw Corrupt{ "more than one node refers to offset " + std::to_string(offset) };
+            }
+            m_read[cursor / sizeof(uint32_t)] = true;
+
+            return cursor;
+        }
+
+        // The word at the cursor, which then moves past it
+        uint32_t word(size_t &cursor) const {
+            if (cursor + sizeof(uint32_t) > m_size) {
+                throw Corrupt{ "a node runs past the end" };
+            }
+            uint32_t value;
+            std::memcpy(&value, m_data + cursor, sizeof(value));
+            cursor += sizeof(uint32_t);
+
+            return value;
+        }
+
+        std::string string(uint32_t offset, size_t parent) const {
+            size_t cursor = checked(offset, parent);
+            const uint32_t length = word(cursor);
+            if (length > m_size - cursor) {
+                throw Corrupt{ "a string runs past the end" };
+            }
+
+            return { reinterpret_cast<const char*>(m_data + cursor), length };
+        }
+
+        Token token(size_t &cursor, size_t parent) const {
+            const uint32_t type = word(cursor);
+            if (type > static_cast<uint32_t>(TokenType::close_square_bracket)) {
+                throw Corrupt{ "a token has an unknown type" };
+            }
+            Token read_token{ .type = static_cast<TokenType>(type) };
+            read_token.line_no = static_cast<int>(word(cursor));
+            read_token.column_no = static_cast<int>(word(cursor));
+            if (const uint32_t value = word(cursor)) {
+                read_token.value = string(value, parent);
+            }
+            const uint64_t low = word(cursor);
+            read_token.int_value = static_cast<int64_t>(low | static_cast<uint64_t>(word(cursor)) << 32);
+
+            return read_token;
+        }
+
+        std::vector<Node::Expression*> expressions(size_t &cursor, size_t parent) {
+            const uint32_t count = word(cursor);
+            std::vector<Node::Expression*> args;
+            for (uint32_t index = 0; index < count; index++) {
+                args.push_back(expression(word(cursor), parent));
+            }
+
+            return args;
+        }
+
+        Node::TermCall* call(size_t &cursor, size_t parent) {
+            auto call_term = m_allocator.alloc<Node::TermCall>();
+            call_term->identifier = token(cursor, parent);
+            call_term->args = expressions(cursor, parent);
+
+            return call_term;
+        }
+
+        template <typename Operation> Node::Expression* binary(size_t &cursor, size_t parent) {
+            auto operation = m_allocator.alloc<Operation>();
+            operation->left_side = expression(word(cursor), parent);
+            operation->right_side = expression(word(cursor), parent);
+            auto binary_expression = m_allocator.emplace<Node::BinExpr>(operation);
+
+            return m_allocator.emplace<Node::Expression>(binary_expression);
+        }
+
+        template <typename Operation> Node::Expression* term(Operation *operation) {
+            auto term_node = m_allocator.emplace<Node::Term>(operation);
+
+            return m_allocator.emplace<Node::Expression>(term_node);
+        }
+
+        Node::Expression* expression(uint32_t offset, size_t parent) {
+            size_t cursor = node(offset, parent);
+            const size_t self = cursor;
+            switch (word(cursor)) {
+                case 0:
+                    return term(m_allocator.emplace<Node::TermInt>(token(cursor, self)));
+                case 1:
+                    return term(m_allocator.emplace<Node::TermBool>(token(cursor, self)));
+                case 2:
+                    return term(m_allocator.emplace<Node::TermIdent>(token(cursor, self)));
+                case 3:
+                    return term(m_allocator.emplace<Node::TermExpr>(expression(word(cursor), self)));
+                case AstFormat::call_kind:
+                    return term(call(cursor, self));
+                case 5: {
+                    auto index_term = m_allocator.alloc<Node::TermIndex>();
+                    index_term->identifier = token(cursor, self);
+                    index_term->index = expression(word(cursor), self);
+                    return term(index_term);
+                }
+                case 6: {
+                    auto builtin_term = m_allocator.alloc<Node::TermBuiltin>();
+                    builtin_term->identifier = token(cursor, self);
+                    builtin_term->args = expressions(cursor, self);
+                    return term(builtin_term);
+                }
+                case 7:
+                    return term(m_allocator.emplace<Node::BitNot>(expression(word(cursor), self)));
+                case AstFormat::binary_kind + 0: return binary<Node::BinAdd>(cursor, self);
+                case AstFormat::binary_kind + 1: return binary<Node::BinSubtract>(cursor, self);
+                case AstFormat::binary_kind + 2: return binary<Node::BinMultiply>(cursor, self);
+                case AstFormat::binary_kind + 3: return binary<Node::BinDivide>(cursor, self);
+                case AstFormat::binary_kind + 4: return binary<Node::BinModulus>(cursor, self);
+                case AstFormat::binary_kind + 5: return binary<Node::BitAnd>(cursor, self);
+                case AstFormat::binary_kind + 6: return binary<Node::BitOr>(cursor, self);
+                case AstFormat::binary_kind + 7: return binary<Node::BitXor>(cursor, self);
+                case AstFormat::binary_kind + 8: return binary<Node::ShiftLeft>(cursor, self);
+                case AstFormat::binary_kind + 9: return binary<Node::ShiftRight>(cursor, self);
+                case AstFormat::binary_kind + 10: return binary<Node::CmpEqual>(cursor, self);
+                case AstFormat::binary_kind + 11: return binary<Node::CmpNotEqual>(cursor, self);
+                case AstFormat::binary_kind + 12: return binary<Node::CmpLess>(cursor, self);
+                case AstFormat::binary_kind + 13: return binary<Node::CmpLessEqual>(cursor, self);
+                case AstFormat::binary_kind + 14: return binary<Node::CmpGreater>(cursor, self);
+                case AstFormat::binary_kind + 15: return binary<Node::CmpGreaterEqual>(cursor, self);
+                case AstFormat::binary_kind + 16: return binary<Node::LogicAnd>(cursor, self);
+                case AstFormat::binary_kind + 17: return binary<Node::LogicOr>(cursor, self);
+                default:
+                    throw Corrupt{ "an expression has an unknown kind" };
+            }
+        }
+
+        std::optional<Node::Expression*> optional_expression(uint32_t offset, size_t parent) {
+            if (offset == 0) {
+                return {};
+            }
+
+            return expression(offset, parent);
+        }
+
+        Node::Scope* scope(uint32_t offset, size_t parent) {
+            size_t cursor = node(offset, parent);
+            const size_t self = cursor;
+            auto scope_node = m_allocator.alloc<Node::Scope>();
+            const uint32_t count = word(cursor);
+            for (uint32_t index = 0; index < count; index++) {
+                scope_node->stmts.push_back(statement(word(cursor), self));
+            }
+
+            return scope_node;
+        }
+
+        std::optional<Node::StmtIfNext*> if_next(uint32_t offset, size_t parent) {
+            if (offset == 0) {
+                return {};
+            }
+            size_t cursor = node(offset, parent);
+            const size_t self = cursor;
+            if (word(cursor) == 0) {
+                auto elif_statement = m_allocator.alloc<Node::StmtElif>();
+                elif_statement->expr = expression(word(cursor), self);
+                elif_statement->scope = scope(word(cursor), self);
+                elif_statement->next = if_next(word(cursor), self);
+                return m_allocator.emplace<Node::StmtIfNext>(elif_statement);
+            }
+            auto else_statement = m_allocator.alloc<Node::StmtElse>();
+            else_statement->scope = scope(word(cursor), self);
+
+            return m_allocator.emplace<Node::StmtIfNext>(else_statement);
+        }
+
+        Node::Statement* statement(uint32_t offset, size_t parent) {
+            size_t cursor = node(offset, parent);
+            const size_t self = cursor;
+            const uint32_t kind = word(cursor);
+            auto statement_node = m_allocator.alloc<Node::Statement>();
+            statement_node->line_no = static_cast<int>(word(cursor));
+            switch (kind) {
+                case 0:
+                    statement_node->var = m_allocator.emplace<Node::StmtExit>(expression(word(cursor), self));
+                    break;
+                case 1: {
+                    auto mut_statement = m_allocator.alloc<Node::StmtMut>();
+                    mut_statement->identifier = token(cursor, self);
+                    mut_statement->type = token(cursor, self);
+                    mut_statement->expr = optional_expression(word(cursor), self);
+                    const uint32_t has_length = word(cursor);
+                    const uint32_t length = word(cursor);
+                    if (has_length) {
+                        mut_statement->length = length;
+                    }
+                    statement_node->var = mut_statement;
+                    break;
+                }
+                case 2: {
+                    auto identifier_statement = m_allocator.alloc<Node::StmtIdent>();
+                    identifier_statement->identifier = token(cursor, self);
+                    identifier_statement->expr = expression(word(cursor), self);
+                    statement_node->var = identifier_statement;
+                    break;
+                }
+                case 3:
+                    statement_node->var = scope(word(cursor), self);
+                    break;
+                case 4: {
+                    auto if_statement = m_allocator.alloc<Node::StmtIf>();
+                    if_statement->expr = expression(word(cursor), self);
+                    if_statement->scope = scope(word(cursor), self);
+                    if_statement->next = if_next(word(cursor), self);
+                    statement_node->var = if_statement;
+                    break;
+                }
+                case 5: {
+                    auto while_statement = m_allocator.alloc<Node::StmtWhile>();
+                    while_statement->expr = expression(word(cursor), self);
+                    while_statement->scope = scope(word(cursor), self);
+                    statement_node->var = while_statement;
+                    break;
+                }
+                case 6: {
+                    auto for_statement = m_allocator.alloc<Node::StmtFor>();
+                    if (const uint32_t init = word(cursor)) {
+                        for_statement->init = statement(init, self);
+                    }
+                    for_statement->expr = optional_expression(word(cursor), self);
+                    if (const uint32_t step = word(cursor)) {
+                        size_t step_cursor = node(step, self);
+                        auto step_statement = m_allocator.alloc<Node::StmtIdent>();
+                        step_statement->identifier = token(step_cursor, step);
+                        step_statement->expr = expression(word(step_cursor), step);
+                        for_statement->step = step_statement;
+                    }
+                    for_statement->scope = scope(word(cursor), self);
+                    statement_node->var = for_statement;
+                    break;
+                }
+                case 7: {
+                    const uint32_t call_offset = word(cursor);
+                    size_t call_cursor = node(call_offset, self);
+                    if (word(call_cursor) != AstFormat::call_kind) {
+                        throw Corrupt{ "a call statement doesn't hold a call" };
+                    }
+                    statement_node->var = m_allocator.emplace<Node::StmtCall>(call(call_cursor, call_offset));
+                    break;
+                }
+                case 8: {
+                    auto return_statement = m_allocator.alloc<Node::StmtReturn>();
+                    return_statement->token = token(cursor, self);
+                    return_statement->expr = optional_expression(word(cursor), self);
+                    statement_node->var = return_statement;
+                    break;
+                }
+                case 9: {
+                    auto index_statement = m_allocator.alloc<Node::StmtIndex>();
+                    index_statement->identifier = token(cursor, self);
+                    index_statement->index = expression(word(cursor), self);
+                    index_statement->expr = expression(word(cursor), self);
+                    statement_node->var = index_statement;
+                    break;
+                }
+                case 10: {
+                    auto array_statement = m_allocator.alloc<Node::StmtArray>();
+                    array_statement->identifier = token(cursor, self);
+                    array_statement->expr = expression(word(cursor), self);
+                    statement_node->var = array_statement;
+                    break;
+                }
+                case 11: {
+                    auto profile_statement = m_allocator.alloc<Node::StmtProfile>();
+                    profile_statement->name = token(cursor, self);
+                    profile_statement->scope = scope(word(cursor), self);
+                    statement_node->var = profile_statement;
+                    break;
+                }
+                case 12:
+                    statement_node->var = m_allocator.emplace<Node::StmtPrint>(expression(word(cursor), self));
+                    break;
+                case 13: {
+                    auto parallel_statement = m_allocator.alloc<Node::StmtParallel>();
+                    parallel_statement->count = expression(word(cursor), self);
+                    parallel_statement->scope = scope(word(cursor), self);
+                    statement_node->var = parallel_statement;
+                    break;
+                }
+                default:
+                    throw Corrupt{ "a statement has an unknown kind" };
+            }
+
+            return statement_node;
+        }
+
+        Node::Function* function(uint32_t offset, size_t parent) {
+            size_t cursor = node(offset, parent);
+            const size_t self = cursor;
+            auto function_node = m_allocator.alloc<Node::Function>();
+            function_node->identifier = token(cursor, self);
+            const uint32_t has_return_type = word(cursor);
+            Token return_type = token(cursor, self);
+            if (has_return_type) {
+                function_node->return_type = return_type;
+            }
+            const uint32_t count = word(cursor);
+            for (uint32_t index = 0; index < count; index++) {
+                Token identifier = token(cursor, self);
+                function_node->params.push_back(Node::Parameter{ .identifier = identifier, .type = token(cursor, self) });
+            }
+            function_node->scope = scope(word(cursor), self);
+
+            return function_node;
+        }
+
+        Node::Program program(uint32_t offset) {
+            size_t cursor = node(offset, m_size);
+            const size_t self = cursor;
+            Node::Program program_node;
+            const uint32_t statements = word(cursor);
+            for (uint32_t index = 0; index < statements; index++) {
+                program_node.statements.push_back(statement(word(cursor), self));
+            }
+            const uint32_t functions = word(cursor);
+            for (uint32_t index = 0; index < functions; index++) {
+                program_node.functions.push_back(function(word(cursor), self));
+            }
+
+            return program_node;
+        }
+
+        // What the parser checks as it goes, which code generation relies on and a file cer didn't write may break.
+        // The file doesn't say which came first, so every function may be called from anywhere
+        Semantics m_semantics{ &AstReader::report };
+
+        [[noreturn]] static void report(const std::string &message, const Token &token, const std::optional<std::string>&) {
+            if (token.value.has_value()) {
+                throw Corrupt{ "'" + token.value.value() + "' on line " + std::to_string(token.line_no) + ", " + message };
+            }
+            throw Corrupt{ "line " + std::to_string(token.line_no) + ", " + message };
+        }
+
+        void check(const Node::Program &program_node) {
+            for (const Node::Function *function_node : program_node.functions) {
+                name(function_node->identifier);
+                m_semantics.declare_function(function_node);
+            }
+            for (const Node::Statement *statement_node : program_node.statements) {
+                check_statement(statement_node);
+            }
+            for (const Node::Function *function_node : program_node.functions) {
+                check_function(function_node);
+            }
+        }
+
+        // The checks below are of what the parser can't get wrong, the ones that can come out of a source are left to
+        // the semantics, with every name they look at known to be there
+        static const std::string& name(const Token &identifier) {
+            if (!identifier.value.has_value()) {
+                throw Corrupt{ "a name is missing" };
+            }
+
+            return identifier.value.value();
+        }
+
+        static void check_type(const Token &type) {
+            if (!is_type(type.type)) {
+                throw Corrupt{ "a type is not one of int16, int32, int64 or bool" };
+            }
+        }
+
+        void check_function(const Node::Function *function_node) {
+            m_semantics.begin_function(function_node);
+            for (const Node::Parameter &parameter : function_node->params) {
+                name(parameter.identifier);
+                check_type(parameter.type);
+                m_semantics.declare_parameter(parameter.identifier);
+            }
+            if (function_node->return_type.has_value()) {
+                check_type(function_node->return_type.value());
+            }
+            check_scope(function_node->scope);
+            m_semantics.end_function();
+        }
+
+        void check_call(const Node::TermCall *call_term, bool array_expression = false) {
+            name(call_term->identifier);
+            for (const Node::Expression *argument : call_term->args) {
+                check_expression(argument, array_expression);
+            }
+            m_semantics.call(call_term->identifier, call_term->args.size());
+        }
+
+        void check_index(const Token &identifier, const Node::Expression *index, bool array_expression = false) {
+            name(identifier);
+            // The index itself is an ordinary value, even inside an array expression
+            check_expression(index);
+            m_semantics.index(identifier, index, array_expression);
+        }
+
+        void check_expression(const Node::Expression *expression_node, bool array_expression = false) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression_node->var)) {
+                std::visit([&](const auto *operation) {
+                    check_expression(operation->left_side, array_expression);
+                    check_expression(operation->right_side, array_expression);
+                }, (*binary_expression)->bin_expr);
+                return;
+            }
+
+            struct TermChecker {
+                AstReader &reader;
+                bool array_expression;
+
+                void operator() (const Node::TermInt *int_term) const {
+                    if (int_term->int_lit.type != TokenType::int_lit || !int_term->int_lit.value.has_value()) {
+                        throw Corrupt{ "an integer is not an integer literal" };
+                    }
+                }
+
+                void operator() (const Node::TermBool *bool_term) const {
+                    if (bool_term->bool_lit.type != TokenType::True && bool_term->bool_lit.type != TokenType::False) {
+                        throw Corrupt{ "a boolean is neither true nor false" };
+                    }
+                }
+
+                void operator() (const Node::TermIdent *identifier_term) const {
+                    name(identifier_term->identifier);
+                    reader.m_semantics.value(identifier_term->identifier, array_expression);
+                }
+
+                void operator() (const Node::TermExpr *expression_term) const {
+                    reader.check_expression(expression_term->expr, array_expression);
+                }
+
+                void operator() (const Node::TermCall *call_term) const {
+                    reader.check_call(call_term, array_expression);
+                    reader.m_semantics.call_value(call_term->identifier);
+                }
+
+                void operator() (const Node::TermIndex *index_term) const {
+                    reader.check_index(index_term->identifier, index_term->index, array_expression);
+                }
+
+                void operator() (const Node::TermBuiltin *builtin_term) const {
+                    name(builtin_term->identifier);
+                    for (const Node::Expression *argument : builtin_term->args) {
+                        reader.check_expression(argument, array_expression);
+                    }
+                    reader.m_semantics.builtin(builtin_term->identifier, builtin_term->args.size());
+                }
+
+                void operator() (const Node::BitNot *bit_not) const {
+                    reader.check_expression(bit_not->expr, array_expression);
+                }
+            };
+            std::visit(TermChecker{ .reader = *this, .array_expression = array_expression }, std::get<Node::Term*>(expression_node->var)->var);
+        }
+
+        void check_scope(const Node::Scope *scope_node) {
+            m_semantics.begin_scope();
+            for (const Node::Statement *statement_node : scope_node->stmts) {
+                check_statement(statement_node);
+            }
+            m_semantics.end_scope();
+        }
+
+        void check_if_next(const std::optional<Node::StmtIfNext*> &next) {
+            if (!next.has_value()) {
+                return;
+            }
+            if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                check_expression((*elif_statement)->expr);
+                check_scope((*elif_statement)->scope);
+                check_if_next((*elif_statement)->next);
+            }
+            else {
+                check_scope(std::get<Node::StmtElse*>(next.value()->var)->scope);
+            }
+        }
+
+        void check_statement(const Node::Statement *statement_node) {
+            struct StatementChecker {
+                AstReader &reader;
+                int line_no;
+
+                void operator() (const Node::StmtExit *exit_statement) const {
+                    reader.check_expression(exit_statement->expr);
+                }
+
+                void operator() (const Node::StmtMut *mut_statement) const {
+                    name(mut_statement->identifier);
+                    check_type(mut_statement->type);
+                    if (!reader.m_semantics.can_declare(mut_statement->identifier)) {
+                        return;
+                    }
+                    if (mut_statement->length.has_value()) {
+                        reader.m_semantics.array_length(mut_statement->identifier, mut_statement->type.type, mut_statement->length.value());
+                    }
+                    // Declared before its initializer, as the parser does
+                    reader.m_semantics.declare(mut_statement->identifier, mut_statement->type.type, mut_statement->length.value_or(0));
+                    if (mut_statement->length.has_value() && mut_statement->expr.has_value()) {
+                        reader.m_semantics.array_initializer(mut_statement->identifier);
+                    }
+                    if (mut_statement->expr.has_value()) {
+                        reader.check_expression(mut_statement->expr.value());
+                    }
+                }
+
+                void operator() (const Node::StmtIdent *identifier_statement) const {
+                    name(identifier_statement->identifier);
+                    reader.m_semantics.assignment(identifier_statement->identifier);
+                    reader.check_expression(identifier_statement->expr);
+                }
+
+                void operator() (const Node::Scope *scope) const {
+                    reader.check_scope(scope);
+                }
+
+                void operator() (const Node::StmtIf *if_statement) const {
+                    reader.check_expression(if_statement->expr);
+                    reader.check_scope(if_statement->scope);
+                    reader.check_if_next(if_statement->next);
+                }
+
+                void operator() (const Node::StmtWhile *while_statement) const {
+                    reader.check_expression(while_statement->expr);
+                    reader.check_scope(while_statement->scope);
+                }
+
+                void operator() (const Node::StmtFor *for_statement) const {
+                    // Variables declared in the initializer belong to a scope around the loop
+                    reader.m_semantics.begin_scope();
+                    if (for_statement->init.has_value()) {
+                        reader.check_statement(for_statement->init.value());
+                    }
+                    if (for_statement->expr.has_value()) {
+                        reader.check_expression(for_statement->expr.value());
+                    }
+                    if (for_statement->step.has_value()) {
+                        (*this)(for_statement->step.value());
+                    }
+                    reader.check_scope(for_statement->scope);
+                    reader.m_semantics.end_scope();
+                }
+
+                void operator() (const Node::StmtCall *call_statement) const {
+                    reader.check_call(call_statement->call);
+                }
+
+                void operator() (const Node::StmtReturn *return_statement) const {
+                    if (return_statement->expr.has_value()) {
+                        reader.check_expression(return_statement->expr.value());
+                    }
+                    reader.m_semantics.return_statement(return_statement->token, return_statement->expr.has_value());
+                }
+
+                void operator() (const Node::StmtIndex *index_statement) const {
+                    reader.check_index(index_statement->identifier, index_statement->index);
+                    reader.check_expression(index_statement->expr);
+                }
+
+                void operator() (const Node::StmtArray *array_statement) const {
+                    // The parser only reads a whole array assignment to an array
+                    if (!reader.m_semantics.is_array(name(array_statement->identifier))) {
+                        throw Corrupt{ "'" + name(array_statement->identifier) + "' is assigned an array expression but isn't an array" };
+                    }
+                    reader.check_expression(array_statement->expr, true);
+                    reader.m_semantics.array_expression(array_statement->expr, array_statement->identifier);
+                }
+
+                void operator() (const Node::StmtProfile *profile_statement) const {
+                    name(profile_statement->name);
+                    reader.check_scope(profile_statement->scope);
+                }
+
+                void operator() (const Node::StmtPrint *print_statement) const {
+                    reader.check_expression(print_statement->expr);
+                }
+
+                void operator() (const Node::StmtParallel *parallel_statement) const {
+                    reader.check_expression(parallel_statement->count);
+                    const bool outer_parallel = reader.m_semantics.begin_parallel({ .type = TokenType::parallel, .line_no = line_no });
+                    reader.check_scope(parallel_statement->scope);
+                    reader.m_semantics.end_parallel(outer_parallel);
+                }
+            };
+            std::visit(StatementChecker{ .reader = *this, .line_no = statement_node->line_no }, statement_node->var);
+        }
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <variant>
+#include <optional>
+
+#include "parser.hpp"
+
+
+// Dumps a program for --emit=ast, one statement per line indented by nesting, with expressions written as prefix
+// lists so the way they were grouped is visible
+class AstPrinter {
+    public:
+        [[nodiscard]] static std::string print(const Node::Program &program) {
+            std::stringstream out;
+            for (const Node::Function *function : program.functions) {
+                out << "fn " << function->identifier.value.value() << "(";
+                for (size_t index = 0; index < function->params.size(); index++) {
+                    const Node::Parameter &parameter = function->params[index];
+                    out << (index == 0 ? "" : ", ") << parameter.identifier.value.value() << ": " << get_token(parameter.type);
+                }
+                out << ")";
+                if (function->return_type.has_value()) {
+                    out << ": " << get_token(function->return_type.value());
+                }
+                out << "\n";
+                print_statements(out, function->scope->stmts, 1);
+            }
+            print_statements(out, program.statements, 0);
+
+            return out.str();
+        }
+
+    private:
+        static void print_statements(std::stringstream &out, const std::vector<Node::Statement*> &statements, int depth) {
+            for (const Node::Statement *statement : statements) {
+                print_statement(out, statement, depth);
+            }
+        }
+
+        static void print_statement(std::stringstream &out, const Node::Statement *statement, int depth) {
+            struct StatementVisitor {
+                std::stringstream &out;
+                int depth;
+
+                void operator() (const Node::StmtExit *exit_statement) const {
+                    out << "exit " << expression(exit_statement->expr) << "\n";
+                }
+
+                void operator() (const Node::StmtPrint *print_statement) const {
+                    out << "print " << expression(print_statement->expr) << "\n";
+                }
+
+                void operator() (const Node::StmtMut *mut_statement) const {
+                    out << "mut " << mut_statement->identifier.value.value() << ": " << get_token(mut_statement->type);
+                    if (mut_statement->length.has_value()) {
+                        out << "[" << mut_statement->length.value() << "]";
+                    }
+                    if (mut_statement->expr.has_value()) {
+                        out << " = " << expression(mut_statement->expr.value());
+                    }
+                    out << "\n";
+                }
+
+                void operator() (const Node::StmtIdent *identifier_statement) const {
+                    out << identifier_statement->identifier.value.value() << " = " << expression(identifier_statement->expr) << "\n";
+                }
+
+                void operator() (const Node::StmtIndex *index_statement) const {
+                    out << index_statement->identifier.value.value() << "[" << expression(index_statement->index) << "] = "
+                        << expression(index_statement->expr) << "\n";
+                }
+
+                void operator() (const Node::StmtArray *array_statement) const {
+                    out << array_statement->identifier.value.value() << "[] = " << expression(array_statement->expr) << "\n";
+                }
+
+                void operator() (const Node::Scope *scope) const {
+                    out << "scope\n";
+                    print_statements(out, scope->stmts, depth + 1);
+                }
+
+                void operator() (const Node::StmtProfile *profile_statement) const {
+                    out << "profile " << get_token(profile_statement->name) << "\n";
+                    print_statements(out, profile_statement->scope->stmts, depth + 1);
+                }
+
+                void operator() (const Node::StmtParallel *parallel_statement) const {
+                    out << "parallel " << expression(parallel_statement->count) << "\n";
+                    print_statements(out, parallel_statement->scope->stmts, depth + 1);
+                }
+
+                void operator() (const Node::StmtIf *if_statement) const {
+                    out << "if " << expression(if_statement->expr) << "\n";
+                    print_statements(out, if_statement->scope->stmts, depth + 1);
+                    std::optional<Node::StmtIfNext*> next = if_statement->next;
+                    while (next.has_value()) {
+                        indent(out, depth);
+                        if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                            out << "elif " << expression((*elif_statement)->expr) << "\n";
+                            print_statements(out, (*elif_statement)->scope->stmts, depth + 1);
+                            next = (*elif_statement)->next;
+                        }
+                        else {
+                            out << "else\n";
+                            print_statements(out, std::get<Node::StmtElse*>(next.value()->var)->scope->stmts, depth + 1);
+                            next = {};
+                        }
+                    }
+                }
+
+                void operator() (const Node::StmtWhile *while_statement) const {
+                    out << "while " << expression(while_statement->expr) << "\n";
+                    print_statements(out, while_statement->scope->stmts, depth + 1);
+                }
+
+                void operator() (const Node::StmtFor *for_statement) const {
+                    out << "for\n";
+                    if (for_statement->init.has_value()) {
+                        indent(out, depth + 1);
+                        out << "init\n";
+                        print_statement(out, for_statement->init.value(), depth + 2);
+                    }
+                    if (for_statement->expr.has_value()) {
+                        indent(out, depth + 1);
+                        out << "condition " << expression(for_statement->expr.value()) << "\n";
+                    }
+                    if (for_statement->step.has_value()) {
+                        indent(out, depth + 1);
+                        out << "step " << for_statement->step.value()->identifier.value.value() << " = "
+                            << expression(for_statement->step.value()->expr) << "\n";
+                    }
+                    print_statements(out, for_statement->scope->stmts, depth + 1);
+                }
+
+                void operator() (const Node::StmtCall *call_statement) const {
+                    out << "call " << call(call_statement->call->identifier, call_statement->call->args) << "\n";
+                }
+
+                void operator() (const Node::StmtReturn *return_statement) const {
+                    out << "return";
+                    if (return_statement->expr.has_value()) {
+                        out << " " << expression(return_statement->expr.value());
+                    }
+                    out << "\n";
+                }
+            };
+
+            indent(out, depth);
+            std::visit(StatementVisitor{ .out = out, .depth = depth }, statement->var);
+        }
+
+        static std::string expression(const Node::Expression *expression_node) {
+            if (auto term = std::get_if<Node::Term*>(&expression_node->var)) {
+                return AstPrinter::term(*term);
+            }
+
+            return std::visit([](const auto *operation) {
+                return "(" + std::string(symbol(operation)) + " " + expression(operation->left_side) + " "
+                     + expression(operation->right_side) + ")";
+            }, std::get<Node::BinExpr*>(expression_node->var)->bin_expr);
+        }
+
+        static std::string term(const Node::Term *term_node) {
+            struct TermVisitor {
+                std::string operator() (const Node::TermInt *int_term) const {
+                    return int_term->int_lit.value.value();
+                }
+
+                std::string operator() (const Node::TermBool *bool_term) const {
+                    return get_token(bool_term->bool_lit);
+                }
+
+                std::string operator() (const Node::TermIdent *identifier_term) const {
+                    return identifier_term->identifier.value.value();
+                }
+
+                // Parentheses only group, which the prefix form already shows
+                std::string operator() (const Node::TermExpr *expression_term) const {
+                    return expression(expression_term->expr);
+                }
+
+                std::string operator() (const Node::TermCall *call_term) const {
+                    return call(call_term->identifier, call_term->args);
+                }
+
+                std::string operator() (const Node::TermIndex *index_term) const {
+                    return index_term->identifier.value.value() + "[" + expression(index_term->index) + "]";
+                }
+
+                std::string operator() (const Node::TermBuiltin *builtin_term) const {
+                    return call(builtin_term->identifier, builtin_term->args);
+                }
+
+                std::string operator() (const Node::BitNot *bit_not) const {
+                    return "(~ " + expression(bit_not->expr) + ")";
+                }
+            };
+
+            return std::visit(TermVisitor{}, term_node->var);
+        }
+
+        static std::string call(const Token &identifier, const std::vector<Node::Expression*> &args) {
+            std::string text = identifier.value.value() + "(";
+            for (size_t index = 0; index < args.size(); index++) {
+                text += (index == 0 ? "" : ", ") + expression(args[index]);
+            }
+
+            return text + ")";
+        }
+
+        static void indent(std::stringstream &out, int depth) {
+            out << std::string(static_cast<size_t>(depth) * 2, ' ');
+        }
+
+        static const char* symbol(const Node::BinAdd*) { return "+"; }
+        static const char* symbol(const Node::BinSubtract*) { return "-"; }
+        static const char* symbol(const Node::BinMultiply*) { return "*"; }
+        static const char* symbol(const Node::BinDivide*) { return "/"; }
+        static const char* symbol(const Node::BinModulus*) { return "%"; }
+        static const char* symbol(const Node::BitAnd*) { return "&"; }
+        static const char* symbol(const Node::BitOr*) { return "|"; }
+        static const char* symbol(const Node::BitXor*) { return "^"; }
+        static const char* symbol(const Node::ShiftLeft*) { return "<<"; }
+        static const char* symbol(const Node::ShiftRight*) { return ">>"; }
+        static const char* symbol(const Node::CmpEqual*) { return "=="; }
+        static const char* symbol(const Node::CmpNotEqual*) { return "!="; }
+        static const char* symbol(const Node::CmpLess*) { return "<"; }
+        static const char* symbol(const Node::CmpLessEqual*) { return "<="; }
+        static const char* symbol(const Node::CmpGreater*) { return ">"; }
+        static const char* symbol(const Node::CmpGreaterEqual*) { return ">="; }
+        static const char* symbol(const Node::LogicAnd*) { return "&&"; }
+        static const char* symbol(const Node::LogicOr*) { return "||"; }
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <vector>
+#include <variant>
+#include <optional>
+#include <functional>
+
+#include "parser.hpp"
+
+
+// Read only traversals over the AST shared by the analyses that run before code generation
+namespace Walk {
+    using StatementCallback = std::function<void(const Node::Statement*)>;
+    using ExpressionCallback = std::function<void(const Node::Expression*)>;
+
+    // Calls back with the scope of every arm of an if statement, in source order
+    inline void if_arms(const Node::StmtIf *if_statement, const std::function<void(const Node::Scope*)> &callback) {
+        callback(if_statement->scope);
+        std::optional<Node::StmtIfNext*> next = if_statement->next;
+        while (next.has_value()) {
+            if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                callback((*elif_statement)->scope);
+                next = (*elif_statement)->next;
+            }
+            else {
+                callback(std::get<Node::StmtElse*>(next.value()->var)->scope);
+                next = {};
+            }
+        }
+    }
+
+    inline void statements(const std::vector<Node::Statement*> &statements, const StatementCallback &callback);
+
+    // A statement and every statement nested inside it, parents before children
+    inline void statement_tree(const Node::Statement *statement, const StatementCallback &callback) {
+        struct StatementVisitor {
+            const StatementCallback &callback;
+
+            void operator() (const Node::StmtExit*) const {}
+            void operator() (const Node::StmtPrint*) const {}
+            void operator() (const Node::StmtMut*) const {}
+            void operator() (const Node::StmtIdent*) const {}
+            void operator() (const Node::StmtCall*) const {}
+            void operator() (const Node::StmtReturn*) const {}
+            void operator() (const Node::StmtIndex*) const {}
+            void operator() (const Node::StmtArray*) const {}
+
+            void operator() (const Node::Scope *scope) const {
+                Walk::statements(scope->stmts, callback);
+            }
+
+            void operator() (const Node::StmtProfile *profile_statement) const {
+                Walk::statements(profile_statement->scope->stmts, callback);
+            }
+
+            void operator() (const Node::StmtParallel *parallel_statement) const {
+                Walk::statements(parallel_statement->scope->stmts, callback);
+            }
+
+            void operator() (const Node::StmtIf *if_statement) const {
+                if_arms(if_statement, [&](const Node::Scope *scope) {
+                    Walk::statements(scope->stmts, callback);
+                });
+            }
+
+            void operator() (const Node::StmtWhile *while_statement) const {
+                Walk::statements(while_statement->scope->stmts, callback);
+            }
+
+            void operator() (const Node::StmtFor *for_statement) const {
+                if (for_statement->init.has_value()) {
+                    Walk::statements({ for_statement->init.value() }, callback);
+                }
+                Walk::statements(for_statement->scope->stmts, callback);
+            }
+        };
+
+        callback(statement);
+        std::visit(StatementVisitor{.callback = callback}, statement->var);
+    }
+
+    // Every statement in the list and every statement nested inside them, parents before children
+    inline void statements(const std::vector<Node::Statement*> &statements, const StatementCallback &callback) {
+        for (const Node::Statement *statement : statements) {
+            statement_tree(statement, callback);
+        }
+    }
+
+    // The outermost expressions a single statement evaluates itself, not counting nested statements
+    inline void statement_expressions(const Node::Statement *statement, const ExpressionCallback &callback) {
+        struct ExpressionVisitor {
+            const ExpressionCallback &callback;
+
+            void operator() (const Node::StmtExit *exit_statement) const {
+                callback(exit_statement->expr);
+            }
+
+            void operator() (const Node::StmtPrint *print_statement) const {
+                callback(print_statement->expr);
+            }
+
+            void operator() (const Node::StmtMut *mut_statement) const {
+                if (mut_statement->expr.has_value()) {
+                    callback(mut_statement->expr.value());
+                }
+            }
+
+            void operator() (const Node::StmtIdent *identifier_statement) const {
+                callback(identifier_statement->expr);
+            }
+
+            void operator() (const Node::StmtCall *call_statement) const {
+                for (const Node::Expression *argument : call_statement->call->args) {
+                    callback(argument);
+                }
+            }
+
+            void operator() (const Node::StmtReturn *return_statement) const {
+                if (return_statement->expr.has_value()) {
+                    callback(return_statement->expr.value());
+                }
+            }
+
+            void operator() (const Node::StmtIndex *index_statement) const {
+                callback(index_statement->index);
+                callback(index_statement->expr);
+            }
+
+            // Array expressions are not values, every analysis over values has to leave them alone
+            void operator() (const Node::StmtArray*) const {}
+
+            void operator() (const Node::Scope*) const {}
+            void operator() (const Node::StmtProfile*) const {}
+
+            void operator() (const Node::StmtParallel *parallel_statement) const {
+                callback(parallel_statement->count);
+            }
+
+            void operator() (const Node::StmtIf *if_statement) const {
+                callback(if_statement->expr);
+                std::optional<Node::StmtIfNext*> next = if_statement->next;
+                while (next.has_value()) {
+                    if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                        callback((*elif_statement)->expr);
+                        next = (*elif_statement)->next;
+                    }
+                    else {
+                        next = {};
+                    }
+                }
+            }
+
+            void operator() (const Node::StmtWhile *while_statement) const {
+                callback(while_statement->expr);
+            }
+
+            void operator() (const Node::StmtFor *for_statement) const {
+                if (for_statement->expr.has_value()) {
+                    callback(for_statement->expr.value());
+                }
+                if (for_statement->step.has_value()) {
+                    callback(for_statement->step.value()->expr);
+                }
+            }
+        };
+
+        std::visit(ExpressionVisitor{.callback = callback}, statement->var);
+    }
+
+    // The outermost expressions of every statement in the list, including nested statements
+    inline void expressions(const std::vector<Node::Statement*> &statements, const ExpressionCallback &callback) {
+        Walk::statements(statements, [&](const Node::Statement *statement) {
+            statement_expressions(statement, callback);
+        });
+    }
+
+    // The direct children of an expression: both sides of a binary expression, the inside of parentheses, the
+    // arguments of a call or builtin, the index of an array element and the operand of a unary operator
+    inline void operands(const Node::Expression *expression, const ExpressionCallback &callback) {
+        if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var)) {
+                callback((*expression_term)->expr);
+            }
+            else if (auto index_term = std::get_if<Node::TermIndex*>(&(*term)->var)) {
+                callback((*index_term)->index);
+            }
+            else if (auto builtin_term = std::get_if<Node::TermBuiltin*>(&(*term)->var)) {
+                for (const Node::Expression *argument : (*builtin_term)->args) {
+                    callback(argument);
+                }
+            }
+            else if (auto bit_not = std::get_if<Node::BitNot*>(&(*term)->var)) {
+                callback((*bit_not)->expr);
+            }
+            else if (auto call_term = std::get_if<Node::TermCall*>(&(*term)->var)) {
+                for (const Node::Expression *argument : (*call_term)->args) {
+                    callback(argument);
+                }
+            }
+            return;
+        }
+
+        std::visit([&](const auto *operation) {
+            callback(operation->left_side);
+            callback(operation->right_side);
+        }, std::get<Node::BinExpr*>(expression->var)->bin_expr);
+    }
+
+    // The expression itself and everything below it, parents before children
+    inline void subexpressions(const Node::Expression *expression, const ExpressionCallback &callback) {
+        callback(expression);
+        operands(expression, [&](const Node::Expression *operand) {
+            subexpressions(operand, callback);
+        });
+    }
+
+    // What one analysis looks at as the program is walked, so any number of them can share a single traversal.
+    // The function hook comes before the statements of each function, with nullptr for the top level
+    struct Hooks {
+        std::function<void(const Node::Function*)> function{};
+        StatementCallback statement{};
+        ExpressionCallback expression{}; // Every subexpression of what each statement evaluates
+    };
+
+    // The top level and then every function, statements parents first, each statement followed by its
+    // expressions, which is the order every hook sees the program in
+    inline void program(const Node::Program &program, const std::vector<Hooks> &hooks) {
+        auto walk = [&](const std::vector<Node::Statement*> &statement_list, const Node::Function *function) {
+            for (const Hooks &hook : hooks) {
+                if (hook.function) {
+                    hook.function(function);
+                }
+            }
+            Walk::statements(statement_list, [&](const Node::Statement *statement) {
+                for (const Hooks &hook : hooks) {
+                    if (hook.statement) {
+                        hook.statement(statement);
+                    }
+                }
+                statement_expressions(statement, [&](const Node::Expression *expression) {
+                    subexpressions(expression, [&](const Node::Expression *subexpression) {
+                        for (const Hooks &hook : hooks) {
+                            if (hook.expression) {
+                                hook.expression(subexpression);
+                            }
+                        }
+                    });
+                });
+            });
+        };
+
+        walk(program.statements, nullptr);
+        for (const Node::Function *function : program.functions) {
+            walk(function->scope->stmts, function);
+        }
+    }
+
+    // The call in a term, if the expression is one
+    inline const Node::TermCall* as_call(const Node::Expression *expression) {
+        if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+            if (auto call_term = std::get_if<Node::TermCall*>(&(*term)->var)) {
+                return *call_term;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Whether evaluating the expression can fault: division by zero, or an element read at an index that was not
+    // checked against the array length when parsing
+    inline bool can_trap(const Node::Expression *expression) {
+        bool trap = false;
+        subexpressions(expression, [&](const Node::Expression *subexpression) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&subexpression->var)) {
+                trap = trap || std::holds_alternative<Node::BinDivide*>((*binary_expression)->bin_expr)
+                            || std::holds_alternative<Node::BinModulus*>((*binary_expression)->bin_expr);
+            }
+            else if (auto term = std::get_if<Node::Term*>(&subexpression->var)) {
+                if (auto index_term = std::get_if<Node::TermIndex*>(&(*term)->var)) {
+                    auto index = std::get_if<Node::Term*>(&(*index_term)->index->var);
+                    trap = trap || index == nullptr || !std::holds_alternative<Node::TermInt*>((*index)->var);
+                }
+            }
+        });
+
+        return trap;
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <cstdlib>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "xxhash.hpp"
+
+
+// Executables cer has built before, keyed by a hash of everything that went into them: the compiler itself, the
+// source, and every option that changes the output. A hit is hard linked into place without compiling anything.
+// Entries are written under a temporary name and renamed, so builds sharing the cache never see half an entry, and
+// the least recently used ones go when the cache grows past its size limit
+class BuildCache {
+    public:
+        // Set CER_CACHE_DIR to turn the cache on, and CER_CACHE_MAX_MB to bound it, 512 MB when not set
+        static std::optional<BuildCache> from_environment() {
+            const char *directory = std::getenv("CER_CACHE_DIR");
+            if (directory == nullptr || *directory == '\0') {
+                return {};
+            }
+            uint64_t max_bytes = default_max_megabytes * 1024 * 1024;
+            if (const char *megabytes = std::getenv("CER_CACHE_MAX_MB")) {
+                max_bytes = static_cast<uint64_t>(std::strtod(megabytes, nullptr) * 1024 * 1024);
+            }
+
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            if (error) {
+                return {};
+            }
+
+            return BuildCache(directory, max_bytes);
+        }
+
+        // Every input goes in with its length in front, so no two different lists of inputs join into the same
+        // bytes, and the whole is hashed twice with different seeds into a 128 bit key
+        [[nodiscard]] static std::string key(const std::vector<std::string> &inputs) {
+            std::string joined = compiler_identity();
+            for (const std::string &input : inputs) {
+                joined += '\0';
+                joined += std::to_string(input.size());
+                joined += ':';
+                joined += input;
+            }
+
+            char name[33];
+            std::snprintf(name, sizeof(name), "%016llx%016llx", static_cast<unsigned long long>(XXHash64::hash(joined, 0)),
+                          static_cast<unsigned long long>(XXHash64::hash(joined, 1)));
+            return name;
+        }
+
+        // Puts the cached output at the path, replacing whatever is there, and marks the entry as just used
+        bool fetch(const std::string &key, const std::filesystem::path &output) const {
+            const std::filesystem::path entry = m_directory / key;
+            const std::filesystem::path staging = temporary(output);
+            std::error_code error;
+            std::filesystem::create_hard_link(entry, staging, error);
+            if (error) {
+                // The cache may be on another file system than the output
+                error.clear();
+                if (!std::filesystem::copy_file(entry, staging, error) || error) {
+                    std::filesystem::remove(staging, error);
+                    return false;
+                }
+            }
+            std::filesystem::rename(staging, output, error);
+            if (error) {
+                std::filesystem::remove(staging, error);
+                return false;
+            }
+            std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);
+
+            return true;
+        }
+
+        void store(const std::string &key, const std::filesystem::path &output) const {
+            const std::filesystem::path staging = temporary(m_directory / key);
+            std::error_code error;
+            std::filesystem::copy_file(output, staging, error);
+            if (!error) {
+                std::filesystem::rename(staging, m_directory / key, error);
+            }
+            if (error) {
+                std::filesystem::remove(staging, error);
+                return;
+            }
+            evict();
+        }
+
+    private:
+        static constexpr uint64_t default_max_megabytes = 512;
+
+        std::filesystem::path m_directory;
+        uint64_t m_max_bytes;
+
+        BuildCache(std::filesystem::path directory, uint64_t max_bytes) : m_directory(std::move(directory))
+                                                                        , m_max_bytes(max_bytes) {}
+
+        // A name next to the final one, so the rename that publishes it stays on one file system
+        static std::filesystem::path temporary(const std::filesystem::path &path) {
+            static std::atomic<uint64_t> counter = 0;
+            return path.string() + ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter.fetch_add(1));
+        }
+
+        // The bytes of the running compiler, hashed once, so any rebuild of cer misses everything cached before it
+        static const std::string& compiler_identity() {
+            static const std::string identity = []() {
+                std::ifstream executable("/proc/self/exe", std::ios::binary);
+                std::stringstream contents;
+                contents << executable.rdbuf();
+                return std::to_string(XXHash64::hash(contents.str()));
+            }();
+
+            return identity;
+        }
+
+        // Drops least recently used entries until the cache is back under three quarters of its limit, so it
+        // isn't trimmed again on the very next store
+        void evict() const {
+            struct Entry {
+                std::filesystem::path path;
+                std::filesystem::file_time_type used;
+                uint64_t size;
+            };
+            std::vector<Entry> entries;
+            uint64_t total = 0;
+            std::error_code error;
+            for (const auto &file : std::filesystem::directory_iterator(m_directory, error)) {
+                if (!file.is_regular_file(error) || file.path().string().find(".tmp.") != std::string::npos) {
+                    continue;
+                }
+                Entry entry{ .path = file.path(), .used = file.last_write_time(error), .size = file.file_size(error) };
+                if (!error) {
+                    total += entry.size;
+                    entries.push_back(std::move(entry));
+                }
+                error.clear();
+            }
+            if (total <= m_max_bytes) {
+                return;
+            }
+
+            std::sort(entries.begin(), entries.end(), [](const Entry &left, const Entry &right) { return left.used < right.used; });
+            for (const Entry &entry : entries) {
+                if (total <= m_max_bytes / 4 * 3) {
+                    break;
+                }
+                // Another build may have removed it already, which is just as good
+                std::filesystem::remove(entry.path, error);
+                total -= entry.size;
+            }
+        }
+};
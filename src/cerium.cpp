@@ -0,0 +1,251 @@
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+
+#include "cerium.hpp"
+#include "token.hpp"
+#include "error.hpp"
+#include "tokenize.hpp"
+#include "parser.hpp"
+#include "codegen.hpp"
+#include "passes.hpp"
+#include "profile.hpp"
+#include "astprinter.hpp"
+#include "astbinary.hpp"
+#include "timereport.hpp"
+#include "varaibles.hpp"
+
+
+// Lines of assembly that are instructions, not labels, directives or data
+static size_t count_instructions(const std::string &assembly) {
+    size_t instructions = 0;
+    std::istringstream lines(assembly);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.starts_with('\t') && !line.starts_with("\talign") && !line.starts_with("\tdq")) {
+            instructions++;
+        }
+    }
+
+    return instructions;
+}
+
+// Runs nasm in a directory of its own, so compiles running at the same time don't write over each other's files
+static std::optional<std::string> assemble(const std::string &assembly, bool line_info) {
+    char directory_template[] = "/tmp/cerium.XXXXXX";
+    if (mkdtemp(directory_template) == nullptr) {
+        return {};
+    }
+    const std::filesystem::path directory = directory_template;
+    const std::string source = (directory / "out.asm").string();
+    const std::string object = (directory / "out.o").string();
+
+    std::ofstream(source) << assembly;
+    const std::string command = std::string(line_info ? "nasm -felf64 -g -F dwarf" : "nasm -felf64") + " -o " + object + " " + source;
+    std::optional<std::string> bytes;
+    if (system(command.c_str()) == 0) {
+        std::ifstream input(object, std::ios::binary);
+        std::stringstream contents;
+        contents << input.rdbuf();
+        bytes = contents.str();
+    }
+    std::filesystem::remove_all(directory);
+
+    return bytes;
+}
+
+
+// The report is optional, the phases are timed only when there is one
+class Phases {
+    public:
+        explicit Phases(TimeReport *report) : m_report(report) {}
+
+        void start(const std::string &name) const {
+            if (m_report != nullptr) {
+                m_report->start(name);
+            }
+        }
+
+        void stop() const {
+            if (m_report != nullptr) {
+                m_report->stop();
+            }
+        }
+
+        void count(const std::string &what, size_t value) const {
+            if (m_report != nullptr) {
+                m_report->count(what, value);
+            }
+        }
+
+    private:
+        TimeReport *m_report;
+};
+
+// Runs the part of a compile that works on the tree, turning what goes wrong inside the compiler into diagnostics
+template <typename Body> static bool guarded(const std::string &filename, Diagnostics &diagnostics, Body body) {
+    try {
+        return body();
+    }
+    catch (const std::bad_alloc&) {
+        diagnostics.error(filename, "program is too large to compile", 1, 1, "the whole file");
+    }
+    catch (const std::logic_error &error) {
+        diagnostics.error(filename, std::string("internal compiler error: ") + error.what(), 1, 1, "the whole file");
+    }
+
+    return false;
+}
+
+// Everything from a tree onwards, whether it was parsed from source or mapped from a binary AST. The source hash
+// and name are those of the source the tree came from, which profiles and line information refer to
+static bool generate(const Node::Program &ast, uint64_t source_hash, const std::string &source_filename,
+                     const CompileOptions &options, const Phases &phases, Diagnostics &diagnostics, CompileResult &result) {
+    auto resolve = [&](const std::string &path) {
+        return std::filesystem::absolute(options.directory / path).string();
+    };
+
+    phases.start("optimize");
+    PassManager passes(options.optimization, options.profile_output.has_value() || options.profile_input.has_value());
+    PassManager::Analyses analyses = passes.analyze(ast);
+    phases.stop();
+
+    phases.start("codegen");
+    CodeGenOptions codegen_options{ .target = options.target, .source_hash = source_hash,
+                                    .threads = options.codegen_threads };
+    // Debuggers look the source up by the path recorded here, so it has to work from anywhere
+    if (options.line_info) {
+        codegen_options.line_file = resolve(source_filename);
+    }
+    // The instrumented program writes its profile where the compiler was asked to, whatever directory it runs in
+    if (options.profile_output.has_value()) {
+        codegen_options.profile_output = resolve(options.profile_output.value());
+        codegen_options.profile = analyses.profile;
+    }
+    if (options.profile_input.has_value()) {
+        Profile profile = analyses.profile.value();
+        if (auto problem = profile.load(resolve(options.profile_input.value()), source_hash)) {
+            diagnostics.warning(problem.value() + ", ignoring it");
+        }
+        else {
+            codegen_options.profile = std::move(profile);
+        }
+    }
+    result.output = passes.generate(ast, std::move(codegen_options), std::move(analyses));
+    result.passes = passes.timings();
+    phases.stop();
+    phases.count("instructions", count_instructions(result.output));
+
+    return true;
+}
+
+// Assembles the output when an object was asked for and hands back everything the compile came to
+static CompileResult finish(CompileResult result, const CompileOptions &options, const Phases &phases,
+                            Diagnostics &diagnostics, bool generated) {
+    if (generated && options.emit == Emit::object) {
+        phases.start("assemble");
+        std::optional<std::string> object = assemble(result.output, options.line_info);
+        phases.stop();
+        if (object.has_value()) {
+            result.output = std::move(object.value());
+        }
+        else {
+            diagnostics.error(options.filename, "nasm failed to assemble the generated code", 1, 1, "the whole file");
+        }
+    }
+    result.success = generated && !diagnostics.has_errors();
+    result.diagnostics = diagnostics.all();
+
+    return result;
+}
+
+CompileResult compile(const std::string &source, const CompileOptions &options) {
+    CompileResult result;
+    Diagnostics diagnostics(options.error_limit);
+    const Phases phases(options.report);
+
+    phases.start("tokenize");
+    Tokenizer tokenizer(source, options.filename, options.error_limit);
+    std::vector<Token> tokens = tokenizer.tokenize();
+    phases.stop();
+    phases.count("tokens", tokens.size());
+    diagnostics.append(tokenizer.diagnostics());
+    if (diagnostics.has_errors()) {
+        return finish(std::move(result), options, phases, diagnostics, false);
+    }
+    if (options.emit == Emit::tokens) {
+        std::stringstream out;
+        for (const Token &token : tokens) {
+            out << token.line_no << ":" << token.column_no << " " << get_token(token) << "\n";
+        }
+        result.output = out.str();
+        return finish(std::move(result), options, phases, diagnostics, true);
+    }
+
+    const bool generated = guarded(options.filename, diagnostics, [&]() {
+        phases.start("parse");
+        Parser parser(std::move(tokens), options.filename, options.error_limit);
+        // The tree lives in the parser's arena, so everything that reads it happens while the parser is alive
+        Node::Program ast = parser.parse_program().first;
+        phases.stop();
+        phases.count("ast nodes", parser.nodes());
+        phases.count("arena bytes", parser.arena_used());
+        diagnostics.append(parser.diagnostics());
+        if (diagnostics.has_errors()) {
+            return false;
+        }
+        if (options.emit == Emit::ast) {
+            result.output = AstPrinter::print(ast);
+            return true;
+        }
+        if (options.emit == Emit::ast_binary) {
+            result.output = AstWriter::write(ast, Profile::hash(source), options.filename);
+            return true;
+        }
+
+        return generate(ast, Profile::hash(source), options.filename, options, phases, diagnostics, result);
+    });
+
+    return finish(std::move(result), options, phases, diagnostics, generated);
+}
+
+CompileResult compile_ast(const std::string &path, const CompileOptions &options) {
+    CompileResult result;
+    Diagnostics diagnostics(options.error_limit);
+    const Phases phases(options.report);
+
+    const bool generated = guarded(options.filename, diagnostics, [&]() {
+        phases.start("load");
+        AstReader reader(std::filesystem::absolute(options.directory / path).string());
+        // Like the parser's, the tree lives as long as the reader
+        std::optional<Node::Program> ast = reader.read();
+        phases.stop();
+        phases.count("ast nodes", reader.nodes());
+        diagnostics.append(reader.diagnostics());
+        if (!ast.has_value()) {
+            return false;
+        }
+        if (options.emit == Emit::ast) {
+            result.output = AstPrinter::print(ast.value());
+            return true;
+        }
+        if (options.emit == Emit::ast_binary) {
+            result.output = AstWriter::write(ast.value(), reader.source_hash(), reader.source_filename());
+            return true;
+        }
+        if (options.emit == Emit::tokens) {
+            diagnostics.error(options.filename, "an AST file has no tokens to print", 1, 1, "the whole file");
+            return false;
+        }
+
+        return generate(ast.value(), reader.source_hash(), reader.source_filename(), options, phases, diagnostics, result);
+    });
+
+    return finish(std::move(result), options, phases, diagnostics, generated);
+}
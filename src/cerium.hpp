@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+
+#include "error.hpp"
+#include "target.hpp"
+#include "timereport.hpp"
+
+
+// What compile() stops after and hands back
+enum class Emit {
+    tokens,
+    ast,
+    ast_binary, // The tree in the format compile_ast() maps, see astbinary.hpp
+    assembly,
+    object,
+};
+
+// Which pipeline of optimization passes runs, see passes.hpp
+enum class OptLevel {
+    O0,
+    O1,
+    O2,
+    Os,
+};
+
+// One pass that ran, for --print-passes. Analyses that share a traversal share its time, which the first of them
+// is given and the rest say they were fused into
+struct PassTiming {
+    std::string name;
+    std::string kind;
+    std::optional<double> milliseconds{}; // None for what the code generator does while it lowers the tree
+    std::string note{};
+};
+
+struct CompileOptions {
+    std::string filename = "input.crm"; // Where diagnostics and -g line information say the source came from
+    std::filesystem::path directory{}; // What relative paths are relative to, the current directory when empty
+    Emit emit = Emit::assembly;
+    Target target{};
+    bool line_info = false;
+    std::optional<std::string> profile_output{}; // Makes an instrumented program that writes its profile here
+    std::optional<std::string> profile_input{}; // A profile to lay the code out by
+    size_t error_limit = 20; // Errors past this many are dropped and the phase stops, 0 for no limit
+    size_t codegen_threads = 1; // Threads large programs are generated on, which never changes the output
+    OptLevel optimization = OptLevel::O2;
+    TimeReport *report = nullptr; // Filled in phase by phase when given
+};
+
+struct CompileResult {
+    bool success = false;
+    std::string output; // Tokens, the AST or assembly as text, or the bytes of a binary AST or an ELF object file
+    std::vector<Diagnostic> diagnostics;
+    std::vector<PassTiming> passes; // In the order they ran, empty when the compile stopped before code generation
+};
+
+// Compiles one program without touching any global state and without exiting, so a process can run as many
+// compiles as it likes, on as many threads as it likes. Only Emit::object leaves the process, to run nasm
+CompileResult compile(const std::string &source, const CompileOptions &options = {});
+
+// Compiles a binary AST written with Emit::ast_binary, mapping the file rather than reading the source and parsing
+// it again. The path is relative to the options' directory, and options.filename names the file in diagnostics
+CompileResult compile_ast(const std::string &path, const CompileOptions &options = {});
@@ -1,25 +1,87 @@
 #pragma once
 
 #include <map>
+#include <algorithm>
 #include <stack>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <bit>
+#include <atomic>
+#include <thread>
 
 #include "error.hpp"
 #include "parser.hpp"
 #include "varaibles.hpp"
+#include "inliner.hpp"
+#include "loopanalysis.hpp"
+#include "ifconversion.hpp"
+#include "target.hpp"
+#include "profile.hpp"
 
 
+// One arm of an if chain. The arm a chain without an else takes when none of the conditions hold has neither a
+// condition nor a scope
+struct IfArm {
+    std::optional<const Node::Expression*> condition{};
+    std::optional<const Node::Scope*> scope{};
+    const void *block; // What the profile counts the arm as
+};
+
+// What the generator does beyond a plain translation of every statement, each switched on by a pass of the
+// pipeline the optimization level picks, see passes.hpp
+struct Optimizations {
+    bool hoist_invariants = true; // Loop invariant expressions are evaluated once, before the loop
+    bool strength_reduction = true; // Products of a loop's induction variable are kept up to date by adds
+    bool if_conversion = true; // Ifs that only pick a value become cmov
+    bool align_loops = true; // Loop bodies start on a 16 byte boundary, which costs padding
+};
+
+// Everything about the generated code that is picked on the command line
+struct CodeGenOptions {
+    Target target{};
+    std::optional<std::string> line_file{}; // Source path line info refers to, every statement gets tagged with -g
+    std::optional<std::string> profile_output{}; // Where an instrumented program writes its counts to
+    std::optional<Profile> profile{}; // The blocks counted, with the counts of a previous run for -fprofile-use
+    uint64_t source_hash = 0; // Ties a profile to the source it was counted for
+    size_t threads = 1; // Top level regions are generated on this many threads, the output is the same for any number
+    Optimizations optimizations{};
+    std::optional<Inliner> inliner{}; // Decides what gets inlined, the generator walks the program for one when not given
+};
+
 class CodeGenerator {
 public:
-    inline explicit CodeGenerator(Node::Program program_node, const Variables& variables) : m_program_node(std::move(program_node))
-                                                                                    , m_variables(variables){
+    inline explicit CodeGenerator(Node::Program program_node, const Variables& variables, CodeGenOptions options = {})
+                                                                                    : m_variables(variables)
+                                                                                    , m_program_node(std::move(program_node))
+                                                                                    , m_inliner(options.inliner.has_value() ? options.inliner.value()
+                                                                                                : Inliner::analyze(m_program_node))
+                                                                                    , m_options(std::move(options))
+                                                                                    , m_level(m_options.target.level) {
         m_stack_pointer = 0;
+        m_stack_alignment = 0; // The kernel starts _start with a 16 byte aligned stack
         m_current_scope = 0;
         m_label_map = { {TokenType::if_, 0}, {TokenType::else_, 0},
                         {TokenType::elif, 0}, {TokenType::while_, 0},
-                        {TokenType::for_, 0}, {TokenType::exit, 0}};
+                        {TokenType::for_, 0}, {TokenType::return_, 0},
+                        {TokenType::double_ampersand, 0}, {TokenType::double_pipe, 0},
+                        {TokenType::open_square_bracket, 0}, {TokenType::exit, 0}};
+        for (const Node::Function *function : m_program_node.functions) {
+            m_functions[function->identifier.value.value()] = function;
+        }
+        auto find_parallel = [&](const Node::Statement *statement) {
+            m_uses_parallel = m_uses_parallel || std::holds_alternative<Node::StmtParallel*>(statement->var);
+        };
+        Walk::statements(m_program_node.statements, find_parallel);
+        for (const Node::Function *function : m_program_node.functions) {
+            Walk::statements(function->scope->stmts, find_parallel);
+        }
+        m_options.inliner.reset(); // m_inliner has it
     }
 
     [[nodiscard]] std::string generate_term(const Node::Term *term) {
@@ -28,22 +90,50 @@ public:
             CodeGenerator &generator;
 
             void operator() (const Node::TermInt *int_term) const {
-                code_stream << "\tmov rax, " << int_term->int_lit.value.value() << "\n";
+                code_stream << load_immediate(int_term->int_lit.int_value);
+                code_stream << generator.push_stack("rax");
+            }
+
+            void operator() (const Node::TermBool *bool_term) const {
+                code_stream << load_immediate(bool_term->bool_lit.type == TokenType::True ? 1 : 0);
                 code_stream << generator.push_stack("rax");
             }
 
             void operator() (const Node::TermIdent *identifier_term) {
                 std::string variable_identifier = identifier_term->identifier.value.value();
                 auto iterator = generator.m_variables.get_variable(variable_identifier, generator.m_current_scope);
-                    const Variable& variable = iterator->second;
-                    std::stringstream offset;
-                    offset << "QWORD [rsp + " << (generator.m_stack_pointer - variable.stack_location) * 8 << "]";
-                    code_stream << generator.push_stack(offset.str());
+                const Variable& variable = iterator->second;
+                code_stream << generator.push_variable(variable);
             }
 
             void operator() (const Node::TermExpr *expression_term) const {
                 code_stream << generator.generate_expression(expression_term->expr);
             }
+
+            void operator() (const Node::TermCall *call_term) const {
+                code_stream << generator.generate_call(call_term, true);
+            }
+
+            void operator() (const Node::TermBuiltin *builtin_term) const {
+                code_stream << generator.generate_builtin(builtin_term);
+            }
+
+            void operator() (const Node::BitNot *bit_not) const {
+                code_stream << generator.generate_expression(bit_not->expr);
+                code_stream << generator.pop_stack("rax");
+                code_stream << "\tnot rax\n";
+                code_stream << generator.push_stack("rax");
+            }
+
+            void operator() (const Node::TermIndex *index_term) const {
+                std::string variable_identifier = index_term->identifier.value.value();
+                auto iterator = generator.m_variables.get_variable(variable_identifier, generator.m_current_scope);
+                Variable variable = iterator->second;
+                code_stream << generator.generate_expression(index_term->index);
+                code_stream << generator.pop_stack("rcx");
+                code_stream << generator.load_element(variable, "rax", generator.element_operand(variable, "rcx"));
+                code_stream << generator.push_stack("rax");
+            }
         };
         std::stringstream code;
         ExpressionVisitor visitor{.code_stream = code, .generator = *this};
@@ -56,87 +146,204 @@ public:
         struct BinExpressionVisitor {
             std::stringstream &code_stream;
             CodeGenerator &generator;
+            int width;
 
             void operator() (const Node::BinAdd *binary_add) const {
-                code_stream << generator.generate_expression(binary_add->left_side);
-                code_stream << generator.generate_expression(binary_add->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tadd rax, rbx\n";
-                code_stream << generator.push_stack("rax");
+                arithmetic(binary_add->left_side, binary_add->right_side, "add", true, width);
             }
 
             void operator() (const Node::BinSubtract *binary_subtract) const {
-                code_stream << generator.generate_expression(binary_subtract->left_side);
-                code_stream << generator.generate_expression(binary_subtract->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tsub rax, rbx\n";
-                code_stream << generator.push_stack("rax");
+                arithmetic(binary_subtract->left_side, binary_subtract->right_side, "sub", false, width);
             }
 
             void operator() (const Node::BinMultiply *binary_multiply) const {
-                code_stream << generator.generate_expression(binary_multiply->left_side);
-                code_stream << generator.generate_expression(binary_multiply->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tmul rbx\n";
+                std::string value_register = width == 32 ? "eax" : "rax";
+                std::string multiply;
+                if (auto factor = generator.generate_immediate_operands(binary_multiply->left_side, binary_multiply->right_side, true, multiply)) {
+                    code_stream << multiply << multiply_by(value_register, factor.value());
+                }
+                else {
+                    code_stream << generator.generate_operands(binary_multiply->left_side, binary_multiply->right_side);
+                    code_stream << "\timul " << value_register << ", " << (width == 32 ? "ebx" : "rbx") << "\n";
+                }
+                if (width == 32) {
+                    code_stream << "\tmovsxd rax, eax\n";
+                }
+                code_stream << generator.push_stack("rax");
+            }
+
+            // Adds, subtracts and bitwise operations take a small literal on the right as an immediate, which nasm
+            // encodes in a single byte when it fits in one
+            void arithmetic(const Node::Expression *left_side, const Node::Expression *right_side, const std::string &instruction,
+                            bool commutative, int operation_width) const {
+                std::string value_register = operation_width == 32 ? "eax" : "rax";
+                std::string operands;
+                if (auto value = generator.generate_immediate_operands(left_side, right_side, commutative, operands)) {
+                    code_stream << operands;
+                    code_stream << "\t" << instruction << " " << value_register << ", " << value.value() << "\n";
+                }
+                else {
+                    code_stream << generator.generate_operands(left_side, right_side);
+                    code_stream << "\t" << instruction << " " << value_register << ", " << (operation_width == 32 ? "ebx" : "rbx") << "\n";
+                }
+                if (operation_width == 32) {
+                    code_stream << "\tmovsxd rax, eax\n";
+                }
                 code_stream << generator.push_stack("rax");
             }
 
+            // Multiplies by a constant with a shift for powers of two and lea for 3, 5 and 9, which are shorter and
+            // quicker than imul
+            static std::string multiply_by(const std::string &value_register, int64_t factor) {
+                if (factor == 1) {
+                    return "";
+                }
+                if (factor > 0 && std::has_single_bit(static_cast<uint64_t>(factor))) {
+                    return "\tshl " + value_register + ", " + std::to_string(std::countr_zero(static_cast<uint64_t>(factor))) + "\n";
+                }
+                // The address is always formed from the 64 bit register, a 32 bit one would need a prefix
+                if (factor == 3 || factor == 5 || factor == 9) {
+                    return "\tlea " + value_register + ", [rax + rax * " + std::to_string(factor - 1) + "]\n";
+                }
+
+                return "\timul " + value_register + ", " + value_register + ", " + std::to_string(factor) + "\n";
+            }
+
             void operator() (const Node::BinDivide *binary_divide) const {
-                code_stream << generator.generate_expression(binary_divide->left_side);
-                code_stream << generator.generate_expression(binary_divide->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tdiv rbx\n";
+                code_stream << generator.generate_operands(binary_divide->left_side, binary_divide->right_side);
+                if (width == 32) {
+                    code_stream << "\tcdq\n";
+                    code_stream << "\tidiv ebx\n";
+                    code_stream << "\tmovsxd rax, eax\n";
+                }
+                else {
+                    code_stream << "\tcqo\n";
+                    code_stream << "\tidiv rbx\n";
+                }
                 code_stream << generator.push_stack("rax");
             }
 
             void operator() (const Node::BinModulus *binary_modulus) const {
-                code_stream << generator.generate_expression(binary_modulus->left_side);
-                code_stream << generator.generate_expression(binary_modulus->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tdiv rbx\n";
+                code_stream << generator.generate_operands(binary_modulus->left_side, binary_modulus->right_side);
+                if (width == 32) {
+                    code_stream << "\tcdq\n";
+                    code_stream << "\tidiv ebx\n";
+                    code_stream << "\tmovsxd rdx, edx\n";
+                }
+                else {
+                    code_stream << "\tcqo\n";
+                    code_stream << "\tidiv rbx\n";
+                }
                 code_stream << generator.push_stack("rdx");
             }
 
+            // Bitwise operations on sign extended operands are already sign extended, so they always run at 64 bits
             void operator() (const Node::BitAnd *bitwise_and) const {
-                code_stream << generator.generate_expression(bitwise_and->left_side);
-                code_stream << generator.generate_expression(bitwise_and->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tand rax, rbx\n";
+                auto left_not = bit_not_operand(bitwise_and->left_side);
+                auto right_not = bit_not_operand(bitwise_and->right_side);
+                if (generator.has_bmi() && left_not.has_value()) {
+                    code_stream << generator.generate_operands(left_not.value(), bitwise_and->right_side);
+                    code_stream << "\tandn rax, rax, rbx\n";
+                }
+                else if (generator.has_bmi() && right_not.has_value()) {
+                    code_stream << generator.generate_operands(bitwise_and->left_side, right_not.value());
+                    code_stream << "\tandn rax, rbx, rax\n";
+                }
+                else {
+                    arithmetic(bitwise_and->left_side, bitwise_and->right_side, "and", true, 64);
+                    return;
+                }
                 code_stream << generator.push_stack("rax");
             }
 
+            void operator() (const Node::ShiftLeft *shift_left) const {
+                code_stream << generator.generate_shift(shift_left->left_side, shift_left->right_side, "shl", width);
+            }
+
+            void operator() (const Node::ShiftRight *shift_right) const {
+                code_stream << generator.generate_shift(shift_right->left_side, shift_right->right_side, "sar", width);
+            }
+
+            static std::optional<const Node::Expression*> bit_not_operand(const Node::Expression *expression) {
+                if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+                    if (auto bit_not = std::get_if<Node::BitNot*>(&(*term)->var)) {
+                        return (*bit_not)->expr;
+                    }
+                }
+
+                return {};
+            }
+
             void operator() (const Node::BitXor *bitwise_xor) const {
-                code_stream << generator.generate_expression(bitwise_xor->left_side);
-                code_stream << generator.generate_expression(bitwise_xor->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\txor rax, rbx\n";
-                code_stream << generator.push_stack("rax");
+                arithmetic(bitwise_xor->left_side, bitwise_xor->right_side, "xor", true, 64);
             }
 
             void operator() (const Node::BitOr *bitwise_or) const {
-                code_stream << generator.generate_expression(bitwise_or->left_side);
-                code_stream << generator.generate_expression(bitwise_or->right_side);
-                code_stream << generator.pop_stack("rbx");
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\tor rax, rbx\n";
+                arithmetic(bitwise_or->left_side, bitwise_or->right_side, "or", true, 64);
+            }
+
+            void operator() (const Node::CmpEqual *compare_equal) const {
+                code_stream << generator.generate_compare_value(compare_equal->left_side, compare_equal->right_side, "e");
+            }
+
+            void operator() (const Node::CmpNotEqual *compare_not_equal) const {
+                code_stream << generator.generate_compare_value(compare_not_equal->left_side, compare_not_equal->right_side, "ne");
+            }
+
+            void operator() (const Node::CmpLess *compare_less) const {
+                code_stream << generator.generate_compare_value(compare_less->left_side, compare_less->right_side, "l");
+            }
+
+            void operator() (const Node::CmpLessEqual *compare_less_equal) const {
+                code_stream << generator.generate_compare_value(compare_less_equal->left_side, compare_less_equal->right_side, "le");
+            }
+
+            void operator() (const Node::CmpGreater *compare_greater) const {
+                code_stream << generator.generate_compare_value(compare_greater->left_side, compare_greater->right_side, "g");
+            }
+
+            void operator() (const Node::CmpGreaterEqual *compare_greater_equal) const {
+                code_stream << generator.generate_compare_value(compare_greater_equal->left_side, compare_greater_equal->right_side, "ge");
+            }
+
+            // Logical operators only evaluate their right side when the left side doesn't decide the result
+            void operator() (const Node::LogicAnd *logical_and) const {
+                std::string false_label = generator.generate_label(TokenType::double_ampersand);
+                code_stream << generator.generate_branch(logical_and->left_side, false, false_label);
+                code_stream << generator.generate_branch(logical_and->right_side, false, false_label);
+                code_stream << "\tmov eax, 1\n";
+                code_stream << "\tjmp " << false_label << "_end\n";
+                code_stream << false_label << ":\n";
+                code_stream << "\txor eax, eax\n";
+                code_stream << false_label << "_end:\n";
+                code_stream << generator.push_stack("rax");
+            }
+
+            void operator() (const Node::LogicOr *logical_or) const {
+                std::string true_label = generator.generate_label(TokenType::double_pipe);
+                code_stream << generator.generate_branch(logical_or->left_side, true, true_label);
+                code_stream << generator.generate_branch(logical_or->right_side, true, true_label);
+                code_stream << "\txor eax, eax\n";
+                code_stream << "\tjmp " << true_label << "_end\n";
+                code_stream << true_label << ":\n";
+                code_stream << "\tmov eax, 1\n";
+                code_stream << true_label << "_end:\n";
                 code_stream << generator.push_stack("rax");
             }
         };
         std::stringstream code;
-        BinExpressionVisitor visitor{.code_stream = code, .generator = *this};
+        int width = binary_expression_width(binary_expression);
+        BinExpressionVisitor visitor{.code_stream = code, .generator = *this, .width = width == 0 ? 64 : width};
         std::visit(visitor, binary_expression->bin_expr);
 
         return code.str();
     }
 
     [[nodiscard]] std::string generate_expression(const Node::Expression *expression) {
+        if (auto hoisted = m_hoisted.find(expression); hoisted != m_hoisted.end()) {
+            return push_variable(hoisted->second);
+        }
+
         struct ExpressionVisitor {
             std::stringstream &code_stream;
             CodeGenerator &generator;
@@ -156,224 +363,2260 @@ public:
         return code.str();
     }
 
-    [[nodiscard]] std::string generate_if_next(const Node::StmtIfNext *if_next) {
-        struct ExpressionVisitor {
-            std::stringstream &code_stream;
-            CodeGenerator &generator;
+    // Without a profile the arms are laid out in source order. With one, the arms tested before the one that runs
+    // most are moved out of line and taken by jumping, that arm falls through to the end, and the arms after it
+    // are moved out of line as well, so the common case gets through without a taken branch
+    [[nodiscard]] std::string generate_if(const Node::StmtIf *if_statement) {
+        std::stringstream code;
+        std::vector<IfArm> arms = if_arms(if_statement);
+        std::optional<size_t> hot = hot_arm(arms);
+        // The arm a chain without an else takes when nothing holds is empty unless it is being counted
+        if (!instrumenting() && !arms.back().scope.has_value() && hot != arms.size() - 1) {
+            arms.pop_back();
+        }
 
-            void operator() (const Node::StmtElif *elif_statement) const {
-                std::stringstream buffer;
-                std::string elif_label = generator.generate_label(TokenType::elif);
-                generator.m_labels.push_back(elif_label);
-                code_stream << "\n" << elif_label << ":\n";
-                code_stream << generator.generate_expression(elif_statement->expr);
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\ttest rax, rax\n";
-                generator.begin_scope();
-                for (const Node::Statement *stmt : elif_statement->scope->stmts) {
-                    buffer << generator.generate_statement(stmt);
-                }
-                buffer << generator.end_scope();
-                buffer << "\tjmp " << generator.m_labels.front() << "\n";
-                if (elif_statement->next.has_value()) {
-                    buffer << generator.generate_if_next(elif_statement->next.value());
-                    code_stream << "\tjz " << generator.m_labels.back() << "\n";
-                    generator.m_labels.pop_back();
-                }
-                else {
-                    code_stream << "\tjz " << generator.m_labels.front() << "\n";
-                }
-                code_stream << buffer.str();
-            }
+        std::string end_label = generate_label(TokenType::if_);
+        if (!hot.has_value()) {
+            code << generate_arms(arms, 0, end_label);
+            code << "\n" << end_label << ":\n";
+            return code.str();
+        }
 
-            void operator() (const Node::StmtElse *else_statement) {
-                std::string else_label = generator.generate_label(TokenType::else_);
-                generator.m_labels.push_back(else_label);
-                code_stream << "\n" << else_label << ":\n";
-                generator.begin_scope();
-                for (const Node::Statement *stmt : else_statement->scope->stmts) {
-                    code_stream << generator.generate_statement(stmt);
-                }
-                code_stream << generator.end_scope();
-                code_stream << "jmp " << generator.m_labels.front() << "\n";
+        for (size_t index = 0; index < hot.value(); index++) {
+            std::string cold_label = arm_label(arms[index]);
+            code << generate_branch(arms[index].condition.value(), true, cold_label);
+            std::stringstream cold;
+            cold << "\n" << cold_label << ":\n" << enclosing_line_marker();
+            cold << generate_arm(arms[index]);
+            cold << "\tjmp " << end_label << "\n";
+            m_cold_code << cold.str();
+        }
+
+        const IfArm &hot_arm = arms[hot.value()];
+        bool has_rest = hot.value() + 1 < arms.size();
+        std::string rest_label = has_rest ? arm_label(arms[hot.value() + 1]) : end_label;
+        if (hot_arm.condition.has_value()) {
+            code << generate_branch(hot_arm.condition.value(), false, rest_label);
+        }
+        code << generate_arm(hot_arm);
+        if (has_rest) {
+            std::stringstream cold;
+            cold << "\n" << rest_label << ":\n" << enclosing_line_marker();
+            cold << generate_arms(arms, hot.value() + 1, end_label);
+            cold << "\tjmp " << end_label << "\n";
+            m_cold_code << cold.str();
+        }
+        code << "\n" << end_label << ":\n";
+
+        return code.str();
+    }
+
+    // Arms in source order from the first one, whose label the caller places, each condition jumping to the next
+    // arm when it doesn't hold
+    [[nodiscard]] std::string generate_arms(const std::vector<IfArm> &arms, size_t first, const std::string &end_label) {
+        std::stringstream code;
+        for (size_t index = first; index < arms.size(); index++) {
+            bool last = index + 1 == arms.size();
+            std::string next_label = last ? end_label : arm_label(arms[index + 1]);
+            if (arms[index].condition.has_value()) {
+                code << generate_branch(arms[index].condition.value(), false, next_label);
             }
-        };
+            code << generate_arm(arms[index]);
+            if (!last) {
+                code << "\tjmp " << end_label << "\n";
+                code << "\n" << next_label << ":\n";
+            }
+        }
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_arm(const IfArm &arm) {
         std::stringstream code;
-        ExpressionVisitor visitor{.code_stream = code, .generator = *this};
-        std::visit(visitor, if_next->var);
+        code << count_block(arm.block);
+        if (arm.scope.has_value()) {
+            code << generate_scope(arm.scope.value());
+        }
 
         return code.str();
     }
 
-    [[nodiscard]] std::string generate_statement(const Node::Statement *statement) {
-        struct StatementVisitor {
-            std::stringstream &code_stream;
-            CodeGenerator &generator;
+    // The start time lives on the stack while the region runs. rdtscp waits for everything before it to finish and
+    // the lfence keeps everything after it from starting early, so only the region itself gets timed. A region left
+    // through return or exit isn't counted
+    [[nodiscard]] std::string generate_timed_region(const Node::StmtProfile *profile_statement) {
+        std::stringstream code;
+        auto [iterator, inserted] = m_timers.emplace(profile_statement->name.value.value(), m_timers.size());
+        size_t offset = iterator->second * 16;
 
-            void operator() (const Node::StmtExit *exit_statement) {
-                std::string exit_label = generator.generate_label(TokenType::exit);
-                code_stream << generator.generate_expression(exit_statement->expr);
-                code_stream << generator.pop_stack("rdi");
-                code_stream << "\tjmp _exit\n";
-            }
+        code << read_timestamp();
+        code << push_stack("rax");
+        code << generate_scope(profile_statement->scope);
+        code << read_timestamp();
+        code << pop_stack("rdx");
+        code << "\tsub rax, rdx\n";
+        code << shared_update() << "add QWORD [rel _timer_table + " << offset << "], rax\n";
+        code << shared_update() << "inc QWORD [rel _timer_table + " << offset + 8 << "]\n";
 
-            void operator() (const Node::StmtMut *mut_statement) {
-                std::string variable_identifier = mut_statement->identifier.value.value();
-                if (mut_statement->expr.has_value()) {
-                    code_stream << generator.generate_expression(mut_statement->expr.value());
-                }
-                else {
-                    code_stream << generator.move_stack(1);
-                }
+        return code.str();
+    }
 
-                generator.m_variables.add_variable(variable_identifier, generator.m_stack_pointer, generator.m_current_scope);
-            }
+    // Maps a stack for every worker in one go and starts a thread with clone on each, then sleeps on the count of
+    // workers still running until the last one to finish wakes it. Below r15 the starting thread keeps that count,
+    // the stacks, the number of workers and the r15 of whatever started it, in case a worker calls this function
+    [[nodiscard]] std::string generate_parallel(const Node::StmtParallel *parallel_statement) {
+        std::stringstream code;
+        std::string label = generate_label(TokenType::parallel);
+        m_uses_parallel = true;
 
-            void operator() (const Node::StmtIdent *identifier_statement) {
-                std::string variable_identifier = identifier_statement->identifier.value.value();
-                auto iterator = generator.m_variables.get_variable(variable_identifier, generator.m_current_scope);
-                const Variable& variable = iterator->second;
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (generator.m_stack_pointer - variable.stack_location) * 8 << "]";
-                code_stream << generator.generate_expression(identifier_statement->expr);
-                code_stream << generator.pop_stack(offset.str());
-            }
+        code << push_stack("r15");
+        code << generate_expression(parallel_statement->count);
+        code << "\tmov rax, [rsp]\n";
+        code << push_stack("rax");
+        code << push_stack("rax");
+        code << "\tmov r15, rsp\n";
+        const size_t base = m_stack_pointer;
+        code << "\ttest rax, rax\n";
+        code << "\tjle " << label << "_done\n";
 
-            void operator() (const Node::Scope *scope_statement) {
-                generator.begin_scope();
-                for (const Node::Statement *stmt : scope_statement->stmts) {
-                    code_stream << generator.generate_statement(stmt);
-                }
-                code_stream << generator.end_scope();
-            }
+        code << "\tmov rsi, rax\n";
+        code << "\timul rsi, rsi, " << worker_stack_size << "\n";
+        code << "\tjo _parallel_failed\n";
+        code << "\txor edi, edi\n";
+        code << "\tmov edx, 3\n"; // PROT_READ | PROT_WRITE
+        code << "\tmov r10d, 0x4022\n"; // MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+        code << "\tmov r8, -1\n";
+        code << "\txor r9d, r9d\n";
+        code << "\tmov eax, 9\n"; // mmap
+        code << "\tsyscall\n";
+        code << "\tcmp rax, -4095\n";
+        code << "\tjae _parallel_failed\n";
+        code << "\tmov [r15 + 8], rax\n";
 
-            void operator() (const Node::StmtIf *if_statement) {
-                std::stringstream buffer;
-                code_stream << generator.generate_expression(if_statement->expr);
-                std::string end_if_label = generator.generate_label(TokenType::if_);
-                generator.m_labels.push_back(end_if_label);
-                code_stream << generator.pop_stack("rax");
-                code_stream << "\ttest rax, rax\n";
-                generator.begin_scope();
-                for (const Node::Statement *stmt : if_statement->scope->stmts) {
-                    buffer << generator.generate_statement(stmt);
-                }
-                buffer << generator.end_scope();
-                buffer << "jmp " << generator.m_labels.front() << "\n";
-                if (if_statement->next.has_value()) {
-                    buffer << generator.generate_if_next(if_statement->next.value());
-                    code_stream << "\tjz " << generator.m_labels.back() << "\n";
-                    generator.m_labels.pop_back();
-                }
-                else {
-                    code_stream << "\tjz " << generator.m_labels.front() << "\n";
-                }
-                generator.m_labels.clear();
-                code_stream << buffer.str();
-                code_stream << "\n" << end_if_label << ":\n";
+        // A worker starts with its index on top of its stack and everything else the same as here
+        code << "\txor ebx, ebx\n";
+        code << label << "_spawn:\n";
+        code << "\tlea rsi, [rbx + 1]\n";
+        code << "\timul rsi, rsi, " << worker_stack_size << "\n";
+        code << "\tadd rsi, [r15 + 8]\n";
+        code << "\tsub rsi, 8\n";
+        code << "\tmov [rsi], rbx\n";
+        code << "\tmov edi, 0x50f00\n"; // CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM
+        code << "\txor edx, edx\n";
+        code << "\txor r10d, r10d\n";
+        code << "\txor r8d, r8d\n";
+        code << "\tmov eax, 56\n"; // clone
+        code << "\tsyscall\n";
+        code << "\ttest rax, rax\n";
+        code << "\tjz " << label << "_worker\n";
+        code << "\tjs _parallel_failed\n";
+        code << "\tinc rbx\n";
+        code << "\tcmp rbx, [r15 + 16]\n";
+        code << "\tjb " << label << "_spawn\n";
+
+        code << label << "_wait:\n";
+        code << "\tmov edx, [r15]\n";
+        code << "\ttest edx, edx\n";
+        code << "\tjz " << label << "_joined\n";
+        code << "\tmov rdi, r15\n";
+        code << "\tmov esi, 128\n"; // FUTEX_WAIT_PRIVATE, returns straight away if the count has changed since
+        code << "\txor r10d, r10d\n";
+        code << "\tmov eax, 202\n"; // futex
+        code << "\tsyscall\n";
+        code << "\tjmp " << label << "_wait\n";
+        code << label << "_joined:\n";
+        code << "\tmov rdi, [r15 + 8]\n";
+        code << "\tmov rsi, [r15 + 16]\n";
+        code << "\timul rsi, rsi, " << worker_stack_size << "\n";
+        code << "\tmov eax, 11\n"; // munmap
+        code << "\tsyscall\n";
+        code << "\tjmp " << label << "_done\n";
+
+        // The worker's stack carries on from the depth r15 was set at. After the count goes down it touches
+        // neither stack again, so the stacks can be unmapped as soon as the last one is done
+        const size_t stack_alignment = m_stack_alignment;
+        code << label << "_worker:\n";
+        m_stack_pointer = base + 8;
+        m_stack_alignment = base % 16;
+        m_worker = Worker{ .base = base, .index = Variable{ .stack_location = base + 8 } };
+        code << generate_scope(parallel_statement->scope);
+        m_worker.reset();
+        m_stack_pointer = base;
+        m_stack_alignment = stack_alignment;
+        code << "\tlock dec DWORD [r15]\n";
+        code << "\tjnz " << label << "_exit\n";
+        code << "\tmov rdi, r15\n";
+        code << "\tmov esi, 129\n"; // FUTEX_WAKE_PRIVATE
+        code << "\tmov edx, 1\n";
+        code << "\tmov eax, 202\n";
+        code << "\tsyscall\n";
+        code << label << "_exit:\n";
+        code << "\txor edi, edi\n";
+        code << "\tmov eax, 60\n"; // exit, which only ends this thread
+        code << "\tsyscall\n";
+
+        code << label << "_done:\n";
+        code << "\tadd rsp, 24\n";
+        m_stack_pointer -= 24;
+        code << pop_stack("r15");
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_scope(const Node::Scope *scope) {
+        std::stringstream code;
+        code << begin_scope(scope->stmts);
+        for (const Node::Statement *stmt : scope->stmts) {
+            code << generate_statement(stmt);
+        }
+        code << end_scope();
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_assignment(const Node::StmtIdent *identifier_statement) {
+        std::stringstream code;
+        std::string variable_identifier = identifier_statement->identifier.value.value();
+        auto iterator = m_variables.get_variable(variable_identifier, m_current_scope);
+        Variable variable = iterator->second; // A copy, inlining a call in the expression swaps out m_variables
+        if (is_shared(variable) && variable.type != TokenType::boolean) {
+            if (auto reduction = generate_reduction(identifier_statement, variable)) {
+                return reduction.value();
             }
+        }
+        code << generate_expression(identifier_statement->expr);
+        code << pop_variable(variable);
+
+        return code.str();
+    }
+
+    // In a worker, an assignment that only adds to or subtracts from a variable outside the parallel block is a
+    // reduction. The rest of the sum is worked out first and then added in with one lock xadd, so no worker
+    // loses what another added in between. The low bits of a sum don't depend on the width it was taken at, so
+    // the variable ends up with what the plain assignment would have stored
+    std::optional<std::string> generate_reduction(const Node::StmtIdent *identifier_statement, const Variable &variable) {
+        std::vector<std::pair<const Node::Expression*, bool>> operands;
+        sum_operands(identifier_statement->expr, false, operands);
+        auto is_target = [&](const std::pair<const Node::Expression*, bool> &operand) {
+            auto term = std::get_if<Node::Term*>(&operand.first->var);
+            auto identifier_term = term != nullptr ? std::get_if<Node::TermIdent*>(&(*term)->var) : nullptr;
+            return identifier_term != nullptr
+                   && (*identifier_term)->identifier.value.value() == identifier_statement->identifier.value.value();
         };
+        auto target = std::find_if(operands.begin(), operands.end(), is_target);
+        if (target == operands.end() || target->second || std::count_if(operands.begin(), operands.end(), is_target) != 1
+            || operands.size() == 1) {
+            return {};
+        }
+        operands.erase(target);
+
         std::stringstream code;
-        StatementVisitor visitor{.code_stream = code, .generator = *this};
-        std::visit(visitor, statement->var);
+        code << generate_expression(operands.front().first);
+        if (operands.front().second) {
+            code << pop_stack("rax");
+            code << "\tneg rax\n";
+            code << push_stack("rax");
+        }
+        for (size_t index = 1; index < operands.size(); index++) {
+            code << generate_expression(operands[index].first);
+            code << pop_stack("rcx");
+            code << pop_stack("rax");
+            code << (operands[index].second ? "\tsub rax, rcx\n" : "\tadd rax, rcx\n");
+            code << push_stack("rax");
+        }
+        code << pop_stack("rax");
+        code << "\tlock xadd " << variable_operand(variable) << ", " << sized_register(0, variable.type) << "\n";
 
         return code.str();
     }
 
-    [[nodiscard]] std::string generate_program() {
-        m_asm_code << "global _start\n_start:\n";
-
-        for (const Node::Statement *statement : m_program_node.statements) {
-            m_asm_code << generate_statement(statement);
+    // The terms of a sum through any parentheses, each with whether it ends up subtracted
+    static void sum_operands(const Node::Expression *expression, bool negated,
+                             std::vector<std::pair<const Node::Expression*, bool>> &operands) {
+        expression = strip_parentheses(expression);
+        if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression->var)) {
+            if (auto add = std::get_if<Node::BinAdd*>(&(*binary_expression)->bin_expr)) {
+                sum_operands((*add)->left_side, negated, operands);
+                sum_operands((*add)->right_side, negated, operands);
+                return;
+            }
+            if (auto subtract = std::get_if<Node::BinSubtract*>(&(*binary_expression)->bin_expr)) {
+                sum_operands((*subtract)->left_side, negated, operands);
+                sum_operands((*subtract)->right_side, !negated, operands);
+                return;
+            }
         }
+        operands.emplace_back(expression, negated);
+    }
 
-        m_asm_code << "\n\tmov rdi, 0\n";
-        m_asm_code << "\n_exit:\n";
-        m_asm_code << "\tmov rax, 60\n";
-        m_asm_code << "\tsyscall\n";
+    [[nodiscard]] std::string generate_element_assignment(const Node::StmtIndex *index_statement) {
+        std::stringstream code;
+        auto iterator = m_variables.get_variable(index_statement->identifier.value.value(), m_current_scope);
+        Variable variable = iterator->second;
+        code << generate_expression(index_statement->index);
+        code << generate_expression(index_statement->expr);
+        code << pop_stack("rax");
+        code << pop_stack("rcx");
+        code << "\tmov " << element_operand(variable, "rcx") << ", " << sized_register(0, variable.type) << "\n";
 
-        return m_asm_code.str();
+        return code.str();
     }
 
+    // Whole array assignments run over the arrays in 32 byte AVX2 vectors when the target has them, in 16 byte
+    // SSE2 vectors otherwise, and finish whatever is left one element at a time. The array length is known here,
+    // so every trip count is a constant
+    [[nodiscard]] std::string generate_array_assignment(const Node::StmtArray *array_statement) {
+        std::stringstream code;
+        auto iterator = m_variables.get_variable(array_statement->identifier.value.value(), m_current_scope);
+        const Variable& target = iterator->second;
+        size_t element_size = type_size(target.type);
+        size_t bytes = target.length * element_size;
+        size_t avx2_bytes = bytes & ~static_cast<size_t>(31);
+        size_t sse2_bytes = bytes & ~static_cast<size_t>(15);
+        std::string label = generate_label(TokenType::open_square_bracket);
 
-private:
-    int m_current_scope;
-    Variables m_variables;
-    size_t m_stack_pointer;
-    std::stringstream m_asm_code;
-    std::vector<std::string> m_labels;
-    const Node::Program m_program_node;
-    std::map<TokenType, int> m_label_map;
+        bool avx2 = has_avx2() && avx2_bytes != 0;
+        size_t vector_bytes = avx2 ? avx2_bytes : sse2_bytes;
 
-    std::string push_stack(const std::string &x64_register) {
+        code << "\txor ecx, ecx\n";
+        if (avx2) {
+            code << align_loop();
+            code << label << "_avx2:\n";
+            code << generate_vector_lanes(array_statement->expr, target.type, 0, true);
+            code << "\tvmovdqu [" << variable_address(target) << " + rcx], ymm0\n";
+            code << "\tadd rcx, 32\n";
+            code << "\tcmp rcx, " << avx2_bytes << "\n";
+            code << "\tjb " << label << "_avx2\n";
+            code << "\tvzeroupper\n";
+        }
+        else if (sse2_bytes != 0) {
+            code << align_loop();
+            code << label << "_sse2:\n";
+            code << generate_vector_lanes(array_statement->expr, target.type, 0, false);
+            code << "\tmovdqu [" << variable_address(target) << " + rcx], xmm0\n";
+            code << "\tadd rcx, 16\n";
+            code << "\tcmp rcx, " << sse2_bytes << "\n";
+            code << "\tjb " << label << "_sse2\n";
+        }
+        if (vector_bytes != bytes) {
+            code << label << "_scalar:\n";
+            code << generate_scalar_lanes(array_statement->expr, target.type, 0);
+            code << "\tmov " << element_operand(target, "rcx", false) << ", " << sized_register(0, target.type) << "\n";
+            code << "\tadd rcx, " << element_size << "\n";
+            code << "\tcmp rcx, " << bytes << "\n";
+            code << "\tjb " << label << "_scalar\n";
+        }
+
+        return code.str();
+    }
+
+    // Evaluates an array expression for one vector of elements at byte offset rcx into xmm or ymm register
+    // `depth`, using the registers above it as scratch
+    std::string generate_vector_lanes(const Node::Expression *expression, TokenType type, size_t depth, bool avx2) {
         std::stringstream code;
-        code << "\tpush " << x64_register << "\n";
-        m_stack_pointer++; // One size is 64bit
+        std::string vector_register = (avx2 ? "ymm" : "xmm") + std::to_string(depth);
+        expression = strip_parentheses(expression);
+        if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+            const Variable &variable = array_operand(std::get<Node::TermIdent*>((*term)->var));
+            code << "\t" << (avx2 ? "vmovdqu " : "movdqu ") << vector_register << ", [" << variable_address(variable) << " + rcx]\n";
+            return code.str();
+        }
+
+        std::visit([&](const auto *operation) {
+            std::string instruction = vector_instruction(operation, type);
+            code << generate_vector_lanes(operation->left_side, type, depth, avx2);
+            const Node::Expression *right_side = strip_parentheses(operation->right_side);
+            auto right_term = std::get_if<Node::Term*>(&right_side->var);
+            if (avx2 && right_term != nullptr) {
+                // VEX encoded instructions take unaligned memory operands, so a plain array needs no load
+                const Variable &variable = array_operand(std::get<Node::TermIdent*>((*right_term)->var));
+                code << "\tv" << instruction << " " << vector_register << ", " << vector_register << ", ["
+                     << variable_address(variable) << " + rcx]\n";
+                return;
+            }
+
+            std::string right_register = (avx2 ? "ymm" : "xmm") + std::to_string(depth + 1);
+            code << generate_vector_lanes(right_side, type, depth + 1, avx2);
+            if (avx2) {
+                code << "\tv" << instruction << " " << vector_register << ", " << vector_register << ", " << right_register << "\n";
+            }
+            else {
+                code << "\t" << instruction << " " << vector_register << ", " << right_register << "\n";
+            }
+        }, std::get<Node::BinExpr*>(expression->var)->bin_expr);
 
         return code.str();
     }
 
-    std::string pop_stack(const std::string &x64_register) {
+    // The same for a single element, computed at 64 bits in the registers of scalar_registers
+    std::string generate_scalar_lanes(const Node::Expression *expression, TokenType type, size_t depth) {
         std::stringstream code;
-        code << "\tpop " << x64_register << "\n";
-        m_stack_pointer--; // One size is 64bit
+        expression = strip_parentheses(expression);
+        if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+            const Variable &variable = array_operand(std::get<Node::TermIdent*>((*term)->var));
+            code << load_element(variable, scalar_registers[depth], element_operand(variable, "rcx", false));
+            return code.str();
+        }
+
+        std::visit([&](const auto *operation) {
+            using Operation = std::remove_cvref_t<decltype(*operation)>;
+            std::string instruction;
+            if constexpr (std::is_same_v<Operation, Node::BinAdd>) {
+                instruction = "add";
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BinSubtract>) {
+                instruction = "sub";
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BitAnd>) {
+                instruction = "and";
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BitOr>) {
+                instruction = "or";
+            }
+            else {
+                instruction = "xor";
+            }
+            code << generate_scalar_lanes(operation->left_side, type, depth);
+            code << generate_scalar_lanes(operation->right_side, type, depth + 1);
+            code << "\t" << instruction << " " << scalar_registers[depth] << ", " << scalar_registers[depth + 1] << "\n";
+        }, std::get<Node::BinExpr*>(expression->var)->bin_expr);
 
         return code.str();
     }
 
-    std::string move_stack(int offset) {
+    // SSE2 name of an elementwise operation, AVX2 spells it with a leading v
+    template <typename Operation> static std::string vector_instruction(const Operation*, TokenType type) {
+        std::string suffix = type == TokenType::int16 ? "w" : type == TokenType::int32 ? "d" : "q";
+        if constexpr (std::is_same_v<Operation, Node::BinAdd>) {
+            return "padd" + suffix;
+        }
+        else if constexpr (std::is_same_v<Operation, Node::BinSubtract>) {
+            return "psub" + suffix;
+        }
+        else if constexpr (std::is_same_v<Operation, Node::BitAnd>) {
+            return "pand";
+        }
+        else if constexpr (std::is_same_v<Operation, Node::BitOr>) {
+            return "por";
+        }
+        else {
+            return "pxor";
+        }
+    }
+
+    const Variable& array_operand(const Node::TermIdent *identifier_term) {
+        return m_variables.get_variable(identifier_term->identifier.value.value(), m_current_scope)->second;
+    }
+
+    // Loads an element or variable of the given type sign extended into a 64bit register
+    static std::string load_element(const Variable &variable, const std::string &x64_register, const std::string &operand) {
+        switch (variable.type) {
+            case TokenType::int16:
+                return "\tmovsx " + x64_register + ", " + operand + "\n";
+            case TokenType::int32:
+                return "\tmovsxd " + x64_register + ", " + operand + "\n";
+            default:
+                return "\tmov " + x64_register + ", " + operand + "\n";
+        }
+    }
+
+    // The low bits of one of the scalar_registers that hold a value of the given type
+    static std::string sized_register(size_t depth, TokenType type) {
+        static const std::vector<std::vector<std::string>> names = {
+            { "ax", "eax", "rax" }, { "dx", "edx", "rdx" }, { "si", "esi", "rsi" }, { "di", "edi", "rdi" },
+            { "r8w", "r8d", "r8" }, { "r9w", "r9d", "r9" }, { "r10w", "r10d", "r10" }, { "r11w", "r11d", "r11" }
+        };
+        size_t width = type == TokenType::int16 ? 0 : type == TokenType::int32 ? 1 : 2;
+
+        return names.at(depth).at(width);
+    }
+
+    // Arrays start out zeroed, rep stosb is fast for any length on everything with ERMSB
+    std::string clear_array(const Variable &variable) {
         std::stringstream code;
-        code << "\tsub rsp, " << offset * 8 << "\n";
-        m_stack_pointer = m_stack_pointer + offset; // One size is 64bit
+        code << "\tlea rdi, [" << variable_address(variable) << "]\n";
+        code << "\txor eax, eax\n";
+        code << "\tmov rcx, " << variable.length * type_size(variable.type) << "\n";
+        code << "\trep stosb\n";
 
         return code.str();
     }
 
-    void begin_scope() {
-        m_variables.scope_push({});
-        m_current_scope++;
+    // Stores the x86-64 level of the CPU in _cpu_level for multi versioned regions to dispatch on. Level 3 also
+    // needs the kernel to save the ymm registers
+    static std::string generate_cpu_detection() {
+        std::stringstream code;
+        code << "\tmov BYTE [rel _cpu_level], 1\n";
+        code << "\txor eax, eax\n";
+        code << "\tcpuid\n";
+        code << "\tmov r8d, eax\n"; // Highest leaf
+        code << "\tmov eax, 1\n";
+        code << "\tcpuid\n";
+        code << "\tmov r9d, ecx\n";
+        code << "\tand ecx, 0x982201\n"; // SSE3, SSSE3, CMPXCHG16B, SSE4.1, SSE4.2 and POPCNT
+        code << "\tcmp ecx, 0x982201\n";
+        code << "\tjne _cpu_detected\n";
+        code << "\tmov BYTE [rel _cpu_level], 2\n";
+        code << "\tcmp r8d, 7\n";
+        code << "\tjb _cpu_detected\n";
+        code << "\tand r9d, 0x38401000\n"; // FMA, MOVBE, OSXSAVE, AVX and F16C
+        code << "\tcmp r9d, 0x38401000\n";
+        code << "\tjne _cpu_detected\n";
+        code << "\txor ecx, ecx\n";
+        code << "\txgetbv\n";
+        code << "\tand eax, 6\n"; // xmm and ymm state enabled
+        code << "\tcmp eax, 6\n";
+        code << "\tjne _cpu_detected\n";
+        code << "\tmov eax, 7\n";
+        code << "\txor ecx, ecx\n";
+        code << "\tcpuid\n";
+        code << "\tand ebx, 0x128\n"; // BMI1, AVX2 and BMI2
+        code << "\tcmp ebx, 0x128\n";
+        code << "\tjne _cpu_detected\n";
+        code << "\tmov eax, 0x80000001\n";
+        code << "\tcpuid\n";
+        code << "\tbt ecx, 5\n"; // LZCNT
+        code << "\tjnc _cpu_detected\n";
+        code << "\tmov BYTE [rel _cpu_level], 3\n";
+        code << "_cpu_detected:\n";
+
+        return code.str();
     }
 
-    std::string end_scope() {
+    // Builds the result of an if-converted chain from the last arm back to the first, each arm replacing the
+    // value so far with cmov when its condition holds. Only the first condition is evaluated unconditionally
+    // in the source, and it is evaluated last here, which is fine as everything before it is side effect free
+    [[nodiscard]] std::string generate_select(const Select &select) {
         std::stringstream code;
-        auto scope_top = m_variables.get_top();
-        size_t pop_count = scope_top.size();
-        for(const std::string& identifier : scope_top){
-            m_variables.delete_variable(identifier);
+        auto iterator = m_variables.get_variable(select.target.value.value(), m_current_scope);
+        Variable variable = iterator->second;
+        if (select.otherwise.has_value()) {
+            code << generate_expression(select.otherwise.value());
+        }
+        else {
+            code << push_variable(variable);
         }
 
-        code << "\tadd rsp, " << pop_count * 8 << "\n";
-        m_variables.scope_pop();
-        m_stack_pointer -= pop_count;
-        m_current_scope--;
+        for (auto arm = select.arms.rbegin(); arm != select.arms.rend(); arm++) {
+            code << generate_expression(arm->value);
+            auto [condition_code, condition_flags] = generate_flags(arm->condition);
+            code << condition_flags;
+            // Neither pop nor push touch the flags
+            code << pop_stack("rbx");
+            code << pop_stack("rax");
+            code << "\tcmov" << condition_code << " rax, rbx\n";
+            code << push_stack("rax");
+        }
+        code << pop_variable(variable);
 
         return code.str();
     }
 
-    std::string generate_label(TokenType type) {
-        std::string label;
+    // Calls follow the System V AMD64 convention: the first six arguments go in registers, the rest are pushed
+    // right to left, and rsp is 16 byte aligned at the call instruction
+    [[nodiscard]] std::string generate_call(const Node::TermCall *call_term, bool value_used) {
+        const Node::Function *function = m_functions.at(call_term->identifier.value.value());
+        if (m_inliner.should_inline(function)) {
+            return generate_inline_call(function, call_term, value_used);
+        }
+
+        std::stringstream code;
+        size_t stack_arguments = call_term->args.size() > argument_registers.size() ? call_term->args.size() - argument_registers.size() : 0;
+        size_t padding = (16 + m_stack_alignment - (m_stack_pointer + stack_arguments * 8) % 16) % 16;
+        if (padding != 0) {
+            code << "\tsub rsp, " << padding << "\n";
+            m_stack_pointer += padding;
+        }
+
+        for (auto argument = call_term->args.rbegin(); argument != call_term->args.rend(); argument++) {
+            code << generate_expression(*argument);
+        }
+        for (size_t index = 0; index < call_term->args.size() && index < argument_registers.size(); index++) {
+            code << pop_stack(argument_registers[index]);
+        }
+        code << "\tcall " << function_label(function) << "\n";
+
+        size_t cleanup = stack_arguments * 8 + padding;
+        if (cleanup != 0) {
+            code << "\tadd rsp, " << cleanup << "\n";
+            m_stack_pointer -= cleanup;
+        }
+        if (value_used) {
+            code << push_stack("rax");
+        }
+
+        return code.str();
+    }
+
+    // Arguments are evaluated straight into the stack slots the parameters live in, and returns jump past the
+    // body instead of unwinding a frame
+    [[nodiscard]] std::string generate_inline_call(const Node::Function *function, const Node::TermCall *call_term, bool value_used) {
+        std::stringstream code;
+        size_t entry_depth = m_stack_pointer;
+        for (auto argument = call_term->args.rbegin(); argument != call_term->args.rend(); argument++) {
+            code << generate_expression(*argument);
+        }
+
+        Variables caller_variables = std::exchange(m_variables, Variables{});
+        int caller_scope = std::exchange(m_current_scope, 0);
+        m_variables.scope_push({});
+        m_current_scope++;
+        for (size_t index = 0; index < function->params.size(); index++) {
+            const Node::Parameter &parameter = function->params[index];
+            size_t stack_location = entry_depth + (call_term->args.size() - index) * 8;
+            m_variables.add_variable(parameter.identifier.value.value(), stack_location, parameter.type.type, m_current_scope);
+        }
+
+        std::string end_label = generate_label(TokenType::return_);
+        m_returns.push_back({ .depth = entry_depth, .type = return_type(function), .end_label = end_label, .last = last_return(function->scope) });
+        code << generate_function_body(function);
+        m_returns.pop_back();
+        code << "\n" << end_label << ":\n";
+
+        m_stack_pointer = entry_depth;
+        m_variables = std::move(caller_variables);
+        m_current_scope = caller_scope;
+        if (value_used) {
+            code << push_stack("rax");
+        }
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_function(const Node::Function *function) {
+        std::stringstream code;
+        Variables caller_variables = std::exchange(m_variables, Variables{});
+        size_t stack_arguments = function->params.size() > argument_registers.size() ? function->params.size() - argument_registers.size() : 0;
+
+        // The return address and the caller's stack arguments are already on the stack, and rsp was 16 byte
+        // aligned just before the return address was pushed
+        m_stack_pointer = (stack_arguments + 1) * 8;
+        m_stack_alignment = (m_stack_pointer - 8) % 16;
+        m_current_scope = 0;
+
+        code << "\n" << line_marker(function->identifier.line_no);
+        code << function_label(function) << ":\n";
+        code << push_stack("rbx"); // rbx is callee saved
+        m_variables.scope_push({});
+        m_current_scope++;
+        for (size_t index = 0; index < function->params.size(); index++) {
+            const Node::Parameter &parameter = function->params[index];
+            size_t stack_location;
+            if (index < argument_registers.size()) {
+                code << push_stack(argument_registers[index]);
+                stack_location = m_stack_pointer;
+            }
+            else {
+                stack_location = (stack_arguments + 1) * 8 - 8 - (index - argument_registers.size()) * 8;
+            }
+            m_variables.add_variable(parameter.identifier.value.value(), stack_location, parameter.type.type, m_current_scope);
+        }
+
+        m_returns.push_back({ .depth = (stack_arguments + 2) * 8, .type = return_type(function), .last = last_return(function->scope) });
+        m_in_function = true;
+        code << generate_function_body(function);
+        m_in_function = false;
+        code << line_marker(function->identifier.line_no); // The epilogue
+        m_returns.pop_back();
+
+        m_variables = std::move(caller_variables);
+
+        return code.str();
+    }
+
+    // Generates the body of a function, which leaves its result in rax and the stack at the depth its return
+    // context was entered at
+    [[nodiscard]] std::string generate_function_body(const Node::Function *function) {
+        std::stringstream code;
+        code << begin_scope(function->scope->stmts);
+        for (const Node::Statement *stmt : function->scope->stmts) {
+            code << generate_statement(stmt);
+        }
+        std::string scope_end = end_scope();
+
+        // A trailing return has already unwound everything, otherwise fall off the end returning 0
+        if (m_returns.back().last == nullptr) {
+            code << scope_end;
+            code << "\txor eax, eax\n";
+            code << generate_return_jump();
+        }
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_return(const Node::StmtReturn *return_statement) {
+        std::stringstream code;
+        if (return_statement->expr.has_value()) {
+            code << generate_expression(return_statement->expr.value());
+            code << pop_stack("rax");
+            code << extend_return();
+        }
+        code << generate_return_jump(m_returns.back().last == return_statement);
+
+        return code.str();
+    }
+
+    // Unwinds the stack back to where the return context started and leaves the function
+    std::string generate_return_jump(bool falls_through = false) {
+        std::stringstream code;
+        const ReturnContext &context = m_returns.back();
+        if (m_stack_pointer != context.depth) {
+            code << "\tadd rsp, " << m_stack_pointer - context.depth << "\n";
+        }
+
+        if (!context.end_label.has_value()) {
+            code << "\tpop rbx\n";
+            code << "\tret\n";
+        }
+        else if (!falls_through) {
+            code << "\tjmp " << context.end_label.value() << "\n";
+        }
+
+        return code.str();
+    }
+
+    // Loops are laid out with the condition at the bottom so every iteration takes a single taken branch, and
+    // the body starts on a 16 byte boundary that is only ever reached by jumps
+    [[nodiscard]] std::string generate_loop(TokenType type, std::optional<const Node::Expression*> condition, const Node::Scope *body,
+                                            std::optional<const Node::StmtIdent*> step) {
+        std::stringstream code;
+        LoopAnalysis analysis(body, condition, step);
+        std::vector<const Node::Expression*> hoisted;
+        std::vector<const Node::Expression*> invariants;
+        if (m_options.optimizations.hoist_invariants) {
+            invariants = analysis.invariants();
+        }
+        for (const Node::Expression *invariant : invariants) {
+            if (!m_hoisted.contains(invariant)) {
+                code << generate_expression(invariant);
+                m_hoisted[invariant] = Variable{ .stack_location = m_stack_pointer };
+                hoisted.push_back(invariant);
+            }
+        }
+
+        std::vector<InductionProduct> products;
+        if (step.has_value() && m_options.optimizations.strength_reduction) {
+            auto iterator = m_variables.get_variable(step.value()->identifier.value.value(), m_current_scope);
+            if (iterator->second.type == TokenType::int64) {
+                products = analysis.induction_products();
+            }
+        }
+        for (const InductionProduct &product : products) {
+            code << generate_expression(product.expression);
+            m_hoisted[product.expression] = Variable{ .stack_location = m_stack_pointer };
+            hoisted.push_back(product.expression);
+        }
+
+        std::string loop_label = generate_label(type);
+        if (condition.has_value()) {
+            code << "\tjmp " << loop_label << "_condition\n";
+        }
+        code << "\n" << align_loop();
+        code << loop_label << "_body:\n";
+        code << count_block(body);
+        code << generate_scope(body);
+        if (step.has_value()) {
+            code << generate_assignment(step.value());
+            for (const InductionProduct &product : products) {
+                std::string operand = variable_operand(m_hoisted[product.expression]);
+                if (product.increment >= INT32_MIN && product.increment <= INT32_MAX) {
+                    code << "\tadd " << operand << ", " << product.increment << "\n";
+                }
+                else {
+                    code << load_immediate(product.increment);
+                    code << "\tadd " << operand << ", rax\n";
+                }
+            }
+        }
+
+        if (condition.has_value()) {
+            code << "\n" << loop_label << "_condition:\n";
+            code << generate_branch(condition.value(), true, loop_label + "_body");
+        }
+        else {
+            code << "\tjmp " << loop_label << "_body\n";
+        }
+
+        for (const Node::Expression *expression : hoisted) {
+            m_hoisted.erase(expression);
+        }
+        if (!hoisted.empty()) {
+            code << "\tadd rsp, " << hoisted.size() * 8 << "\n";
+            m_stack_pointer -= hoisted.size() * 8;
+        }
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_statement(const Node::Statement *statement) {
+        // Code after a nested statement belongs to the enclosing one again. Multi versioning generates the same
+        // statement once more, which keeps the line it already has
+        if (m_options.line_file.has_value() && (m_line_statements.empty() || m_line_statements.back() != statement)) {
+            std::stringstream code;
+            m_line_statements.push_back(statement);
+            code << line_marker(statement->line_no);
+            code << generate_statement(statement);
+            m_line_statements.pop_back();
+            if (!m_line_statements.empty()) {
+                code << line_marker(m_line_statements.back()->line_no);
+            }
+
+            return code.str();
+        }
+
+        if (m_options.target.multi && !m_in_region && is_hot_region(statement)) {
+            return generate_multiversioned(statement);
+        }
+
+        struct StatementVisitor {
+            std::stringstream &code_stream;
+            CodeGenerator &generator;
+
+            void operator() (const Node::StmtExit *exit_statement) {
+                std::string exit_label = generator.generate_label(TokenType::exit);
+                code_stream << generator.generate_expression(exit_statement->expr);
+                code_stream << generator.pop_stack("rdi");
+                code_stream << "\tjmp _exit\n";
+            }
+
+            void operator() (const Node::StmtPrint *print_statement) {
+                code_stream << generator.generate_expression(print_statement->expr);
+                code_stream << generator.pop_stack("rax");
+                code_stream << (generator.is_concurrent() ? "\tcall _print_locked\n" : "\tcall _print\n");
+                generator.m_uses_print = true;
+            }
+
+            void operator() (const Node::StmtParallel *parallel_statement) {
+                code_stream << generator.generate_parallel(parallel_statement);
+            }
+
+            void operator() (const Node::StmtMut *mut_statement) {
+                std::string variable_identifier = mut_statement->identifier.value.value();
+                size_t stack_location = generator.m_frame_slots.at(mut_statement);
+                TokenType type = mut_statement->type.type;
+                if (mut_statement->expr.has_value()) {
+                    code_stream << generator.generate_expression(mut_statement->expr.value());
+                }
+
+                generator.m_variables.add_variable(variable_identifier, stack_location, type, generator.m_current_scope,
+                                                   mut_statement->length.value_or(0));
+                auto iterator = generator.m_variables.get_variable(variable_identifier, generator.m_current_scope);
+                if (mut_statement->expr.has_value()) {
+                    code_stream << generator.pop_variable(iterator->second);
+                }
+                if (mut_statement->length.has_value()) {
+                    code_stream << generator.clear_array(iterator->second);
+                }
+            }
+
+            void operator() (const Node::StmtIndex *index_statement) {
+                code_stream << generator.generate_element_assignment(index_statement);
+            }
+
+            void operator() (const Node::StmtArray *array_statement) {
+                code_stream << generator.generate_array_assignment(array_statement);
+            }
+
+            void operator() (const Node::StmtIdent *identifier_statement) {
+                code_stream << generator.generate_assignment(identifier_statement);
+            }
+
+            void operator() (const Node::Scope *scope_statement) {
+                code_stream << generator.generate_scope(scope_statement);
+            }
+
+            void operator() (const Node::StmtIf *if_statement) {
+                // Instrumented builds keep every branch so its arms can be counted
+                if (generator.m_options.optimizations.if_conversion && !generator.instrumenting()
+                    && !generator.is_biased(generator.if_arms(if_statement))) {
+                    auto select = IfConversion::match(if_statement);
+                    // A select loads and stores a variable shared by the workers without a lock, which would lose
+                    // what other workers add to it in between
+                    if (select.has_value() && !generator.is_shared(generator.m_variables.get_variable(
+                                                   select->target.value.value(), generator.m_current_scope)->second)) {
+                        code_stream << generator.generate_select(select.value());
+                        return;
+                    }
+                }
+
+                code_stream << generator.generate_if(if_statement);
+            }
+
+            void operator() (const Node::StmtProfile *profile_statement) {
+                code_stream << generator.generate_timed_region(profile_statement);
+            }
+
+            void operator() (const Node::StmtWhile *while_statement) {
+                code_stream << generator.generate_loop(TokenType::while_, while_statement->expr, while_statement->scope, {});
+            }
+
+            void operator() (const Node::StmtCall *call_statement) {
+                code_stream << generator.generate_call(call_statement->call, false);
+            }
+
+            void operator() (const Node::StmtReturn *return_statement) {
+                code_stream << generator.generate_return(return_statement);
+            }
+
+            void operator() (const Node::StmtFor *for_statement) {
+                std::vector<Node::Statement*> init;
+                if (for_statement->init.has_value()) {
+                    init.push_back(for_statement->init.value());
+                }
+                code_stream << generator.begin_scope(init);
+                for (const Node::Statement *stmt : init) {
+                    code_stream << generator.generate_statement(stmt);
+                }
+                code_stream << generator.generate_loop(TokenType::for_, for_statement->expr, for_statement->scope, for_statement->step);
+                code_stream << generator.end_scope();
+            }
+        };
+        std::stringstream code;
+        StatementVisitor visitor{.code_stream = code, .generator = *this};
+        std::visit(visitor, statement->var);
+
+        return code.str();
+    }
+
+    // Emits a variant of a hot region for every level that changes its code, and picks the best one the CPU
+    // supports on the way in. The level is read from memory that is written once at startup, so the branches
+    // always go the same way
+    [[nodiscard]] std::string generate_multiversioned(const Node::Statement *region) {
+        std::stringstream code;
+        std::vector<TargetLevel> levels = Target::variants(region);
+        m_in_region = true;
+        if (levels.size() == 1) {
+            code << generate_statement(region);
+            m_in_region = false;
+            return code.str();
+        }
+
+        m_uses_cpu_level = true;
+        std::string label = "_region_" + m_label_namespace + std::to_string(m_regions++);
+        for (size_t index = 0; index + 1 < levels.size(); index++) {
+            int level = static_cast<int>(levels[index]);
+            code << "\tcmp BYTE [rel _cpu_level], " << level << "\n";
+            code << "\tjae " << label << "_v" << level << "\n";
+        }
+        code << generate_variant(region, levels.back());
+        code << "\tjmp " << label << "_end\n";
+        for (size_t index = 0; index + 1 < levels.size(); index++) {
+            int level = static_cast<int>(levels[index]);
+            code << label << "_v" << level << ":\n";
+            code << generate_variant(region, levels[index]);
+            if (index + 2 < levels.size()) {
+                code << "\tjmp " << label << "_end\n";
+            }
+        }
+        code << label << "_end:\n";
+        m_in_region = false;
+
+        return code.str();
+    }
+
+    [[nodiscard]] std::string generate_program() {
+        std::stringstream code;
+        code << allocate_frame(m_program_node.statements);
+
+        // _exit reports every region, including those only functions have, so they all get their timers first
+        assign_timers();
+        code << generate_top_level();
+
+        // Functions are generated before _exit, which has to know whether any of them prints
+        std::stringstream functions;
+        for (const Node::Function *function : m_program_node.functions) {
+            if (m_inliner.is_emitted(function)) {
+                functions << generate_function(function);
+            }
+        }
+
+        code << "\n\tmov rdi, 0\n";
+        code << line_marker(1);
+        code << "\n_exit:\n";
+        if (m_uses_print) {
+            code << "\tmov rbx, rdi\n";
+            code << "\tcall _print_flush\n";
+            code << "\tmov rdi, rbx\n";
+        }
+        if (!m_timers.empty()) {
+            code << generate_timer_report();
+        }
+        if (instrumenting()) {
+            code << generate_profile_write();
+        }
+        // exit would only end the thread that called it, when there can be others exit_group ends them all
+        code << (m_uses_parallel ? "\tmov rax, 231\n" : "\tmov rax, 60\n");
+        code << "\tsyscall\n";
+        if (m_uses_print) {
+            code << generate_print_runtime();
+        }
+        if (m_uses_parallel) {
+            code << generate_parallel_runtime();
+        }
+
+        code << functions.str();
+        code << m_cold_code.str();
+
+        // The CPU is only checked when some code depends on what it supports
+        m_asm_code << "global _start\n" << line_marker(1) << "_start:\n";
+        if (m_uses_cpu_level) {
+            m_asm_code << generate_cpu_detection();
+        }
+        m_asm_code << code.str();
+        if (m_uses_cpu_level) {
+            m_asm_code << "\nsection .bss\n";
+            m_asm_code << "_cpu_level: resb 1\n";
+        }
+        if (instrumenting()) {
+            m_asm_code << generate_profile_data();
+        }
+        if (!m_timers.empty()) {
+            m_asm_code << generate_timer_data();
+        }
+        if (m_uses_print) {
+            m_asm_code << generate_print_data();
+        }
+        if (m_uses_parallel) {
+            m_asm_code << generate_parallel_data();
+        }
+
+        return m_asm_code.str();
+    }
+
+
+private:
+    // Where a return statement unwinds to: the stack depth its function or inlined body started at, and for
+    // inlined bodies the label after them
+    struct ReturnContext {
+        size_t depth;
+        TokenType type;
+        std::optional<std::string> end_label{};
+        const Node::StmtReturn *last = nullptr;
+    };
+
+    // What the code of a worker thread needs: the stack depth r15 was set at on the thread that started it, and
+    // the worker's index, which is the first thing on its own stack
+    struct Worker {
+        size_t base;
+        Variable index;
+    };
+
+    // The pieces of a line of the profile region report, around the name and the numbers
+    inline static const std::string timer_separator = ": ";
+    inline static const std::string timer_hits = " hits, ";
+    inline static const std::string timer_cycles = " cycles, ";
+    inline static const std::string timer_per_hit = " cycles per hit\n";
+
+    // Printed values are formatted straight into a buffer in .bss, which is only written out when the next value
+    // might not fit and when the program exits. The longest value is a sign, 19 digits and the newline
+    static constexpr size_t print_buffer_size = 64 * 1024;
+    static constexpr size_t print_max_length = 21;
+
+    // Worker stacks are mapped without reserving memory for them, so only the pages a worker touches cost anything
+    static constexpr size_t worker_stack_size = 8 * 1024 * 1024;
+    inline static const std::string parallel_failed_message = "parallel: the worker threads could not be started\n";
+
+    // Branches that go the same way this often are predicted well enough to beat cmov
+    static constexpr double biased_share = 0.95;
+
+    inline static const std::vector<std::string> argument_registers = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+    // Registers array expressions are evaluated in, as deep as the parser lets array expressions nest. rcx holds
+    // the offset into the arrays
+    inline static const std::vector<std::string> scalar_registers = { "rax", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11" };
+
+    int m_current_scope;
+    Variables m_variables;
+    size_t m_stack_pointer; // In bytes
+    std::stringstream m_asm_code;
+    const Node::Program m_program_node;
+    std::map<TokenType, int> m_label_map;
+    std::vector<size_t> m_frame_sizes;
+    std::map<const Node::StmtMut*, size_t> m_frame_slots;
+    std::map<const Node::Expression*, Variable> m_hoisted;
+    size_t m_stack_alignment; // Value of m_stack_pointer modulo 16 at which rsp is 16 byte aligned
+    std::map<std::string, const Node::Function*> m_functions;
+    Inliner m_inliner;
+    std::vector<ReturnContext> m_returns;
+    CodeGenOptions m_options;
+    TargetLevel m_level; // Level of the code being generated, which differs between the variants of a region
+    bool m_in_region = false;
+    bool m_uses_cpu_level = false;
+    bool m_uses_print = false;
+    bool m_uses_parallel = false; // Found before any code is generated, functions depend on it
+    bool m_in_function = false; // Generating the body of an out of line function
+    std::optional<Worker> m_worker; // While the scope of a parallel block is generated
+    size_t m_regions = 0;
+    std::vector<const Node::Statement*> m_line_statements; // Statements being generated, innermost last
+    std::stringstream m_cold_code; // Arms a profile says rarely run, placed after everything else
+    std::map<std::string, size_t> m_timers; // Index of every profile region in the timer table by name
+    std::string m_label_namespace; // In every label, so top level regions generated apart never make the same one
+
+    // Programs with more top level statements than this get split into regions, at most max_regions of them.
+    // Neither depends on the number of threads, so neither does the output
+    static constexpr size_t min_region_statements = 256;
+    static constexpr size_t max_regions = 64;
+
+    // A generator for one top level region, picking up where the parent's frame left off. It gets the slots of the
+    // variables its own statements declare, looks up the ones declared before it in the shared top level table,
+    // and names its labels after the region. Whether the program has parallel blocks is known before, and decides
+    // whether prints and timer updates lock, so the region has to agree with its parent on it
+    CodeGenerator(const CodeGenerator &parent, Variables *top_level, size_t region, size_t begin, size_t end)
+                                                                    : m_current_scope(parent.m_current_scope)
+                                                                    , m_stack_pointer(parent.m_stack_pointer)
+                                                                    , m_program_node({ .statements = {}, .functions = parent.m_program_node.functions })
+                                                                    , m_label_map(parent.m_label_map)
+                                                                    , m_frame_sizes(parent.m_frame_sizes)
+                                                                    , m_stack_alignment(parent.m_stack_alignment)
+                                                                    , m_functions(parent.m_functions)
+                                                                    , m_inliner(parent.m_inliner)
+                                                                    , m_options(parent.m_options)
+                                                                    , m_level(parent.m_level)
+                                                                    , m_uses_parallel(parent.m_uses_parallel)
+                                                                    , m_timers(parent.m_timers)
+                                                                    , m_label_namespace("r" + std::to_string(region) + "_") {
+        m_variables.set_outer(top_level);
+        for (size_t index = begin; index < end; index++) {
+            if (auto mut_statement = std::get_if<Node::StmtMut*>(&parent.m_program_node.statements[index]->var)) {
+                m_frame_slots[*mut_statement] = parent.m_frame_slots.at(*mut_statement);
+            }
+        }
+    }
+
+    // Top level statements all start at the same stack depth, right after the program's frame, and every profile
+    // region has its timer before any code is generated, so any run of them can be generated apart from the rest.
+    // Large programs are cut into regions that are generated on a pool of threads and joined in order
+    [[nodiscard]] std::string generate_top_level() {
+        const std::vector<Node::Statement*> &statements = m_program_node.statements;
+        std::stringstream code;
+        if (statements.size() <= min_region_statements) {
+            for (const Node::Statement *statement : statements) {
+                code << generate_statement(statement);
+            }
+            return code.str();
+        }
+
+        Variables top_level;
+        for (const Node::Statement *statement : statements) {
+            if (auto mut_statement = std::get_if<Node::StmtMut*>(&statement->var)) {
+                top_level.add_variable((*mut_statement)->identifier.value.value(), m_frame_slots.at(*mut_statement),
+                                       (*mut_statement)->type.type, m_current_scope, (*mut_statement)->length.value_or(0));
+            }
+        }
+
+        const size_t region_size = std::max(min_region_statements, (statements.size() + max_regions - 1) / max_regions);
+        const size_t regions = (statements.size() + region_size - 1) / region_size;
+        struct Region {
+            std::string code;
+            std::string cold_code;
+            bool uses_cpu_level = false;
+            bool uses_print = false;
+            bool uses_parallel = false;
+        };
+        std::vector<Region> results(regions);
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t region = next++; region < regions; region = next++) {
+                const size_t begin = region * region_size;
+                const size_t end = std::min(begin + region_size, statements.size());
+                CodeGenerator generator(*this, &top_level, region, begin, end);
+                std::stringstream region_code;
+                for (size_t index = begin; index < end; index++) {
+                    region_code << generator.generate_statement(statements[index]);
+                }
+                results[region] = { .code = region_code.str(), .cold_code = generator.m_cold_code.str(),
+                                    .uses_cpu_level = generator.m_uses_cpu_level, .uses_print = generator.m_uses_print,
+                                    .uses_parallel = generator.m_uses_parallel };
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t thread = 1; thread < std::min(m_options.threads, regions); thread++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+
+        for (const Region &region : results) {
+            code << region.code;
+            m_cold_code << region.cold_code;
+            m_uses_cpu_level = m_uses_cpu_level || region.uses_cpu_level;
+            m_uses_print = m_uses_print || region.uses_print;
+            m_uses_parallel = m_uses_parallel || region.uses_parallel;
+        }
+
+        return code.str();
+    }
+
+    // Gives every profile region its slot in the timer table before any code is generated, in the order they
+    // appear in the source, so regions generated apart agree on them
+    void assign_timers() {
+        auto assign = [&](const Node::Statement *statement) {
+            if (auto profile_statement = std::get_if<Node::StmtProfile*>(&statement->var)) {
+                m_timers.emplace((*profile_statement)->name.value.value(), m_timers.size());
+            }
+        };
+        Walk::statements(m_program_node.statements, assign);
+        for (const Node::Function *function : m_program_node.functions) {
+            Walk::statements(function->scope->stmts, assign);
+        }
+    }
+
+    // Attributes the instructions that follow to a line of the source, nothing without -g
+    std::string line_marker(int line_no) const {
+        if (!m_options.line_file.has_value()) {
+            return "";
+        }
+
+        return "%line " + std::to_string(line_no) + "+0 " + m_options.line_file.value() + "\n";
+    }
+
+    // Out of line code continues the line of the statement it was taken out of
+    std::string enclosing_line_marker() const {
+        if (m_line_statements.empty()) {
+            return "";
+        }
+
+        return line_marker(m_line_statements.back()->line_no);
+    }
+
+    // Loops start on a 16 byte boundary, unless -Os would rather not pay the padding
+    std::string align_loop() const {
+        return m_options.optimizations.align_loops ? "\talign 16\n" : "";
+    }
+
+    bool instrumenting() const {
+        return m_options.profile_output.has_value();
+    }
+
+    // Code several threads may run at once: a worker, or any function of a program with parallel blocks, as a
+    // worker may call it
+    bool is_concurrent() const {
+        return m_worker.has_value() || (m_in_function && m_uses_parallel);
+    }
+
+    // Counters every thread adds to are locked in concurrent code, so no count is lost
+    std::string shared_update() const {
+        return is_concurrent() ? "\tlock " : "\t";
+    }
+
+    std::string count_block(const void *block) const {
+        if (!instrumenting()) {
+            return "";
+        }
+
+        return shared_update() + "inc QWORD [rel _profile_counters + " + std::to_string(m_options.profile->counter(block).value() * 8) + "]\n";
+    }
+
+    // The exit status in rdi is kept in rbx while the counters are written, a profile that can't be written is
+    // silently skipped
+    std::string generate_profile_write() const {
+        std::stringstream code;
+        code << "\tmov rbx, rdi\n";
+        code << "\tmov rax, 2\n"; // open
+        code << "\tlea rdi, [rel _profile_file]\n";
+        code << "\tmov rsi, 577\n"; // O_WRONLY | O_CREAT | O_TRUNC
+        code << "\tmov rdx, 420\n"; // 0644
+        code << "\tsyscall\n";
+        code << "\ttest rax, rax\n";
+        code << "\tjs _profile_written\n";
+        code << "\tmov rdi, rax\n";
+        code << "\tmov rax, 1\n"; // write
+        code << "\tlea rsi, [rel _profile_header]\n";
+        code << "\tmov rdx, " << Profile::header_size + m_options.profile->counters() * 8 << "\n";
+        code << "\tsyscall\n";
+        code << "\tmov rax, 3\n"; // close
+        code << "\tsyscall\n";
+        code << "\n_profile_written:\n";
+        code << "\tmov rdi, rbx\n";
+
+        return code.str();
+    }
+
+    // The header is laid out right before the counters so the whole profile goes out in one write
+    std::string generate_profile_data() const {
+        std::stringstream code;
+        code << "\nsection .data\n";
+        code << "_profile_header: db \"" << Profile::magic << "\"\n";
+        code << "\tdq 0x" << std::hex << m_options.source_hash << std::dec << "\n";
+        code << "\tdq " << m_options.profile->counters() << "\n";
+        code << "_profile_counters: times " << m_options.profile->counters() << " dq 0\n";
+        code << "_profile_file: db " << data_bytes(m_options.profile_output.value()) << ", 0\n";
+
+        return code.str();
+    }
+
+    // Operands for db spelling out any string byte by byte, so nothing in it needs quoting
+    static std::string data_bytes(const std::string &bytes) {
+        std::stringstream code;
+        for (size_t index = 0; index < bytes.size(); index++) {
+            code << (index == 0 ? "" : ", ") << static_cast<int>(static_cast<unsigned char>(bytes[index]));
+        }
+
+        return code.str();
+    }
+
+    // Leaves the 64 bit time stamp counter in rax, clobbering rdx and rcx
+    static std::string read_timestamp() {
+        std::stringstream code;
+        code << "\trdtscp\n";
+        code << "\tlfence\n";
+        code << "\tshl rdx, 32\n";
+        code << "\tor rax, rdx\n";
+
+        return code.str();
+    }
+
+    // Builds one line per profile region in a buffer and writes it all to stderr at once. The exit status in rdi
+    // is kept in rbx meanwhile
+    std::string generate_timer_report() const {
+        std::stringstream code;
+        code << "\tmov rbx, rdi\n";
+        for (const auto &[name, index] : m_timers) {
+            std::string cycles = "QWORD [rel _timer_table + " + std::to_string(index * 16) + "]";
+            std::string hits = "QWORD [rel _timer_table + " + std::to_string(index * 16 + 8) + "]";
+            code << "\tlea rsi, [rel _timer_name_" << index << "]\n";
+            code << "\tmov rdx, " << name.size() + timer_separator.size() << "\n";
+            code << "\tcall _timer_append\n";
+            code << "\tmov rax, " << hits << "\n";
+            code << "\tcall _timer_append_number\n";
+            code << "\tlea rsi, [rel _timer_hits]\n";
+            code << "\tmov rdx, " << timer_hits.size() << "\n";
+            code << "\tcall _timer_append\n";
+            code << "\tmov rax, " << cycles << "\n";
+            code << "\tcall _timer_append_number\n";
+            code << "\tlea rsi, [rel _timer_cycles]\n";
+            code << "\tmov rdx, " << timer_cycles.size() << "\n";
+            code << "\tcall _timer_append\n";
+            code << "\txor eax, eax\n";
+            code << "\tmov rcx, " << hits << "\n";
+            code << "\ttest rcx, rcx\n";
+            code << "\tjz _timer_average_" << index << "\n";
+            code << "\tmov rax, " << cycles << "\n";
+            code << "\txor edx, edx\n";
+            code << "\tdiv rcx\n";
+            code << "\n_timer_average_" << index << ":\n";
+            code << "\tcall _timer_append_number\n";
+            code << "\tlea rsi, [rel _timer_per_hit]\n";
+            code << "\tmov rdx, " << timer_per_hit.size() << "\n";
+            code << "\tcall _timer_append\n";
+        }
+        code << "\tmov rax, 1\n"; // write
+        code << "\tmov rdi, 2\n";
+        code << "\tlea rsi, [rel _timer_report]\n";
+        code << "\tmov rdx, [rel _timer_report_length]\n";
+        code << "\tsyscall\n";
+        code << "\tmov rdi, rbx\n";
+        code << "\tjmp _timer_report_written\n";
+
+        // Appends rdx bytes from rsi to the report
+        code << "\n_timer_append:\n";
+        code << "\tlea rdi, [rel _timer_report]\n";
+        code << "\tadd rdi, [rel _timer_report_length]\n";
+        code << "\tadd [rel _timer_report_length], rdx\n";
+        code << "\tmov rcx, rdx\n";
+        code << "\trep movsb\n";
+        code << "\tret\n";
+
+        // Appends rax in decimal to the report
+        code << "\n_timer_append_number:\n";
+        code << "\tlea rsi, [rel _timer_digits + 20]\n";
+        code << "\tmov rcx, 10\n";
+        code << "\n_timer_digit:\n";
+        code << "\txor edx, edx\n";
+        code << "\tdiv rcx\n";
+        code << "\tadd dl, 48\n";
+        code << "\tdec rsi\n";
+        code << "\tmov [rsi], dl\n";
+        code << "\ttest rax, rax\n";
+        code << "\tjnz _timer_digit\n";
+        code << "\tlea rdx, [rel _timer_digits + 20]\n";
+        code << "\tsub rdx, rsi\n";
+        code << "\tjmp _timer_append\n";
+        code << "\n_timer_report_written:\n";
+
+        return code.str();
+    }
+
+    // _print writes rax in decimal and a newline into the print buffer, flushing it first when it might not fit.
+    // It counts the digits against the powers of ten, then writes them from the last one back, two at a time from
+    // a table of every pair, dividing by 100 with a multiply by its reciprocal. _print_flush writes the buffer to
+    // stdout, as many times as write takes to get it all out. Both clobber rax, rcx, rdx, rsi, rdi, r8, r9 and r11
+    std::string generate_print_runtime() const {
+        std::stringstream code;
+        code << "\n_print:\n";
+        code << "\tmov rcx, [rel _print_length]\n";
+        code << "\tcmp rcx, " << print_buffer_size - print_max_length << "\n";
+        code << "\tjbe _print_room\n";
+        code << "\tpush rax\n";
+        code << "\tcall _print_flush\n";
+        code << "\tpop rax\n";
+        code << "\txor ecx, ecx\n";
+        code << "\n_print_room:\n";
+        code << "\tlea rdi, [rel _print_buffer]\n";
+        code << "\tadd rdi, rcx\n";
+        code << "\ttest rax, rax\n";
+        code << "\tjns _print_positive\n";
+        code << "\tmov BYTE [rdi], 45\n"; // '-'
+        code << "\tinc rdi\n";
+        code << "\tneg rax\n"; // The lowest value stays as it is, which is right read as unsigned
+        code << "\n_print_positive:\n";
+        code << "\tlea rsi, [rel _print_powers]\n";
+        code << "\tmov ecx, 1\n";
+        code << "\n_print_count:\n";
+        code << "\tcmp rax, [rsi + rcx * 8 - 8]\n";
+        code << "\tjb _print_counted\n";
+        code << "\tinc ecx\n";
+        code << "\tcmp ecx, 20\n";
+        code << "\tjb _print_count\n";
+        code << "\n_print_counted:\n";
+        code << "\tadd rdi, rcx\n";
+        code << "\tmov BYTE [rdi], 10\n";
+        code << "\tlea rdx, [rdi + 1]\n";
+        code << "\tlea rsi, [rel _print_buffer]\n";
+        code << "\tsub rdx, rsi\n";
+        code << "\tmov [rel _print_length], rdx\n";
+        code << "\tlea rsi, [rel _print_pairs]\n";
+        code << "\tmov r8, 0x28f5c28f5c28f5c3\n"; // x / 100 is the high half of (x >> 2) * this, shifted right by 2
+        code << "\n_print_pair:\n";
+        code << "\tcmp rax, 100\n";
+        code << "\tjb _print_last\n";
+        code << "\tmov rcx, rax\n";
+        code << "\tshr rax, 2\n";
+        code << "\tmul r8\n";
+        code << "\tshr rdx, 2\n";
+        code << "\timul r9, rdx, 100\n";
+        code << "\tsub rcx, r9\n";
+        code << "\tmovzx r9d, WORD [rsi + rcx * 2]\n";
+        code << "\tsub rdi, 2\n";
+        code << "\tmov [rdi], r9w\n";
+        code << "\tmov rax, rdx\n";
+        code << "\tjmp _print_pair\n";
+        code << "\n_print_last:\n";
+        code << "\tcmp rax, 10\n";
+        code << "\tjb _print_digit\n";
+        code << "\tmovzx r9d, WORD [rsi + rax * 2]\n";
+        code << "\tmov [rdi - 2], r9w\n";
+        code << "\tret\n";
+        code << "\n_print_digit:\n";
+        code << "\tadd al, 48\n";
+        code << "\tmov [rdi - 1], al\n";
+        code << "\tret\n";
+
+        code << "\n_print_flush:\n";
+        code << "\tlea rsi, [rel _print_buffer]\n";
+        code << "\tmov rdx, [rel _print_length]\n";
+        code << "\n_print_write:\n";
+        code << "\ttest rdx, rdx\n";
+        code << "\tjz _print_flushed\n";
+        code << "\tmov eax, 1\n"; // write
+        code << "\tmov edi, 1\n";
+        code << "\tsyscall\n";
+        code << "\tcmp rax, -4\n"; // EINTR
+        code << "\tje _print_write\n";
+        code << "\ttest rax, rax\n";
+        code << "\tjle _print_flushed\n"; // Nothing takes the output, so it is dropped
+        code << "\tadd rsi, rax\n";
+        code << "\tsub rdx, rax\n";
+        code << "\tjmp _print_write\n";
+        code << "\n_print_flushed:\n";
+        code << "\tmov QWORD [rel _print_length], 0\n";
+        code << "\tret\n";
+
+        return code.str();
+    }
+
+    // A worker that prints holds a spin lock around _print, no more than one of them formats into the buffer at
+    // a time. Failing to start the workers is reported on stderr and exits with 1
+    std::string generate_parallel_runtime() const {
+        std::stringstream code;
+        if (m_uses_print) {
+            code << "\n_print_locked:\n";
+            code << "\tmov ecx, 1\n";
+            code << "\txchg [rel _print_lock], ecx\n";
+            code << "\ttest ecx, ecx\n";
+            code << "\tjz _print_acquired\n";
+            code << "\tpause\n";
+            code << "\tjmp _print_locked\n";
+            code << "\n_print_acquired:\n";
+            code << "\tcall _print\n";
+            code << "\tmov DWORD [rel _print_lock], 0\n";
+            code << "\tret\n";
+        }
+
+        code << "\n_parallel_failed:\n";
+        code << "\tmov eax, 1\n"; // write
+        code << "\tmov edi, 2\n";
+        code << "\tlea rsi, [rel _parallel_message]\n";
+        code << "\tmov edx, " << parallel_failed_message.size() << "\n";
+        code << "\tsyscall\n";
+        code << "\tmov edi, 1\n";
+        code << "\tjmp _exit\n";
+
+        return code.str();
+    }
+
+    std::string generate_parallel_data() const {
+        std::stringstream code;
+        code << "\nsection .data\n";
+        code << "_parallel_message: db " << data_bytes(parallel_failed_message) << "\n";
+        if (m_uses_print) {
+            code << "\nsection .bss\n";
+            code << "_print_lock: resd 1\n";
+        }
+
+        return code.str();
+    }
+
+    std::string generate_print_data() const {
+        std::stringstream code;
+        std::string pairs;
+        for (int pair = 0; pair < 100; pair++) {
+            pairs += static_cast<char>('0' + pair / 10);
+            pairs += static_cast<char>('0' + pair % 10);
+        }
+        code << "\nsection .data\n";
+        code << "_print_pairs: db " << data_bytes(pairs) << "\n";
+        code << "_print_powers: dq ";
+        uint64_t power = 10;
+        for (int exponent = 1; exponent < 20; exponent++, power *= 10) {
+            code << (exponent == 1 ? "" : ", ") << power;
+        }
+        code << "\n";
+        code << "\nsection .bss\n";
+        code << "_print_length: resq 1\n";
+        code << "_print_buffer: resb " << print_buffer_size << "\n";
+
+        return code.str();
+    }
+
+    // Each line of the report is the name followed by three numbers of at most 20 digits each
+    std::string generate_timer_data() const {
+        std::stringstream code;
+        size_t report_size = 0;
+        code << "\nsection .data\n";
+        code << "_timer_hits: db " << data_bytes(timer_hits) << "\n";
+        code << "_timer_cycles: db " << data_bytes(timer_cycles) << "\n";
+        code << "_timer_per_hit: db " << data_bytes(timer_per_hit) << "\n";
+        for (const auto &[name, index] : m_timers) {
+            code << "_timer_name_" << index << ": db " << data_bytes(name + timer_separator) << "\n";
+            report_size += name.size() + timer_separator.size() + timer_hits.size() + timer_cycles.size()
+                         + timer_per_hit.size() + 3 * 20;
+        }
+        code << "\nsection .bss\n";
+        code << "_timer_table: resq " << m_timers.size() * 2 << "\n"; // Cycles and hits of every region
+        code << "_timer_report_length: resq 1\n";
+        code << "_timer_digits: resb 20\n";
+        code << "_timer_report: resb " << report_size << "\n";
+
+        return code.str();
+    }
+
+    std::string push_stack(const std::string &x64_register) {
+        std::stringstream code;
+        code << "\tpush " << x64_register << "\n";
+        m_stack_pointer += 8;
+
+        return code.str();
+    }
+
+    std::string pop_stack(const std::string &x64_register) {
+        std::stringstream code;
+        code << "\tpop " << x64_register << "\n";
+        m_stack_pointer -= 8;
+
+        return code.str();
+    }
+
+    // Loops and whole array assignments are where the time goes, so they are what gets multi versioned
+    static bool is_hot_region(const Node::Statement *statement) {
+        return std::holds_alternative<Node::StmtWhile*>(statement->var) || std::holds_alternative<Node::StmtFor*>(statement->var)
+               || std::holds_alternative<Node::StmtArray*>(statement->var);
+    }
+
+    std::string generate_variant(const Node::Statement *region, TargetLevel level) {
+        TargetLevel outer_level = std::exchange(m_level, level);
+        std::string code = generate_statement(region);
+        m_level = outer_level;
+
+        return code;
+    }
+
+    bool has_popcnt() const {
+        return m_level >= TargetLevel::x86_64_v2;
+    }
+
+    // BMI1, BMI2 and LZCNT all come with x86-64-v3
+    bool has_bmi() const {
+        return m_level >= TargetLevel::x86_64_v3;
+    }
+
+    bool has_avx2() const {
+        return m_level >= TargetLevel::x86_64_v3;
+    }
+
+    static size_t declaration_size(const Node::StmtMut *declaration) {
+        return type_size(declaration->type.type) * declaration->length.value_or(1);
+    }
+
+    // Lays out the variables declared directly in a scope widest first, so that every slot is naturally aligned
+    // without padding, and reserves the whole frame with a single instruction
+    std::string allocate_frame(const std::vector<Node::Statement*> &statements) {
+        std::stringstream code;
+        std::vector<const Node::StmtMut*> declarations;
+        for (const Node::Statement *statement : statements) {
+            if (auto mut_statement = std::get_if<Node::StmtMut*>(&statement->var)) {
+                declarations.push_back(*mut_statement);
+            }
+        }
+        std::stable_sort(declarations.begin(), declarations.end(), [](const Node::StmtMut *left, const Node::StmtMut *right) {
+            return type_size(left->type.type) > type_size(right->type.type);
+        });
+
+        size_t frame_size = 0;
+        for (const Node::StmtMut *declaration : declarations) {
+            frame_size += declaration_size(declaration);
+        }
+        frame_size = (frame_size + 7) & ~static_cast<size_t>(7); // Keep the stack 64bit aligned for pushes
+
+        size_t offset = 0;
+        for (const Node::StmtMut *declaration : declarations) {
+            m_frame_slots[declaration] = m_stack_pointer + frame_size - offset;
+            offset += declaration_size(declaration);
+        }
+
+        if (frame_size != 0) {
+            code << "\tsub rsp, " << frame_size << "\n";
+        }
+        m_stack_pointer += frame_size;
+        m_frame_sizes.push_back(frame_size);
+
+        return code.str();
+    }
+
+    std::string begin_scope(const std::vector<Node::Statement*> &statements) {
+        m_variables.scope_push({});
+        m_current_scope++;
+
+        return allocate_frame(statements);
+    }
+
+    std::string end_scope() {
+        std::stringstream code;
+        auto scope_top = m_variables.get_top();
+        for(const std::string& identifier : scope_top){
+            m_variables.delete_variable(identifier);
+        }
+
+        size_t frame_size = m_frame_sizes.back();
+        if (frame_size != 0) {
+            code << "\tadd rsp, " << frame_size << "\n";
+        }
+        m_frame_sizes.pop_back();
+        m_variables.scope_pop();
+        m_stack_pointer -= frame_size;
+        m_current_scope--;
+
+        return code.str();
+    }
+
+    static std::string operand_size(TokenType type) {
+        switch (type) {
+            case TokenType::boolean:
+                return "BYTE";
+            case TokenType::int16:
+                return "WORD";
+            case TokenType::int32:
+                return "DWORD";
+            default:
+                return "QWORD";
+        }
+    }
+
+    // A worker runs on a stack of its own, and reaches the variables declared outside its parallel block
+    // through r15, which holds the stack pointer of the thread that started it
+    bool is_shared(const Variable &variable) const {
+        return m_worker.has_value() && variable.stack_location <= m_worker->base;
+    }
+
+    std::string variable_address(const Variable &variable) const {
+        if (is_shared(variable)) {
+            return "r15 + " + std::to_string(m_worker->base - variable.stack_location);
+        }
+
+        return "rsp + " + std::to_string(m_stack_pointer - variable.stack_location);
+    }
+
+    std::string variable_operand(const Variable &variable) const {
+        return operand_size(variable.type) + " [" + variable_address(variable) + "]";
+    }
+
+    // An element of an array, at an index in a register that is scaled by the element size, or at a byte offset
+    // when it is not
+    std::string element_operand(const Variable &variable, const std::string &index_register, bool scaled = true) const {
+        std::stringstream operand;
+        operand << operand_size(variable.type) << " [" << variable_address(variable) << " + " << index_register;
+        if (scaled && type_size(variable.type) != 1) {
+            operand << " * " << type_size(variable.type);
+        }
+        operand << "]";
+
+        return operand.str();
+    }
+
+    // Loads a variable sign or zero extended to 64bit onto the stack
+    std::string push_variable(const Variable &variable) {
+        std::stringstream code;
+        switch (variable.type) {
+            case TokenType::boolean:
+                code << "\tmovzx eax, " << variable_operand(variable) << "\n";
+                code << push_stack("rax");
+                break;
+            case TokenType::int16:
+                code << "\tmovsx rax, " << variable_operand(variable) << "\n";
+                code << push_stack("rax");
+                break;
+            case TokenType::int32:
+                code << "\tmovsxd rax, " << variable_operand(variable) << "\n";
+                code << push_stack("rax");
+                break;
+            default:
+                code << push_stack(variable_operand(variable));
+                break;
+        }
+
+        return code.str();
+    }
+
+    // Stores the top of the stack into a variable truncated to its width, bools are stored as 0 or 1
+    std::string pop_variable(const Variable &variable) {
+        std::stringstream code;
+        switch (variable.type) {
+            case TokenType::boolean:
+                code << pop_stack("rax");
+                code << "\ttest rax, rax\n";
+                code << "\tsetnz " << variable_operand(variable) << "\n";
+                break;
+            case TokenType::int16:
+                code << pop_stack("rax");
+                code << "\tmov " << variable_operand(variable) << ", ax\n";
+                break;
+            case TokenType::int32:
+                code << pop_stack("rax");
+                code << "\tmov " << variable_operand(variable) << ", eax\n";
+                break;
+            default:
+                // pop computes its memory operand after incrementing rsp
+                m_stack_pointer -= 8;
+                code << "\tpop " << variable_operand(variable) << "\n";
+                break;
+        }
+
+        return code.str();
+    }
+
+    // Evaluates a condition and jumps to the label when it is non zero, or zero when jump_if_true is false.
+    // Comparisons jump straight on the flags of their cmp, and logical operators become a chain of jumps
+    std::string generate_branch(const Node::Expression *condition, bool jump_if_true, const std::string &label) {
+        std::stringstream code;
+        condition = strip_parentheses(condition);
+        auto binary_expression = std::get_if<Node::BinExpr*>(&condition->var);
+        if (binary_expression == nullptr || m_hoisted.contains(condition) || !is_boolean(*binary_expression)) {
+            code << generate_expression(condition);
+            code << pop_stack("rax");
+            code << "\ttest rax, rax\n";
+            code << (jump_if_true ? "\tjnz " : "\tjz ") << label << "\n";
+            return code.str();
+        }
+
+        std::visit([&](const auto *operation) {
+            using Operation = std::remove_cvref_t<decltype(*operation)>;
+            if constexpr (std::is_same_v<Operation, Node::LogicAnd>) {
+                if (jump_if_true) {
+                    std::string skip_label = generate_label(TokenType::double_ampersand);
+                    code << generate_branch(operation->left_side, false, skip_label);
+                    code << generate_branch(operation->right_side, true, label);
+                    code << skip_label << ":\n";
+                }
+                else {
+                    code << generate_branch(operation->left_side, false, label);
+                    code << generate_branch(operation->right_side, false, label);
+                }
+            }
+            else if constexpr (std::is_same_v<Operation, Node::LogicOr>) {
+                if (jump_if_true) {
+                    code << generate_branch(operation->left_side, true, label);
+                    code << generate_branch(operation->right_side, true, label);
+                }
+                else {
+                    std::string skip_label = generate_label(TokenType::double_pipe);
+                    code << generate_branch(operation->left_side, true, skip_label);
+                    code << generate_branch(operation->right_side, false, label);
+                    code << skip_label << ":\n";
+                }
+            }
+            else if constexpr (is_boolean_operation<Operation>) {
+                std::string condition_code = comparison_condition<Operation>();
+                code << generate_compare(operation->left_side, operation->right_side);
+                code << "\tj" << (jump_if_true ? condition_code : inverse_condition(condition_code)) << " " << label << "\n";
+            }
+        }, (*binary_expression)->bin_expr);
+
+        return code.str();
+    }
+
+    // Shift counts are taken modulo the width the shift runs at, like the hardware does
+    std::string generate_shift(const Node::Expression *left_side, const Node::Expression *right_side,
+                               const std::string &instruction, int width) {
+        std::stringstream code;
+        std::string value_register = width == 32 ? "eax" : "rax";
+        if (auto count = LoopAnalysis::literal_value(right_side)) {
+            code << generate_expression(left_side);
+            code << pop_stack("rax");
+            code << "\t" << instruction << " " << value_register << ", " << (count.value() & (width == 32 ? 31 : 63)) << "\n";
+        }
+        else if (has_bmi()) {
+            code << generate_operands(left_side, right_side);
+            code << "\t" << instruction << "x " << value_register << ", " << value_register << ", " << (width == 32 ? "ebx" : "rbx") << "\n";
+        }
+        else {
+            code << generate_operands(left_side, right_side);
+            code << "\tmov ecx, ebx\n";
+            code << "\t" << instruction << " " << value_register << ", cl\n";
+        }
+        if (width == 32) {
+            code << "\tmovsxd rax, eax\n";
+        }
+        code << push_stack("rax");
+
+        return code.str();
+    }
+
+    // Builtins work on the whole 64bit value, so they count the sign extension of negative narrow values too
+    std::string generate_builtin(const Node::TermBuiltin *builtin_term) {
+        std::stringstream code;
+        const std::string &name = builtin_term->identifier.value.value();
+        if (name == "worker") {
+            code << push_variable(m_worker.value().index);
+            return code.str();
+        }
+        code << generate_expression(builtin_term->args.front());
+        code << pop_stack("rax");
+        if (name == "popcount" && has_popcnt()) {
+            code << "\tpopcnt rax, rax\n";
+        }
+        else if (name == "popcount") {
+            // Sums the bits in pairs, then nibbles, then bytes, and adds the bytes up with a multiply
+            code << "\tmov rdx, rax\n";
+            code << "\tshr rdx, 1\n";
+            code << "\tmov rcx, 0x5555555555555555\n";
+            code << "\tand rdx, rcx\n";
+            code << "\tsub rax, rdx\n";
+            code << "\tmov rcx, 0x3333333333333333\n";
+            code << "\tmov rdx, rax\n";
+            code << "\tshr rdx, 2\n";
+            code << "\tand rax, rcx\n";
+            code << "\tand rdx, rcx\n";
+            code << "\tadd rax, rdx\n";
+            code << "\tmov rdx, rax\n";
+            code << "\tshr rdx, 4\n";
+            code << "\tadd rax, rdx\n";
+            code << "\tmov rcx, 0x0f0f0f0f0f0f0f0f\n";
+            code << "\tand rax, rcx\n";
+            code << "\tmov rcx, 0x0101010101010101\n";
+            code << "\timul rax, rcx\n";
+            code << "\tshr rax, 56\n";
+        }
+        else if (has_bmi()) {
+            code << "\tlzcnt rax, rax\n";
+        }
+        else {
+            // bsr leaves the destination undefined for zero, which the cmov replaces so that it ends up as 64
+            code << "\tbsr rax, rax\n";
+            code << "\tmov ecx, 127\n";
+            code << "\tcmovz rax, rcx\n";
+            code << "\txor eax, 63\n";
+        }
+        code << push_stack("rax");
+
+        return code.str();
+    }
+
+    // Evaluates a condition that contains no logical operators into the flags, returning the condition code
+    // it is true on along with the code
+    std::pair<std::string, std::string> generate_flags(const Node::Expression *condition) {
+        std::stringstream code;
+        condition = strip_parentheses(condition);
+        auto binary_expression = std::get_if<Node::BinExpr*>(&condition->var);
+        if (binary_expression == nullptr || m_hoisted.contains(condition) || !is_boolean(*binary_expression)) {
+            code << generate_expression(condition);
+            code << pop_stack("rcx");
+            code << "\ttest rcx, rcx\n";
+            return { "nz", code.str() };
+        }
+
+        std::string condition_code;
+        std::visit([&](const auto *operation) {
+            using Operation = std::remove_cvref_t<decltype(*operation)>;
+            if constexpr (is_boolean_operation<Operation>
+                          && !std::is_same_v<Operation, Node::LogicAnd> && !std::is_same_v<Operation, Node::LogicOr>) {
+                condition_code = comparison_condition<Operation>();
+                code << generate_compare(operation->left_side, operation->right_side);
+            }
+        }, (*binary_expression)->bin_expr);
+
+        return { condition_code, code.str() };
+    }
+
+    // Compares two operands, at 32 bits when both are narrow, leaving only the flags behind. A small literal on the
+    // right is compared as an immediate, and zero with test, which sets the flags the same way
+    std::string generate_compare(const Node::Expression *left_side, const Node::Expression *right_side) {
+        std::stringstream code;
+        int width = std::max(expression_width(left_side), expression_width(right_side));
+        std::string value_register = width == 32 ? "eax" : "rax";
+        std::string operands;
+        if (auto value = generate_immediate_operands(left_side, right_side, false, operands)) {
+            code << operands;
+            if (value.value() == 0) {
+                code << "\ttest " << value_register << ", " << value_register << "\n";
+            }
+            else {
+                code << "\tcmp " << value_register << ", " << value.value() << "\n";
+            }
+        }
+        else {
+            code << generate_operands(left_side, right_side);
+            code << (width == 32 ? "\tcmp eax, ebx\n" : "\tcmp rax, rbx\n");
+        }
+
+        return code.str();
+    }
+
+    std::string generate_compare_value(const Node::Expression *left_side, const Node::Expression *right_side, const std::string &condition_code) {
+        std::stringstream code;
+        code << generate_compare(left_side, right_side);
+        code << "\tset" << condition_code << " al\n";
+        code << "\tmovzx eax, al\n";
+        code << push_stack("rax");
+
+        return code.str();
+    }
+
+    template <typename Operation> static constexpr bool is_boolean_operation =
+        std::is_same_v<Operation, Node::CmpEqual> || std::is_same_v<Operation, Node::CmpNotEqual>
+        || std::is_same_v<Operation, Node::CmpLess> || std::is_same_v<Operation, Node::CmpLessEqual>
+        || std::is_same_v<Operation, Node::CmpGreater> || std::is_same_v<Operation, Node::CmpGreaterEqual>
+        || std::is_same_v<Operation, Node::LogicAnd> || std::is_same_v<Operation, Node::LogicOr>;
+
+    static bool is_boolean(const Node::BinExpr *binary_expression) {
+        return std::visit([](const auto *operation) {
+            return is_boolean_operation<std::remove_cvref_t<decltype(*operation)>>;
+        }, binary_expression->bin_expr);
+    }
+
+    // Signed condition code a comparison is true on
+    template <typename Operation> static std::string comparison_condition() {
+        if constexpr (std::is_same_v<Operation, Node::CmpEqual>) {
+            return "e";
+        }
+        else if constexpr (std::is_same_v<Operation, Node::CmpNotEqual>) {
+            return "ne";
+        }
+        else if constexpr (std::is_same_v<Operation, Node::CmpLess>) {
+            return "l";
+        }
+        else if constexpr (std::is_same_v<Operation, Node::CmpLessEqual>) {
+            return "le";
+        }
+        else if constexpr (std::is_same_v<Operation, Node::CmpGreater>) {
+            return "g";
+        }
+        else {
+            return "ge";
+        }
+    }
+
+    static std::string inverse_condition(const std::string &condition_code) {
+        static const std::map<std::string, std::string> inverses = {
+            { "e", "ne" }, { "ne", "e" }, { "l", "ge" }, { "ge", "l" }, { "le", "g" }, { "g", "le" }
+        };
+
+        return inverses.at(condition_code);
+    }
+
+    static const Node::Expression* strip_parentheses(const Node::Expression *expression) {
+        while (auto term = std::get_if<Node::Term*>(&expression->var)) {
+            auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var);
+            if (expression_term == nullptr) {
+                break;
+            }
+            expression = (*expression_term)->expr;
+        }
+
+        return expression;
+    }
+
+    static std::vector<IfArm> if_arms(const Node::StmtIf *if_statement) {
+        std::vector<IfArm> arms = { { .condition = if_statement->expr, .scope = if_statement->scope, .block = if_statement->scope } };
+        std::optional<Node::StmtIfNext*> next = if_statement->next;
+        while (next.has_value()) {
+            if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                arms.push_back({ .condition = (*elif_statement)->expr, .scope = (*elif_statement)->scope, .block = (*elif_statement)->scope });
+                next = (*elif_statement)->next;
+            }
+            else {
+                const Node::Scope *else_scope = std::get<Node::StmtElse*>(next.value()->var)->scope;
+                arms.push_back({ .scope = else_scope, .block = else_scope });
+                return arms;
+            }
+        }
+        arms.push_back({ .block = if_statement });
+
+        return arms;
+    }
+
+    // The arm the profile counted most runs of, nothing without a profile or for a chain that never ran
+    std::optional<size_t> hot_arm(const std::vector<IfArm> &arms) const {
+        if (!m_options.profile.has_value() || !m_options.profile->has_counts()) {
+            return {};
+        }
+
+        uint64_t total = 0;
+        size_t hottest = 0;
+        for (size_t index = 0; index < arms.size(); index++) {
+            uint64_t count = m_options.profile->count(arms[index].block);
+            total += count;
+            if (count > m_options.profile->count(arms[hottest].block)) {
+                hottest = index;
+            }
+        }
+        if (total == 0) {
+            return {};
+        }
+
+        return hottest;
+    }
+
+    bool is_biased(const std::vector<IfArm> &arms) const {
+        std::optional<size_t> hottest = hot_arm(arms);
+        if (!hottest.has_value()) {
+            return false;
+        }
+
+        uint64_t total = 0;
+        for (const IfArm &arm : arms) {
+            total += m_options.profile->count(arm.block);
+        }
+
+        return static_cast<double>(m_options.profile->count(arms[hottest.value()].block)) >= biased_share * static_cast<double>(total);
+    }
+
+    // The return statement a function body ends with, if it ends with one
+    static const Node::StmtReturn* last_return(const Node::Scope *scope) {
+        if (scope->stmts.empty()) {
+            return nullptr;
+        }
+        if (auto return_statement = std::get_if<Node::StmtReturn*>(&scope->stmts.back()->var)) {
+            return *return_statement;
+        }
+
+        return nullptr;
+    }
+
+    static TokenType return_type(const Node::Function *function) {
+        return function->return_type.has_value() ? function->return_type.value().type : TokenType::int64;
+    }
+
+    static std::string function_label(const Node::Function *function) {
+        return "_function_" + function->identifier.value.value();
+    }
+
+    // Return values in rax are extended to 64bit by the callee, like every other value on the stack
+    std::string extend_return() {
+        std::stringstream code;
+        switch (m_returns.back().type) {
+            case TokenType::boolean:
+                code << "\ttest rax, rax\n";
+                code << "\tsetnz al\n";
+                code << "\tmovzx eax, al\n";
+                break;
+            case TokenType::int16:
+                code << "\tmovsx rax, ax\n";
+                break;
+            case TokenType::int32:
+                code << "\tmovsxd rax, eax\n";
+                break;
+            default:
+                break;
+        }
+
+        return code.str();
+    }
+
+    std::string arm_label(const IfArm &arm) {
+        return generate_label(arm.condition.has_value() ? TokenType::elif : TokenType::else_);
+    }
+
+    // When one operand is a literal that fits the sign extended 32 bit immediate of an instruction, evaluates only
+    // the other one, into rax, and gives back the literal. Either side may be the literal when the operation commutes
+    std::optional<int64_t> generate_immediate_operands(const Node::Expression *left_side, const Node::Expression *right_side,
+                                                       bool commutative, std::string &code) {
+        auto immediate = [](const Node::Expression *expression) -> std::optional<int64_t> {
+            auto value = LoopAnalysis::literal_value(expression);
+            if (!value.has_value() || value.value() < INT32_MIN || value.value() > INT32_MAX) {
+                return {};
+            }
+            return value;
+        };
+        std::optional<int64_t> value = immediate(right_side);
+        const Node::Expression *other = left_side;
+        if (!value.has_value() && commutative) {
+            value = immediate(left_side);
+            other = right_side;
+        }
+        if (value.has_value()) {
+            code = generate_expression(other);
+            code += pop_stack("rax");
+        }
+
+        return value;
+    }
+
+    // The shortest way to put a constant in rax: xor for zero, which also breaks any dependency on the old value,
+    // and a 32 bit mov, which zero extends, for anything that fits in 32 bits unsigned
+    static std::string load_immediate(int64_t value) {
+        if (value == 0) {
+            return "\txor eax, eax\n";
+        }
+        if (value > 0 && value <= UINT32_MAX) {
+            return "\tmov eax, " + std::to_string(value) + "\n";
+        }
+
+        return "\tmov rax, " + std::to_string(value) + "\n";
+    }
+
+    std::string generate_operands(const Node::Expression *left_side, const Node::Expression *right_side) {
+        std::stringstream code;
+        code << generate_expression(left_side);
+        code << generate_expression(right_side);
+        code << pop_stack("rbx");
+        code << pop_stack("rax");
+
+        return code.str();
+    }
+
+    // Width in bits an expression is evaluated at: 32 when every typed operand is an int16, int32 or bool,
+    // 64 otherwise. Untyped literals that fit in 32 bits take the width of the operands around them
+    int expression_width(const Node::Expression *expression) {
+        struct WidthVisitor {
+            CodeGenerator &generator;
+
+            int operator() (const Node::Term *term) const {
+                struct TermWidthVisitor {
+                    CodeGenerator &generator;
+
+                    int operator() (const Node::TermInt *int_term) const {
+                        return int_term->int_lit.int_value <= INT32_MAX ? 0 : 64;
+                    }
+
+                    int operator() (const Node::TermBool*) const {
+                        return 32;
+                    }
+
+                    int operator() (const Node::TermIdent *identifier_term) const {
+                        auto iterator = generator.m_variables.get_variable(identifier_term->identifier.value.value(), generator.m_current_scope);
+                        return iterator->second.type == TokenType::int64 ? 64 : 32;
+                    }
+
+                    int operator() (const Node::TermExpr *expression_term) const {
+                        return generator.expression_width(expression_term->expr);
+                    }
+
+                    int operator() (const Node::TermCall *call_term) const {
+                        const Node::Function *function = generator.m_functions.at(call_term->identifier.value.value());
+                        return return_type(function) == TokenType::int64 ? 64 : 32;
+                    }
+
+                    int operator() (const Node::TermBuiltin*) const {
+                        return 32;
+                    }
+
+                    int operator() (const Node::BitNot *bit_not) const {
+                        return generator.expression_width(bit_not->expr);
+                    }
+
+                    int operator() (const Node::TermIndex *index_term) const {
+                        auto iterator = generator.m_variables.get_variable(index_term->identifier.value.value(), generator.m_current_scope);
+                        return iterator->second.type == TokenType::int64 ? 64 : 32;
+                    }
+                };
+                return std::visit(TermWidthVisitor{.generator = generator}, term->var);
+            }
+
+            int operator() (const Node::BinExpr *binary_expression) const {
+                return generator.binary_expression_width(binary_expression);
+            }
+        };
+
+        return std::visit(WidthVisitor{.generator = *this}, expression->var);
+    }
+
+    // Comparisons and logical operators produce a 0 or 1 whatever their operands are, and a shift is as wide as
+    // the value being shifted
+    int binary_expression_width(const Node::BinExpr *binary_expression) {
+        return std::visit([this](const auto *operation) {
+            using Operation = std::remove_cvref_t<decltype(*operation)>;
+            if constexpr (is_boolean_operation<Operation>) {
+                return 32;
+            }
+            else if constexpr (std::is_same_v<Operation, Node::ShiftLeft> || std::is_same_v<Operation, Node::ShiftRight>) {
+                return expression_width(operation->left_side);
+            }
+            else {
+                return std::max(expression_width(operation->left_side), expression_width(operation->right_side));
+            }
+        }, binary_expression->bin_expr);
+    }
+
+    std::string generate_label(TokenType type) {
+        std::string label;
         switch(type) {
             case TokenType::if_:
-                label = "_end_if_label_" + std::to_string(m_label_map[type]);
+                label = "_end_if_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             case TokenType::else_:
-                label = "_else_label_" + std::to_string(m_label_map[type]);
+                label = "_else_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             case TokenType::elif:
-                label = "_elif_label_" + std::to_string(m_label_map[type]);
+                label = "_elif_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             case TokenType::for_:
-                label = "_for_label_" + std::to_string(m_label_map[type]);
+                label = "_for_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             case TokenType::while_:
-                label = "_while_label_" + std::to_string(m_label_map[type]);
+                label = "_while_label_" + m_label_namespace + std::to_string(m_label_map[type]);
+                break;
+            case TokenType::double_ampersand:
+                label = "_and_label_" + m_label_namespace + std::to_string(m_label_map[type]);
+                break;
+            case TokenType::double_pipe:
+                label = "_or_label_" + m_label_namespace + std::to_string(m_label_map[type]);
+                break;
+            case TokenType::return_:
+                label = "_inline_return_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             case TokenType::exit:
-                label = "_exit_" + std::to_string(m_label_map[type]);
+                label = "_exit_" + m_label_namespace + std::to_string(m_label_map[type]);
+                break;
+            case TokenType::open_square_bracket:
+                label = "_array_label_" + m_label_namespace + std::to_string(m_label_map[type]);
+                break;
+            case TokenType::parallel:
+                label = "_parallel_label_" + m_label_namespace + std::to_string(m_label_map[type]);
                 break;
             default:
-                std::cerr << "cer: error: invalid label" << std::endl;
-                exit(EXIT_FAILURE);
+                // A bug in the generator, not in the program being compiled
+                throw std::logic_error("invalid label");
         }
         m_label_map[type] += 1;
 
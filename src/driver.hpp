@@ -0,0 +1,420 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <optional>
+#include <filesystem>
+
+#include "cerium.hpp"
+#include "target.hpp"
+#include "timereport.hpp"
+#include "buildcache.hpp"
+
+
+inline int IsValidFile(std::string filename) {
+    std::filesystem::path filepath = std::move(filename);
+    std::string extension = filepath.extension();
+    filename = std::move(filepath);
+    if (extension == ".crm" || extension == ".crmast"){
+        return 1;
+    }
+    return 0;
+}
+
+const std::string default_profile = "cerium.profile";
+
+// The flags of a cer command, which apply to every file it builds
+struct BuildSettings {
+    bool debug = false; // Keeps the assembly and object files
+    bool line_info = false;
+    bool time_report = false;
+    std::optional<std::string> emit{}; // Phase to stop after, printing what it produced
+    Target target{};
+    std::optional<std::string> profile_output{};
+    std::optional<std::string> profile_input{};
+    size_t codegen_threads = 1; // Not part of the cache key, the output is the same for any number
+    size_t error_limit = 20;
+    DiagnosticFormat diagnostic_format = DiagnosticFormat::text;
+    OptLevel optimization = OptLevel::O2;
+    bool print_passes = false;
+};
+
+// What the executable depends on besides the compiler: the source and every option that changes the output, with
+// the paths -g and -fprofile-generate write into the program made absolute. A profile that can't be read gives
+// nothing, so the build runs and warns about it
+inline std::optional<std::vector<std::string>> cache_inputs(const std::string &contents, const std::filesystem::path &directory,
+                                                            const std::string &source_file, const BuildSettings &settings) {
+    std::vector<std::string> inputs = {
+        contents,
+        std::to_string(static_cast<int>(settings.target.level)) + (settings.target.multi ? " multi" : ""),
+        std::to_string(static_cast<int>(settings.optimization)),
+        settings.line_info ? std::filesystem::absolute(directory / source_file).string() : "",
+        settings.profile_output.has_value() ? std::filesystem::absolute(directory / settings.profile_output.value()).string() : "",
+    };
+    if (settings.profile_input.has_value()) {
+        std::ifstream profile(directory / settings.profile_input.value(), std::ios::binary);
+        if (!profile.is_open()) {
+            return {};
+        }
+        std::stringstream bytes;
+        bytes << profile.rdbuf();
+        inputs.push_back(bytes.str());
+    }
+
+    return inputs;
+}
+
+// The passes a compile ran and their times, for --print-passes
+inline void print_passes(const std::vector<PassTiming> &passes, std::ostream &err) {
+    std::stringstream table;
+    table << "cer: passes\n";
+    table << std::left << std::setw(20) << "  pass" << std::setw(12) << "kind" << std::right << std::setw(10) << "ms" << "\n";
+    for (const PassTiming &pass : passes) {
+        table << "  " << std::left << std::setw(18) << pass.name << std::setw(12) << pass.kind << std::right << std::setw(10);
+        if (pass.milliseconds.has_value()) {
+            table << std::fixed << std::setprecision(3) << pass.milliseconds.value();
+        }
+        else {
+            table << "-";
+        }
+        if (!pass.note.empty()) {
+            table << "  " << pass.note;
+        }
+        table << "\n";
+    }
+    err << table.str() << std::flush;
+}
+
+// Builds one source file into an executable, or prints the phase --emit asks for. The assembly and object files go
+// next to the intermediate path given, with .asm and .o added
+inline int build(const BuildSettings &settings, const std::string &source_file, const std::string &output_file,
+                 const std::filesystem::path &intermediate, const std::filesystem::path &directory, std::ostream &out,
+                 std::ostream &err) {
+    // Everything a build reports about the file goes out in one write, in the format asked for
+    auto report_error = [&](const std::string &message) {
+        err << Diagnostics::format({ { .message = message + " '" + source_file + "'" } }, settings.diagnostic_format) << std::flush;
+    };
+    if (!IsValidFile(source_file)){
+        report_error("invalid file type");
+        return 2;
+    }
+
+    // Builds that stop early or keep their intermediate files always run in full
+    std::optional<BuildCache> cache;
+    std::string cache_key;
+    if (!settings.debug && !settings.emit.has_value()) {
+        cache = BuildCache::from_environment();
+    }
+
+    // A binary AST written by --emit=ast-bin is mapped by the compiler itself, and only read here to key the cache
+    const bool ast_input = std::filesystem::path(source_file).extension() == ".crmast";
+    std::string contents;
+    if (!ast_input || cache.has_value()) {
+        std::stringstream contents_stream;
+        std::fstream input(directory / source_file, std::ios::in | std::ios::binary);
+        if (!input.is_open()) {
+            report_error("failed to open the file");
+            return 3;
+        }
+        contents_stream << input.rdbuf();
+        input.close();
+        contents = contents_stream.str();
+    }
+
+    TimeReport report;
+    auto finish = [&](int status) {
+        if (settings.time_report) {
+            report.print(err);
+        }
+        return status;
+    };
+
+    if (cache.has_value()) {
+        if (auto inputs = cache_inputs(contents, directory, source_file, settings)) {
+            cache_key = BuildCache::key(inputs.value());
+            if (cache->fetch(cache_key, directory / output_file)) {
+                return finish(0);
+            }
+        }
+        else {
+            cache.reset();
+        }
+    }
+
+    CompileOptions options{ .filename = source_file, .directory = directory, .target = settings.target, .line_info = settings.line_info,
+                            .profile_output = settings.profile_output, .profile_input = settings.profile_input,
+                            .error_limit = settings.error_limit, .codegen_threads = settings.codegen_threads,
+                            .optimization = settings.optimization, .report = &report };
+    if (settings.emit == "tokens") {
+        options.emit = Emit::tokens;
+    }
+    else if (settings.emit == "ast") {
+        options.emit = Emit::ast;
+    }
+    else if (settings.emit == "ast-bin") {
+        options.emit = Emit::ast_binary;
+    }
+    CompileResult result = ast_input ? compile_ast(source_file, options) : compile(contents, options);
+    if (!result.diagnostics.empty()) {
+        err << Diagnostics::format(result.diagnostics, settings.diagnostic_format) << std::flush;
+    }
+    if (settings.print_passes && !result.passes.empty()) {
+        print_passes(result.passes, err);
+    }
+    if (!result.success) {
+        return finish(1);
+    }
+    if (settings.emit.has_value()) {
+        out << result.output;
+        return finish(0);
+    }
+    std::string assembly = std::move(result.output);
+
+    const std::string assembly_file = intermediate.string() + ".asm";
+    const std::string object_file = intermediate.string() + ".o";
+    std::fstream file(assembly_file, std::ios::out);
+    file << assembly;
+    file.close();
+
+    report.start("assemble");
+    const std::string assembler_command = std::string(settings.line_info ? "nasm -felf64 -g -F dwarf" : "nasm -felf64")
+                                        + " -o " + object_file + " " + assembly_file;
+    const bool assembled = system(assembler_command.c_str()) == 0;
+    report.stop();
+
+    report.start("link");
+    const std::string linker_command = "ld -o " + (directory / output_file).string() + " " + object_file;
+    const bool linked = assembled && system(linker_command.c_str()) == 0;
+    report.stop();
+
+    if (cache.has_value() && linked) {
+        cache->store(cache_key, directory / output_file);
+    }
+
+    if (!settings.debug) {
+        std::filesystem::remove(object_file);
+        std::filesystem::remove(assembly_file);
+    }
+
+    if (!linked) {
+        err << "cer: error: " << (assembled ? "linking" : "assembling") << " '" << source_file << "' failed" << std::endl;
+        return finish(1);
+    }
+
+    return finish(0);
+}
+
+// Builds every file on a pool of worker threads, each executable named after its source and put in the output
+// directory. What each build prints is held back and printed in the order the files were given, so the output
+// reads the same whatever order the builds finish in
+inline int build_batch(const BuildSettings &settings, const std::vector<std::string> &source_files,
+                       const std::string &output_directory, size_t jobs, const std::filesystem::path &directory,
+                       std::ostream &out, std::ostream &err) {
+    std::set<std::string> names;
+    for (const std::string &source_file : source_files) {
+        if (!names.insert(std::filesystem::path(source_file).stem().string()).second) {
+            err << "cer: error: more than one input is named '" << std::filesystem::path(source_file).stem().string()
+                << "', their executables would overwrite each other" << std::endl;
+            return 1;
+        }
+    }
+    std::error_code error;
+    std::filesystem::create_directories(directory / output_directory, error);
+    if (error) {
+        err << "cer: error: can't create the output directory '" << output_directory << "'" << std::endl;
+        return 1;
+    }
+
+    struct Job {
+        std::stringstream out;
+        std::stringstream err;
+        int exit_code = 0;
+        bool done = false;
+    };
+    std::vector<Job> results(source_files.size());
+    std::atomic<size_t> next = 0;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto worker = [&]() {
+        for (size_t index = next++; index < source_files.size(); index = next++) {
+            const std::filesystem::path output = std::filesystem::path(output_directory) / std::filesystem::path(source_files[index]).stem();
+            Job &job = results[index];
+            int exit_code = build(settings, source_files[index], output.string(), directory / output, directory, job.out, job.err);
+            std::lock_guard<std::mutex> lock(mutex);
+            job.exit_code = exit_code;
+            job.done = true;
+            finished.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t worker_index = 0; worker_index < std::min(jobs, source_files.size()); worker_index++) {
+        workers.emplace_back(worker);
+    }
+
+    int exit_code = 0;
+    for (Job &job : results) {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return job.done; });
+        lock.unlock();
+        out << job.out.str() << std::flush;
+        err << job.err.str() << std::flush;
+        if (exit_code == 0) {
+            exit_code = job.exit_code;
+        }
+    }
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+
+    return exit_code;
+}
+
+
+// Everything one cer command does, from its arguments to its exit code. Relative paths are taken from the
+// directory given rather than the process's own, so a server can run commands for clients in other directories
+inline int drive(int argc, const char *const *argv, const std::filesystem::path &directory, std::ostream &out, std::ostream &err) {
+    if (argc < 2) {
+        err << "cer: error: no input files" << std::endl;
+        return 1;
+    }
+
+    int arg = 1;
+    BuildSettings settings;
+    std::vector<std::string> source_files;
+    std::optional<std::string> output;
+    std::optional<size_t> jobs;
+
+    while (arg < argc) {
+        if (strcmp(argv[arg], "-d") == 0) {
+            settings.debug = true;
+        }
+        else if (strcmp(argv[arg], "-g") == 0) {
+            settings.line_info = true;
+        }
+        else if (strcmp(argv[arg], "-ftime-report") == 0) {
+            settings.time_report = true;
+        }
+        else if (strcmp(argv[arg], "--print-passes") == 0) {
+            settings.print_passes = true;
+        }
+        else if (strncmp(argv[arg], "-O", 2) == 0) {
+            const std::string level = argv[arg] + 2;
+            if (level == "0") {
+                settings.optimization = OptLevel::O0;
+            }
+            else if (level == "1") {
+                settings.optimization = OptLevel::O1;
+            }
+            else if (level == "2") {
+                settings.optimization = OptLevel::O2;
+            }
+            else if (level == "s") {
+                settings.optimization = OptLevel::Os;
+            }
+            else {
+                err << "cer: error: unknown optimization level '" << argv[arg] << "', expected -O0, -O1, -O2 or -Os" << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[arg], "--emit=", 7) == 0) {
+            settings.emit = argv[arg] + 7;
+            if (settings.emit != "tokens" && settings.emit != "ast" && settings.emit != "ast-bin" && settings.emit != "asm") {
+                err << "cer: error: unknown value '" << settings.emit.value() << "' for --emit, expected tokens, ast, ast-bin or asm"
+                    << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[arg], "-march=", 7) == 0) {
+            if (auto march = Target::from_march(argv[arg] + 7)) {
+                settings.target = march.value();
+            }
+            else {
+                err << "cer: error: unknown target '" << argv[arg] + 7 << "' for -march, expected x86-64, x86-64-v2, "
+                    << "x86-64-v3, x86-64-v4, native or multi" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-fprofile-generate") == 0) {
+            settings.profile_output = default_profile;
+        }
+        else if (strncmp(argv[arg], "-fprofile-generate=", 19) == 0) {
+            settings.profile_output = argv[arg] + 19;
+        }
+        else if (strcmp(argv[arg], "-fprofile-use") == 0) {
+            settings.profile_input = default_profile;
+        }
+        else if (strncmp(argv[arg], "-fprofile-use=", 14) == 0) {
+            settings.profile_input = argv[arg] + 14;
+        }
+        else if (strncmp(argv[arg], "-ferror-limit=", 14) == 0) {
+            char *end = nullptr;
+            settings.error_limit = std::strtoul(argv[arg] + 14, &end, 10);
+            if (argv[arg][14] == '\0' || *end != '\0') {
+                err << "cer: error: expected a number of errors after -ferror-limit=, 0 for no limit" << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[arg], "-fdiagnostics-format=", 21) == 0) {
+            if (strcmp(argv[arg] + 21, "json") == 0) {
+                settings.diagnostic_format = DiagnosticFormat::json;
+            }
+            else if (strcmp(argv[arg] + 21, "text") == 0) {
+                settings.diagnostic_format = DiagnosticFormat::text;
+            }
+            else {
+                err << "cer: error: unknown value '" << argv[arg] + 21 << "' for -fdiagnostics-format, expected text or json" << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[arg], "-fcodegen-threads=", 18) == 0) {
+            char *end = nullptr;
+            settings.codegen_threads = std::strtoul(argv[arg] + 18, &end, 10);
+            if (argv[arg][18] == '\0' || *end != '\0' || settings.codegen_threads == 0) {
+                err << "cer: error: expected a number of threads after -fcodegen-threads=" << std::endl;
+                return 1;
+            }
+        }
+        else if (strncmp(argv[arg], "-j", 2) == 0) {
+            const char *count = argv[arg][2] != '\0' ? argv[arg] + 2 : arg + 1 < argc ? argv[++arg] : "";
+            char *end = nullptr;
+            jobs = std::strtoul(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || jobs == 0u) {
+                err << "cer: error: expected a number of jobs after -j" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-o") == 0) {
+            if (arg + 1 >= argc) {
+                err << "cer: error: expected an output after -o" << std::endl;
+                return 1;
+            }
+            output = argv[++arg];
+        }
+        else {
+            source_files.emplace_back(argv[arg]);
+        }
+        arg++;
+    }
+
+    if (source_files.empty()) {
+        err << "cer: error: no input files" << std::endl;
+        return 1;
+    }
+    if (source_files.size() == 1 && !jobs.has_value()) {
+        return build(settings, source_files[0], output.value_or("out"), directory / "out", directory, out, err);
+    }
+
+    return build_batch(settings, source_files, output.value_or("."), jobs.value_or(1), directory, out, err);
+}
@@ -1,44 +1,185 @@
 #pragma once
 
+#include <string>
+#include <vector>
 #include <utility>
+#include <cstdio>
 
 #include "token.hpp"
 
-bool error_flag = false;
-
-
-inline void error_identifier(const std::string &filename, std::string message, Token identifier) {
-    error_flag = true;
-    int line = identifier.line_no;
-    int col = identifier.column_no;
-    std::string name = get_token(std::move(identifier));
-    std::cerr << "cer: error: " << message << std::endl;
-    std::cerr << filename << "::" << line << ":" << col << ": identifier '" << name << "'" << std::endl;
-    std::cerr << std::endl;
-}
-
-inline void error_token(const std::string &filename, std::string message, Token token, std::string token_name) {
-    error_flag = true;
-    int line = token.line_no;
-    int col = token.column_no;
-    std::cerr << "cer: error: " << message << std::endl;
-    std::cerr << filename << "::" << line << ":" << col << ": token '" << token_name << "'" << std::endl;
-    std::cerr << std::endl;
-}
-
-inline void error_expected(const std::string &filename, const std::string &message, Token &token) {
-    error_flag = true;
-    int line = token.line_no;
-    int col = token.column_no;
-    std::string token_name = get_token(std::move(token));
-    std::cerr << "cer: error: " << message << std::endl;
-    std::cerr << filename << "::" << line << ":" << col << ": before token '" << token_name << "'" << std::endl;
-    std::cerr << std::endl;
-}
-
-inline void error_expected(const std::string &filename, const std::string &message, const std::string token, int line, int col) {
-    error_flag = true;
-    std::cerr << "cer: error: " << message << std::endl;
-    std::cerr << filename << "::" << line << ":" << col << ": " << token << "" << std::endl;
-    std::cerr << std::endl;
-}
\ No newline at end of file
+
+struct Diagnostic {
+    enum class Severity { error, warning, note };
+
+    Severity severity = Severity::error;
+    std::string message{};
+    std::string filename{}; // Empty when it isn't about a place in the source
+    int line = 0;
+    int column = 0;
+    std::string context{}; // What is at that place, like "identifier 'x'"
+};
+
+// How diagnostics are printed, text for people or one JSON object per line for tools
+enum class DiagnosticFormat { text, json };
+
+// Everything a compile found wrong, in the order it was found. Each tokenizer and parser has its own, so compiles
+// running side by side don't see each other's errors. Past the error limit errors are dropped, and the phase that
+// reports them stops, so a broken input costs no more than its first few errors
+class Diagnostics {
+    public:
+        explicit Diagnostics(size_t error_limit = 0) : m_error_limit(error_limit) {}
+
+        void error_identifier(const std::string &filename, std::string message, Token identifier) {
+            int line = identifier.line_no;
+            int col = identifier.column_no;
+            std::string name = get_token(std::move(identifier));
+            error(filename, std::move(message), line, col, "identifier '" + name + "'");
+        }
+
+        void error_token(const std::string &filename, std::string message, Token token, std::string token_name) {
+            error(filename, std::move(message), token.line_no, token.column_no, "token '" + token_name + "'");
+        }
+
+        void error_expected(const std::string &filename, const std::string &message, Token &token) {
+            int line = token.line_no;
+            int col = token.column_no;
+            std::string token_name = get_token(std::move(token));
+            error(filename, message, line, col, "before token '" + token_name + "'");
+        }
+
+        void error_expected(const std::string &filename, const std::string &message, const std::string token, int line, int col) {
+            error(filename, message, line, col, token);
+        }
+
+        void error(const std::string &filename, std::string message, int line, int col, std::string context) {
+            add({ .severity = Diagnostic::Severity::error, .message = std::move(message), .filename = filename,
+                  .line = line, .column = col, .context = std::move(context) });
+        }
+
+        void warning(std::string message) {
+            m_diagnostics.push_back({ .severity = Diagnostic::Severity::warning, .message = std::move(message), .filename = "",
+                                      .line = 0, .column = 0, .context = "" });
+        }
+
+        void append(const Diagnostics &other) {
+            for (const Diagnostic &diagnostic : other.m_diagnostics) {
+                add(diagnostic);
+            }
+            m_truncated = m_truncated || other.m_truncated;
+        }
+
+        [[nodiscard]] bool has_errors() const {
+            return m_errors > 0;
+        }
+
+        // An error was dropped for going over the limit, and whoever is reporting them can stop looking
+        [[nodiscard]] bool truncated() const {
+            return m_truncated;
+        }
+
+        // Ends with a note when errors were dropped
+        [[nodiscard]] std::vector<Diagnostic> all() const {
+            std::vector<Diagnostic> diagnostics = m_diagnostics;
+            if (m_truncated) {
+                diagnostics.push_back({ .severity = Diagnostic::Severity::note, .message = "too many errors, stopped after "
+                                        + std::to_string(m_error_limit) + ", raise -ferror-limit to see more",
+                                        .filename = "", .line = 0, .column = 0, .context = "" });
+            }
+
+            return diagnostics;
+        }
+
+        // All of them in one string, so they go out in a single write
+        [[nodiscard]] static std::string format(const std::vector<Diagnostic> &diagnostics, DiagnosticFormat format = DiagnosticFormat::text) {
+            std::string text;
+            for (const Diagnostic &diagnostic : diagnostics) {
+                if (format == DiagnosticFormat::json) {
+                    json(text, diagnostic);
+                }
+                else {
+                    plain(text, diagnostic);
+                }
+            }
+
+            return text;
+        }
+
+    private:
+        std::vector<Diagnostic> m_diagnostics;
+        size_t m_error_limit; // 0 for no limit
+        size_t m_errors = 0;
+        bool m_truncated = false;
+
+        void add(Diagnostic diagnostic) {
+            if (diagnostic.severity == Diagnostic::Severity::error) {
+                if (m_error_limit != 0 && m_errors >= m_error_limit) {
+                    m_truncated = true;
+                    return;
+                }
+                m_errors++;
+            }
+            m_diagnostics.push_back(std::move(diagnostic));
+        }
+
+        static const char* severity(const Diagnostic &diagnostic) {
+            switch (diagnostic.severity) {
+                case Diagnostic::Severity::error:
+                    return "error";
+                case Diagnostic::Severity::warning:
+                    return "warning";
+                default:
+                    return "note";
+            }
+        }
+
+        static void plain(std::string &text, const Diagnostic &diagnostic) {
+            text += std::string("cer: ") + severity(diagnostic) + ": " + diagnostic.message + "\n";
+            if (!diagnostic.filename.empty()) {
+                text += diagnostic.filename + "::" + std::to_string(diagnostic.line) + ":" + std::to_string(diagnostic.column)
+                      + ": " + diagnostic.context + "\n\n";
+            }
+        }
+
+        static void json(std::string &text, const Diagnostic &diagnostic) {
+            text += std::string("{\"severity\":\"") + severity(diagnostic) + "\",\"message\":";
+            quote(text, diagnostic.message);
+            if (!diagnostic.filename.empty()) {
+                text += ",\"file\":";
+                quote(text, diagnostic.filename);
+                text += ",\"line\":" + std::to_string(diagnostic.line) + ",\"column\":" + std::to_string(diagnostic.column)
+                      + ",\"context\":";
+                quote(text, diagnostic.context);
+            }
+            text += "}\n";
+        }
+
+        static void quote(std::string &text, const std::string &value) {
+            text += '"';
+            for (char character : value) {
+                switch (character) {
+                    case '"':
+                        text += "\\\"";
+                        break;
+                    case '\\':
+                        text += "\\\\";
+                        break;
+                    case '\n':
+                        text += "\\n";
+                        break;
+                    case '\t':
+                        text += "\\t";
+                        break;
+                    default:
+                        if (static_cast<unsigned char>(character) < 0x20) {
+                            char escaped[7];
+                            std::snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+                            text += escaped;
+                        }
+                        else {
+                            text += character;
+                        }
+                }
+            }
+            text += '"';
+        }
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <variant>
+#include <optional>
+
+#include "parser.hpp"
+#include "astwalk.hpp"
+
+
+struct SelectArm {
+    const Node::Expression *condition;
+    const Node::Expression *value;
+};
+
+// An if/elif/else chain where every arm only assigns one and the same variable, which can be computed without
+// branches as a chain of conditional moves
+struct Select {
+    Token target;
+    std::vector<SelectArm> arms{};
+    std::optional<const Node::Expression*> otherwise{}; // Without an else the variable keeps its value
+};
+
+// Recognises assignment diamonds worth turning into cmov. Every value and every condition after the first one
+// gets evaluated whether its arm is taken or not, so they must not have side effects or be able to fault, and
+// how much of that speculative work is allowed is capped
+class IfConversion {
+    public:
+        [[nodiscard]] static std::optional<Select> match(const Node::StmtIf *if_statement) {
+            auto assignment = single_assignment(if_statement->scope, {});
+            if (!assignment.has_value() || !is_flag_condition(if_statement->expr)) {
+                return {};
+            }
+
+            Select select{ .target = assignment.value()->identifier };
+            const std::string &target = select.target.value.value();
+            select.arms.push_back({ .condition = if_statement->expr, .value = assignment.value()->expr });
+            size_t speculated_nodes = count_nodes(assignment.value()->expr);
+
+            std::optional<Node::StmtIfNext*> next = if_statement->next;
+            while (next.has_value()) {
+                if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                    auto elif_assignment = single_assignment((*elif_statement)->scope, target);
+                    if (!elif_assignment.has_value() || !is_flag_condition((*elif_statement)->expr)
+                        || !is_speculatable((*elif_statement)->expr)) {
+                        return {};
+                    }
+                    select.arms.push_back({ .condition = (*elif_statement)->expr, .value = elif_assignment.value()->expr });
+                    speculated_nodes += count_nodes((*elif_statement)->expr) + count_nodes(elif_assignment.value()->expr);
+                    next = (*elif_statement)->next;
+                }
+                else {
+                    auto else_assignment = single_assignment(std::get<Node::StmtElse*>(next.value()->var)->scope, target);
+                    if (!else_assignment.has_value()) {
+                        return {};
+                    }
+                    select.otherwise = else_assignment.value()->expr;
+                    speculated_nodes += count_nodes(else_assignment.value()->expr);
+                    next = {};
+                }
+            }
+
+            for (const SelectArm &arm : select.arms) {
+                if (!is_speculatable(arm.value)) {
+                    return {};
+                }
+            }
+            if (select.otherwise.has_value() && !is_speculatable(select.otherwise.value())) {
+                return {};
+            }
+            if (speculated_nodes > max_speculated_nodes) {
+                return {};
+            }
+
+            return select;
+        }
+
+    private:
+        // Roughly a dozen stack machine instructions worth of work per arm that may be thrown away
+        static constexpr size_t max_speculated_nodes = 16;
+
+        // The one assignment an arm consists of. An arm's scope holds no declarations, so the same name in every
+        // arm is the same variable
+        static std::optional<const Node::StmtIdent*> single_assignment(const Node::Scope *scope,
+                                                                       std::optional<std::string> target) {
+            if (scope->stmts.size() != 1) {
+                return {};
+            }
+            auto identifier_statement = std::get_if<Node::StmtIdent*>(&scope->stmts.front()->var);
+            if (identifier_statement == nullptr) {
+                return {};
+            }
+            if (target.has_value() && (*identifier_statement)->identifier.value.value() != target.value()) {
+                return {};
+            }
+
+            return *identifier_statement;
+        }
+
+        // Logical operators are lowered to branches, so a condition built from them defeats the purpose
+        static bool is_flag_condition(const Node::Expression *condition) {
+            bool branches = false;
+            Walk::subexpressions(condition, [&](const Node::Expression *expression) {
+                if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression->var)) {
+                    branches = branches || std::holds_alternative<Node::LogicAnd*>((*binary_expression)->bin_expr)
+                                        || std::holds_alternative<Node::LogicOr*>((*binary_expression)->bin_expr);
+                }
+            });
+
+            return !branches;
+        }
+
+        static bool is_speculatable(const Node::Expression *expression) {
+            bool calls = false;
+            Walk::subexpressions(expression, [&](const Node::Expression *subexpression) {
+                calls = calls || Walk::as_call(subexpression) != nullptr;
+            });
+
+            return !calls && !Walk::can_trap(expression) && is_flag_condition(expression);
+        }
+
+        static size_t count_nodes(const Node::Expression *expression) {
+            size_t nodes = 0;
+            Walk::subexpressions(expression, [&](const Node::Expression*) {
+                nodes++;
+            });
+
+            return nodes;
+        }
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "parser.hpp"
+#include "astwalk.hpp"
+
+
+// How eagerly functions are inlined: not at all, only when it makes the program smaller, or whenever the growth
+// fits the budget
+enum class InlinePolicy {
+    never,
+    size,
+    speed,
+};
+
+// Decides which functions are expanded at their call sites instead of being called. A function is inlined when
+// it is not recursive and copying its body into every caller grows the program by less than a fixed budget,
+// measured in AST nodes against what the calls themselves would have cost. Functions with a parallel block are
+// always called, so that one never ends up inside another, and so are functions with arrays, which would add to
+// the stack their callers' arrays are budgeted in
+class Inliner {
+    public:
+        // Calls and sizes are counted by the traversal hooks() is given to, which other analyses can share
+        inline explicit Inliner(const Node::Program &program, InlinePolicy policy = InlinePolicy::speed) : m_policy(policy) {
+            for (const Node::Function *function : program.functions) {
+                m_functions[function->identifier.value.value()] = function;
+            }
+        }
+
+        // An inliner that walks the program by itself
+        static Inliner analyze(const Node::Program &program, InlinePolicy policy = InlinePolicy::speed) {
+            Inliner inliner(program, policy);
+            Walk::program(program, { inliner.hooks() });
+
+            return inliner;
+        }
+
+        // Only good for one traversal, the hooks hold on to the inliner
+        [[nodiscard]] Walk::Hooks hooks() {
+            return {
+                .function = [this](const Node::Function *function) {
+                    m_caller = function;
+                    if (function != nullptr) {
+                        m_sizes[function] = 0;
+                    }
+                },
+                .statement = [this](const Node::Statement *statement) {
+                    if (m_caller != nullptr) {
+                        m_sizes[m_caller]++;
+                    }
+                    if (auto call_statement = std::get_if<Node::StmtCall*>(&statement->var)) {
+                        count_call((*call_statement)->call, m_caller);
+                    }
+                    if (std::holds_alternative<Node::StmtParallel*>(statement->var) && m_caller != nullptr) {
+                        m_parallel.insert(m_caller);
+                    }
+                    auto mut_statement = std::get_if<Node::StmtMut*>(&statement->var);
+                    if (mut_statement != nullptr && (*mut_statement)->length.has_value() && m_caller != nullptr) {
+                        m_arrays.insert(m_caller);
+                    }
+                },
+                .expression = [this](const Node::Expression *expression) {
+                    if (m_caller != nullptr) {
+                        m_sizes[m_caller]++;
+                    }
+                    if (const Node::TermCall *call_term = Walk::as_call(expression)) {
+                        count_call(call_term, m_caller);
+                    }
+                },
+            };
+        }
+
+        [[nodiscard]] bool should_inline(const Node::Function *function) const {
+            if (m_policy == InlinePolicy::never || is_recursive(function) || size(function) > max_inline_size
+                || m_parallel.contains(function) || m_arrays.contains(function)) {
+                return false;
+            }
+
+            // Every call site gets a copy of the body but no longer pays for argument registers, call and return
+            long copies = static_cast<long>(call_count(function));
+            long growth = (copies - 1) * static_cast<long>(size(function)) - copies * call_cost;
+
+            return growth <= (m_policy == InlinePolicy::size ? 0 : growth_budget);
+        }
+
+        // Whether the function needs a body of its own, it doesn't when it is never called or always inlined
+        [[nodiscard]] bool is_emitted(const Node::Function *function) const {
+            return call_count(function) != 0 && !should_inline(function);
+        }
+
+        [[nodiscard]] size_t size(const Node::Function *function) const {
+            return m_sizes.at(function);
+        }
+
+        [[nodiscard]] size_t call_count(const Node::Function *function) const {
+            auto iterator = m_call_counts.find(function);
+            return iterator == m_call_counts.end() ? 0 : iterator->second;
+        }
+
+    private:
+        static constexpr long call_cost = 8;
+        static constexpr long growth_budget = 64;
+        static constexpr size_t max_inline_size = 256;
+
+        std::map<std::string, const Node::Function*> m_functions;
+        std::map<const Node::Function*, size_t> m_sizes;
+        std::map<const Node::Function*, size_t> m_call_counts;
+        std::map<const Node::Function*, std::set<const Node::Function*>> m_callees;
+        std::set<const Node::Function*> m_parallel; // Functions with a parallel block
+        std::set<const Node::Function*> m_arrays; // Functions that declare an array
+        InlinePolicy m_policy;
+        const Node::Function *m_caller = nullptr; // Whose statements the traversal is in, nullptr at the top level
+
+        void count_call(const Node::TermCall *call_term, const Node::Function *caller) {
+            auto iterator = m_functions.find(call_term->identifier.value.value());
+            if (iterator == m_functions.end()) {
+                return;
+            }
+
+            m_call_counts[iterator->second]++;
+            if (caller != nullptr) {
+                m_callees[caller].insert(iterator->second);
+            }
+        }
+
+        [[nodiscard]] bool is_recursive(const Node::Function *function) const {
+            std::set<const Node::Function*> visited;
+            std::vector<const Node::Function*> pending = { function };
+            while (!pending.empty()) {
+                const Node::Function *current = pending.back();
+                pending.pop_back();
+                auto iterator = m_callees.find(current);
+                if (iterator == m_callees.end()) {
+                    continue;
+                }
+                for (const Node::Function *callee : iterator->second) {
+                    if (callee == function) {
+                        return true;
+                    }
+                    if (visited.insert(callee).second) {
+                        pending.push_back(callee);
+                    }
+                }
+            }
+
+            return false;
+        }
+};
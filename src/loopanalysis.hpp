@@ -0,0 +1,227 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <variant>
+#include <optional>
+
+#include "parser.hpp"
+#include "astwalk.hpp"
+
+
+// A product `i * k` of a loop's induction variable `i` and a literal `k`, which can be kept up to date with an
+// add of `step * k` every iteration instead of being recomputed
+struct InductionProduct {
+    const Node::Expression *expression;
+    int64_t increment;
+};
+
+// Finds the expressions in a loop that are worth computing outside of it. Everything here is decided on the
+// source names alone, so a name that is assigned or declared anywhere in the loop is never treated as invariant
+class LoopAnalysis {
+    public:
+        inline explicit LoopAnalysis(const Node::Scope *body, std::optional<const Node::Expression*> condition = {},
+                                     std::optional<const Node::StmtIdent*> step = {}) : m_body(body)
+                                                                                      , m_condition(condition)
+                                                                                      , m_step(step) {
+            collect_variant(m_body->stmts);
+            if (m_step.has_value()) {
+                m_variant.insert(m_step.value()->identifier.value.value());
+            }
+        }
+
+        // Largest side effect free, non trapping subexpressions that only read variables the loop never writes
+        std::vector<const Node::Expression*> invariants() {
+            std::vector<const Node::Expression*> hoisted;
+            for_each_expression([&](const Node::Expression *expression) {
+                find_invariants(expression, hoisted);
+            });
+
+            return hoisted;
+        }
+
+        // Products of the step variable with a literal, valid when the step is `i = i + c` or `i = i - c` and
+        // nothing else in the loop assigns `i`
+        std::vector<InductionProduct> induction_products() {
+            std::vector<InductionProduct> products;
+            if (!m_step.has_value()) {
+                return products;
+            }
+
+            std::string induction_variable = m_step.value()->identifier.value.value();
+            std::optional<int64_t> step = induction_step(m_step.value(), induction_variable);
+            std::set<std::string> body_variant;
+            collect_variant(m_body->stmts, body_variant);
+            if (!step.has_value() || body_variant.contains(induction_variable)) {
+                return products;
+            }
+
+            for_each_expression([&](const Node::Expression *expression) {
+                find_products(expression, induction_variable, step.value(), products);
+            });
+
+            return products;
+        }
+
+        static std::optional<int64_t> literal_value(const Node::Expression *expression) {
+            auto term = std::get_if<Node::Term*>(&expression->var);
+            if (term == nullptr) {
+                return {};
+            }
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var)) {
+                return literal_value((*expression_term)->expr);
+            }
+            auto int_term = std::get_if<Node::TermInt*>(&(*term)->var);
+            if (int_term == nullptr) {
+                return {};
+            }
+
+            return (*int_term)->int_lit.int_value;
+        }
+
+        static std::optional<std::string> identifier_name(const Node::Expression *expression) {
+            auto term = std::get_if<Node::Term*>(&expression->var);
+            if (term == nullptr) {
+                return {};
+            }
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var)) {
+                return identifier_name((*expression_term)->expr);
+            }
+            if (auto identifier_term = std::get_if<Node::TermIdent*>(&(*term)->var)) {
+                return (*identifier_term)->identifier.value.value();
+            }
+
+            return {};
+        }
+
+    private:
+        const Node::Scope *m_body;
+        std::optional<const Node::Expression*> m_condition;
+        std::optional<const Node::StmtIdent*> m_step;
+        std::set<std::string> m_variant;
+
+        void collect_variant(const std::vector<Node::Statement*> &statements) {
+            collect_variant(statements, m_variant);
+        }
+
+        static void collect_variant(const std::vector<Node::Statement*> &statements, std::set<std::string> &variant) {
+            Walk::statements(statements, [&](const Node::Statement *statement) {
+                if (auto mut_statement = std::get_if<Node::StmtMut*>(&statement->var)) {
+                    variant.insert((*mut_statement)->identifier.value.value());
+                }
+                else if (auto identifier_statement = std::get_if<Node::StmtIdent*>(&statement->var)) {
+                    variant.insert((*identifier_statement)->identifier.value.value());
+                }
+                else if (auto index_statement = std::get_if<Node::StmtIndex*>(&statement->var)) {
+                    variant.insert((*index_statement)->identifier.value.value());
+                }
+                else if (auto array_statement = std::get_if<Node::StmtArray*>(&statement->var)) {
+                    variant.insert((*array_statement)->identifier.value.value());
+                }
+                else if (auto for_statement = std::get_if<Node::StmtFor*>(&statement->var)) {
+                    if ((*for_statement)->step.has_value()) {
+                        variant.insert((*for_statement)->step.value()->identifier.value.value());
+                    }
+                }
+            });
+        }
+
+        void for_each_expression(const Walk::ExpressionCallback &callback) const {
+            if (m_condition.has_value()) {
+                callback(m_condition.value());
+            }
+            if (m_step.has_value()) {
+                callback(m_step.value()->expr);
+            }
+            Walk::expressions(m_body->stmts, callback);
+        }
+
+        // Calls are never invariant, they may exit the program. An array element is only invariant when nothing
+        // in the loop stores to the array
+        bool is_invariant(const Node::Expression *expression) const {
+            if (auto name = identifier_name(expression)) {
+                return !m_variant.contains(name.value());
+            }
+            if (Walk::as_call(expression) != nullptr) {
+                return false;
+            }
+            if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+                auto index_term = std::get_if<Node::TermIndex*>(&(*term)->var);
+                if (index_term != nullptr && m_variant.contains((*index_term)->identifier.value.value())) {
+                    return false;
+                }
+            }
+
+            bool invariant = true;
+            Walk::operands(expression, [&](const Node::Expression *operand) {
+                invariant = invariant && is_invariant(operand);
+            });
+
+            return invariant;
+        }
+
+        // Anything that can fault stays where it is, a loop that never runs must not fault because its body was hoisted
+        void find_invariants(const Node::Expression *expression, std::vector<const Node::Expression*> &hoisted) const {
+            if (std::holds_alternative<Node::BinExpr*>(expression->var) && is_invariant(expression) && !Walk::can_trap(expression)) {
+                hoisted.push_back(expression);
+                return;
+            }
+
+            Walk::operands(expression, [&](const Node::Expression *operand) {
+                find_invariants(operand, hoisted);
+            });
+        }
+
+        static std::optional<int64_t> induction_step(const Node::StmtIdent *step, const std::string &induction_variable) {
+            auto binary_expression = std::get_if<Node::BinExpr*>(&step->expr->var);
+            if (binary_expression == nullptr) {
+                return {};
+            }
+
+            if (auto binary_add = std::get_if<Node::BinAdd*>(&(*binary_expression)->bin_expr)) {
+                if (identifier_name((*binary_add)->left_side) == induction_variable) {
+                    return literal_value((*binary_add)->right_side);
+                }
+                if (identifier_name((*binary_add)->right_side) == induction_variable) {
+                    return literal_value((*binary_add)->left_side);
+                }
+            }
+            else if (auto binary_subtract = std::get_if<Node::BinSubtract*>(&(*binary_expression)->bin_expr)) {
+                if (identifier_name((*binary_subtract)->left_side) == induction_variable) {
+                    if (auto value = literal_value((*binary_subtract)->right_side)) {
+                        return static_cast<int64_t>(0 - static_cast<uint64_t>(value.value()));
+                    }
+                }
+            }
+
+            return {};
+        }
+
+        static void find_products(const Node::Expression *expression, const std::string &induction_variable, int64_t step,
+                                  std::vector<InductionProduct> &products) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression->var)) {
+                if (auto binary_multiply = std::get_if<Node::BinMultiply*>(&(*binary_expression)->bin_expr)) {
+                    std::optional<int64_t> factor;
+                    if (identifier_name((*binary_multiply)->left_side) == induction_variable) {
+                        factor = literal_value((*binary_multiply)->right_side);
+                    }
+                    else if (identifier_name((*binary_multiply)->right_side) == induction_variable) {
+                        factor = literal_value((*binary_multiply)->left_side);
+                    }
+
+                    if (factor.has_value()) {
+                        // Wraps the same way the multiply it replaces would
+                        uint64_t increment = static_cast<uint64_t>(step) * static_cast<uint64_t>(factor.value());
+                        products.push_back({ .expression = expression, .increment = static_cast<int64_t>(increment) });
+                        return;
+                    }
+                }
+            }
+
+            Walk::operands(expression, [&](const Node::Expression *operand) {
+                find_products(operand, induction_variable, step, products);
+            });
+        }
+};
@@ -2,99 +2,48 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <cstdlib>
+#include <new>
 #include <string>
 #include <vector>
 #include <optional>
 #include <filesystem>
 
-#include "./token.hpp"
-#include "./error.hpp"
-#include "./tokenize.hpp"
-#include "./parser.hpp"
-#include "./codegen.hpp"
-#include "./varaibles.hpp"
+#include "./driver.hpp"
+#include "./server.hpp"
+#include "./timereport.hpp"
 
 
-int IsValidFile(std::string filename) {
-    std::filesystem::path filepath = std::move(filename);
-    std::string extension = filepath.extension();
-    filename = std::move(filepath);
-    if (extension == ".crm"){
-        return 1;
+// Counts every heap allocation for -ftime-report
+void* operator new(size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
     }
-    return 0;
+    throw std::bad_alloc{};
 }
 
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        std::cerr << "cer: error: no input files" << std::endl;
-        return 1;
-    }
-
-    int arg = 1;
-    int debug_flag = 0;
-    std::string source_file;
-    std::string output_file;
-    std::string linker_command;
-
-    while (arg < argc) {
-        if (strcmp(argv[arg], "-d") == 0) {
-            debug_flag = 1;
-        }
-        else if (strcmp(argv[arg], "-o") == 0) {
-            output_file = argv[arg + 1];
-            source_file = argv[arg + 2];
-            arg = arg + 2;
-        }
-        else {
-            source_file = argv[arg];
-            output_file = "out";
-        }
-        arg++;
-    }
+void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
 
-    if (!IsValidFile(source_file)){
-        std::cerr << "cer: error: invalid file type" << std::endl;
-        return 2;
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "--server") == 0) {
+        return CompileServer::serve(CompileServer::default_socket());
     }
-
-    std::stringstream contents_stream;
-    std::fstream input(source_file, std::ios::in);
-    if (!input.is_open()) {
-        std::cout << "cer: error: failed to open the file" << std::endl;
-        return 3;
+    if (argc == 2 && strncmp(argv[1], "--server=", 9) == 0) {
+        return CompileServer::serve(argv[1] + 9);
     }
-    contents_stream << input.rdbuf();
-    input.close();
-    std::string contents = contents_stream.str();
-
-    Tokenizer tokenizer(std::move(contents), source_file);
-    std::vector<Token> tokens = tokenizer.tokenize();
-
-    Parser parser(std::move(tokens), source_file);
-    std::pair<Node::Program, Variables> ast_vars_pair = parser.parse_program();
-
-    Node::Program ast = ast_vars_pair.first;
-    Variables variables = ast_vars_pair.second;
-
-    if (!error_flag) {
-        CodeGenerator generator(ast, variables);
-
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.generate_program();
-        file.close();
-
-
-        linker_command = "ld -o " + output_file + " out.o";
-        system("nasm -felf64 out.asm");
-        system(linker_command.c_str());
-        if (!debug_flag) {
-            system("rm out.o");
-            system("rm out.asm");
+    // With CER_SERVER set, a server does the work when one is listening there, and this process when none is
+    if (const char *server = std::getenv("CER_SERVER")) {
+        if (auto exit_code = CompileServer::forward(server, argc, argv)) {
+            return exit_code.value();
         }
     }
 
-    return 0;
+    return drive(argc, argv, std::filesystem::current_path(), std::cout, std::cerr);
 }
-
@@ -1,148 +1,34 @@
 #pragma once
 
 #include <utility>
+#include <map>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <variant>
 #include <optional>
+#include <algorithm>
+#include <functional>
 
+#include "ast.hpp"
 #include "error.hpp"
 #include "tokenize.hpp"
+#include "semantics.hpp"
 #include "varaibles.hpp"
 #include "arenaallocator.hpp"
 
 
-namespace Node {
-    struct Expression;
-    struct Statement;
-    struct StmtIfNext;
-
-    struct TermInt {
-        Token int_lit;
-    };
-
-    struct TermIdent {
-        Token identifier;
-    };
-
-    struct TermExpr {
-        Expression *expr;
-    };
-
-    struct Term {
-        std::variant<TermInt*, TermIdent*, TermExpr*> var;
-    };
-
-    struct BinAdd {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BinSubtract {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BinMultiply {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BinDivide {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BinModulus {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BitAnd{
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BitOr {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BitXor {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BitNot {
-        Expression *left_side;
-        Expression *right_side;
-    };
-
-    struct BinExpr {
-        std::variant<BinAdd*, BinSubtract*, BinMultiply*, BinDivide*, BinModulus*, BitAnd*, BitOr*, BitXor*> bin_expr;
-    };
-
-    struct Expression {
-        std::variant<Term*, BinExpr*> var;
-    };
-
-    struct StmtExit {
-        Expression *expr;
-    };
-
-    struct StmtMut {
-        Token identifier;
-        std::optional<Expression*> expr{};
-    };
-
-    struct StmtIdent {
-        Token identifier;
-        Expression *expr{};
-    };
-
-    struct Scope {
-        std::vector<Statement*> stmts;
-    };
-
-    struct StmtElif {
-        Expression *expr{};
-        Scope *scope{};
-        std::optional<StmtIfNext*> next;
-    };
-
-    struct StmtElse {
-        Scope *scope{};
-    };
-
-    struct StmtIfNext {
-        std::variant<StmtElif*, StmtElse*> var;
-    };
-
-    struct StmtIf {
-        Expression *expr{};
-        Scope *scope{};
-        std::optional<StmtIfNext*> next;
-    };
-
-
-    struct Statement {
-        std::variant<StmtExit*, StmtMut*, StmtIdent*, Scope*, StmtIf*> var;
-    };
-
-    struct Program {
-        std::vector<Statement*> statements;
-    };
-}
-
 class Parser {
     public:
-        inline explicit Parser(std::vector<Token> tokens, std::string  filename) : m_tokens(std::move(tokens))
-                                                                             , m_allocator(1024 * 1024 * 4)
-                                                                             , m_filename(std::move(filename)) {
+        inline explicit Parser(std::vector<Token> tokens, std::string  filename, size_t error_limit = 0) : m_filename(std::move(filename))
+                                                                                                     , m_diagnostics(error_limit)
+                                                                                                     , m_allocator(1024 * 1024 * 4)
+                                                                                                     , m_tokens(std::move(tokens))
+                                                                                                     , m_semantics(std::bind_front(&Parser::report, this)) {
             m_curr_index = 0;
-            m_current_scope = 0;
         }
+        Parser(const Parser&) = delete;
+        Parser& operator=(const Parser&) = delete;
 
         std::optional<Node::Term*> parse_term() {
             if (auto int_lit = try_grab(TokenType::int_lit)) {
@@ -153,14 +39,59 @@ class Parser {
                 return term;
             }
 
+            else if (seek().has_value() && (seek().value().type == TokenType::True || seek().value().type == TokenType::False)) {
+                auto bool_term = m_allocator.alloc<Node::TermBool>();
+                bool_term->bool_lit = grab();
+                auto term = m_allocator.alloc<Node::Term>();
+                term->var = bool_term;
+                return term;
+            }
+
+            else if (auto tilde = try_grab(TokenType::tilde)) {
+                auto bit_not = m_allocator.alloc<Node::BitNot>();
+                if (auto operand = parse_term()) {
+                    bit_not->expr = m_allocator.alloc<Node::Expression>();
+                    bit_not->expr->var = operand.value();
+                }
+                else {
+                    m_diagnostics.error_token(m_filename, "expected primary expression after '~'", tilde.value(), "~");
+                    return {};
+                }
+                auto term = m_allocator.alloc<Node::Term>();
+                term->var = bit_not;
+                return term;
+            }
+
+            else if (seek().has_value() && seek().value().type == TokenType::identifier && Semantics::builtins.contains(seek().value().value.value())
+                     && seek(1).has_value() && seek(1).value().type == TokenType::open_parenthesis) {
+                auto term = m_allocator.alloc<Node::Term>();
+                term->var = parse_builtin(grab());
+                return term;
+            }
+
+            else if (seek().has_value() && seek().value().type == TokenType::identifier
+                     && seek(1).has_value() && seek(1).value().type == TokenType::open_parenthesis) {
+                Token identifier = grab();
+                auto call_term = parse_call(identifier);
+                m_semantics.call_value(identifier);
+                auto term = m_allocator.alloc<Node::Term>();
+                term->var = call_term;
+                return term;
+            }
+
+            else if (seek().has_value() && seek().value().type == TokenType::identifier
+                     && seek(1).has_value() && seek(1).value().type == TokenType::open_square_bracket) {
+                auto term = m_allocator.alloc<Node::Term>();
+                term->var = parse_index(grab());
+                return term;
+            }
+
             else if (auto identifier = try_grab(TokenType::identifier)) {
                 auto identifier_term = m_allocator.alloc<Node::TermIdent>();
-                if (m_variables.exists(identifier.value().value.value(), m_current_scope)) {
+                if (m_semantics.is_declared(identifier.value().value.value())) {
                     identifier_term->identifier = identifier.value();
                 }
-                else {
-                    error_identifier(m_filename, "identifier not declared in this scope", identifier.value());
-                }
+                m_semantics.value(identifier.value(), m_array_expression);
                 auto term = m_allocator.alloc<Node::Term>();
                 term->var = identifier_term;
                 return term;
@@ -183,88 +114,58 @@ class Parser {
             return {};
         }
 
+        template <typename Operation> Node::BinExpr* make_binary_expression(Node::Expression *expression, Node::Expression *right_expression) {
+            auto left_expression = m_allocator.alloc<Node::Expression>();
+            auto binary_expression = m_allocator.alloc<Node::BinExpr>();
+            auto operation = m_allocator.alloc<Operation>();
+            left_expression->var = expression->var;
+            operation->left_side = left_expression;
+            operation->right_side = right_expression;
+            binary_expression->bin_expr = operation;
+            return binary_expression;
+        }
+
         std::optional<Node::BinExpr*> parse_binary_expression(Node::Expression *expression, TokenType type, int precedence) {
             if (auto right_expression = parse_expression(precedence)) {
-                if (type == TokenType::plus) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto binary_add = m_allocator.alloc<Node::BinAdd>();
-                    left_expression->var = expression->var;
-                    binary_add->left_side = left_expression;
-                    binary_add->right_side = right_expression.value();
-                    binary_expression->bin_expr = binary_add;
-                    return binary_expression;
-                }
-                else if (type == TokenType::minus) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto binary_add = m_allocator.alloc<Node::BinSubtract>();
-                    left_expression->var = expression->var;
-                    binary_add->left_side = left_expression;
-                    binary_add->right_side = right_expression.value();
-                    binary_expression->bin_expr = binary_add;
-                    return binary_expression;
-                }
-                else if (type == TokenType::star) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto binary_add = m_allocator.alloc<Node::BinMultiply>();
-                    left_expression->var = expression->var;
-                    binary_add->left_side = left_expression;
-                    binary_add->right_side = right_expression.value();
-                    binary_expression->bin_expr = binary_add;
-                    return binary_expression;
-                }
-                else if (type == TokenType::forward_slash) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto binary_add = m_allocator.alloc<Node::BinDivide>();
-                    left_expression->var = expression->var;
-                    binary_add->left_side = left_expression;
-                    binary_add->right_side = right_expression.value();
-                    binary_expression->bin_expr = binary_add;
-                    return binary_expression;
-                }
-                else if (type == TokenType::modulus) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto binary_modulus = m_allocator.alloc<Node::BinModulus>();
-                    left_expression->var = expression->var;
-                    binary_modulus->left_side = left_expression;
-                    binary_modulus->right_side = right_expression.value();
-                    binary_expression->bin_expr = binary_modulus;
-                    return binary_expression;
-                }
-                else if (type == TokenType::ampersand) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto bitwise_and = m_allocator.alloc<Node::BitAnd>();
-                    left_expression->var = expression->var;
-                    bitwise_and->left_side = left_expression;
-                    bitwise_and->right_side = right_expression.value();
-                    binary_expression->bin_expr = bitwise_and;
-                    return binary_expression;
-                }
-                else if (type == TokenType::caret) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto bitwise_xor = m_allocator.alloc<Node::BitXor>();
-                    left_expression->var = expression->var;
-                    bitwise_xor->left_side = left_expression;
-                    bitwise_xor->right_side = right_expression.value();
-                    binary_expression->bin_expr = bitwise_xor;
-                    return binary_expression;
-                }
-
-                else if (type == TokenType::pipe) {
-                    auto left_expression = m_allocator.alloc<Node::Expression>();
-                    auto binary_expression = m_allocator.alloc<Node::BinExpr>();
-                    auto bitwise_or = m_allocator.alloc<Node::BitOr>();
-                    left_expression->var = expression->var;
-                    bitwise_or->left_side = left_expression;
-                    bitwise_or->right_side = right_expression.value();
-                    binary_expression->bin_expr = bitwise_or;
-                    return binary_expression;
+                switch (type) {
+                    case TokenType::plus:
+                        return make_binary_expression<Node::BinAdd>(expression, right_expression.value());
+                    case TokenType::minus:
+                        return make_binary_expression<Node::BinSubtract>(expression, right_expression.value());
+                    case TokenType::star:
+                        return make_binary_expression<Node::BinMultiply>(expression, right_expression.value());
+                    case TokenType::forward_slash:
+                        return make_binary_expression<Node::BinDivide>(expression, right_expression.value());
+                    case TokenType::modulus:
+                        return make_binary_expression<Node::BinModulus>(expression, right_expression.value());
+                    case TokenType::ampersand:
+                        return make_binary_expression<Node::BitAnd>(expression, right_expression.value());
+                    case TokenType::caret:
+                        return make_binary_expression<Node::BitXor>(expression, right_expression.value());
+                    case TokenType::pipe:
+                        return make_binary_expression<Node::BitOr>(expression, right_expression.value());
+                    case TokenType::shift_left:
+                        return make_binary_expression<Node::ShiftLeft>(expression, right_expression.value());
+                    case TokenType::shift_right:
+                        return make_binary_expression<Node::ShiftRight>(expression, right_expression.value());
+                    case TokenType::double_equals:
+                        return make_binary_expression<Node::CmpEqual>(expression, right_expression.value());
+                    case TokenType::not_equals:
+                        return make_binary_expression<Node::CmpNotEqual>(expression, right_expression.value());
+                    case TokenType::less_than:
+                        return make_binary_expression<Node::CmpLess>(expression, right_expression.value());
+                    case TokenType::less_equals:
+                        return make_binary_expression<Node::CmpLessEqual>(expression, right_expression.value());
+                    case TokenType::greater_than:
+                        return make_binary_expression<Node::CmpGreater>(expression, right_expression.value());
+                    case TokenType::greater_equals:
+                        return make_binary_expression<Node::CmpGreaterEqual>(expression, right_expression.value());
+                    case TokenType::double_ampersand:
+                        return make_binary_expression<Node::LogicAnd>(expression, right_expression.value());
+                    case TokenType::double_pipe:
+                        return make_binary_expression<Node::LogicOr>(expression, right_expression.value());
+                    default:
+                        break;
                 }
             }
 
@@ -303,18 +204,212 @@ class Parser {
         }
 
         Node::Scope* parse_scope() {
-            m_current_scope++;
+            m_semantics.begin_scope();
             auto scope = m_allocator.alloc<Node::Scope>();
             while (auto stmt = parse_statement()) {
                 scope->stmts.push_back(stmt.value());
             }
 
             try_grab(TokenType::close_curly_bracket, "expected '}'");
-            m_current_scope--;
+            m_semantics.end_scope();
 
             return scope;
         }
 
+        Node::StmtIdent* parse_assignment(const Token &identifier) {
+            auto identifier_statement = m_allocator.alloc<Node::StmtIdent>();
+            identifier_statement->identifier = identifier;
+            m_semantics.assignment(identifier);
+            if (m_semantics.is_declared(identifier.value.value())) {
+                try_grab(TokenType::equals, "expected '='");
+
+                if (auto node_expr = parse_expression()) {
+                    identifier_statement->expr = node_expr.value();
+                }
+                else {
+                    if (auto token = seek()) {
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                    }
+                    else {
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                    }
+                }
+            }
+            else {
+                while(seek().has_value() && !is_statement(seek().value().type)) {
+                    grab();
+                }
+            }
+
+            return identifier_statement;
+        }
+
+        Node::StmtIndex* parse_element_assignment(const Token &identifier) {
+            auto index_statement = m_allocator.emplace<Node::StmtIndex>();
+            index_statement->identifier = identifier;
+            index_statement->index = parse_index(identifier)->index;
+            try_grab(TokenType::equals, "expected '='");
+
+            if (auto node_expr = parse_expression()) {
+                index_statement->expr = node_expr.value();
+            }
+            else if (auto token = seek()) {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+            }
+            else {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+            }
+
+            return index_statement;
+        }
+
+        Node::StmtArray* parse_array_assignment(const Token &identifier) {
+            auto array_statement = m_allocator.emplace<Node::StmtArray>();
+            array_statement->identifier = identifier;
+            try_grab(TokenType::equals, "expected '='");
+
+            m_array_expression = true;
+            auto node_expr = parse_expression();
+            m_array_expression = false;
+            if (node_expr.has_value()) {
+                array_statement->expr = node_expr.value();
+                m_semantics.array_expression(node_expr.value(), identifier);
+            }
+            else if (auto token = seek()) {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+            }
+            else {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+            }
+
+            return array_statement;
+        }
+
+        Node::TermIndex* parse_index(const Token &identifier) {
+            auto index_term = m_allocator.emplace<Node::TermIndex>();
+            index_term->identifier = identifier;
+            try_grab(TokenType::open_square_bracket, "expected '['");
+
+            // The index itself is an ordinary value, even inside an array expression
+            bool array_expression = std::exchange(m_array_expression, false);
+            auto index = parse_expression();
+            m_array_expression = array_expression;
+            if (index.has_value()) {
+                index_term->index = index.value();
+            }
+            else if (auto token = seek()) {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+            }
+            else {
+                m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+            }
+            try_grab(TokenType::close_square_bracket, "expected ']'");
+            m_semantics.index(identifier, index.value_or(nullptr), m_array_expression);
+
+            return index_term;
+        }
+
+        void parse_arguments(std::vector<Node::Expression*> &args) {
+            try_grab(TokenType::open_parenthesis, "expected '('");
+
+            if (seek().has_value() && seek().value().type != TokenType::close_parenthesis) {
+                do {
+                    if (auto expression = parse_expression()) {
+                        args.push_back(expression.value());
+                    }
+                    else if (auto token = seek()) {
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                        break;
+                    }
+                    else {
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                        break;
+                    }
+                } while (try_grab(TokenType::comma));
+            }
+            try_grab(TokenType::close_parenthesis, "expected ')'");
+        }
+
+        Node::TermCall* parse_call(const Token &identifier) {
+            auto call_term = m_allocator.emplace<Node::TermCall>();
+            call_term->identifier = identifier;
+            parse_arguments(call_term->args);
+            m_semantics.call(identifier, call_term->args.size());
+
+            return call_term;
+        }
+
+        Node::TermBuiltin* parse_builtin(const Token &identifier) {
+            auto builtin_term = m_allocator.emplace<Node::TermBuiltin>();
+            builtin_term->identifier = identifier;
+            parse_arguments(builtin_term->args);
+            m_semantics.builtin(identifier, builtin_term->args.size());
+
+            return builtin_term;
+        }
+
+        Node::Function* parse_function() {
+            auto function = m_allocator.emplace<Node::Function>();
+            if (auto identifier = try_grab(TokenType::identifier, "expected a function name")) {
+                function->identifier = identifier.value();
+                m_semantics.declare_function(function);
+            }
+            try_grab(TokenType::open_parenthesis, "expected '('");
+            m_semantics.begin_function(function);
+
+            if (seek().has_value() && seek().value().type != TokenType::close_parenthesis) {
+                do {
+                    auto identifier = try_grab(TokenType::identifier, "expected a parameter name");
+                    if (!identifier.has_value()) {
+                        break;
+                    }
+                    Node::Parameter parameter{ .identifier = identifier.value(), .type = { .type = TokenType::int64 } };
+                    try_grab(TokenType::colon, "expected ':'");
+                    if (seek().has_value() && is_type(seek().value().type)) {
+                        parameter.type = grab();
+                    }
+                    else {
+                        try_grab(TokenType::int64, "no type declaration for parameter '" + identifier.value().value.value() + "'");
+                    }
+
+                    m_semantics.declare_parameter(identifier.value());
+                    function->params.push_back(parameter);
+                } while (try_grab(TokenType::comma));
+            }
+            try_grab(TokenType::close_parenthesis, "expected ')'");
+
+            if (try_grab(TokenType::colon)) {
+                if (seek().has_value() && is_type(seek().value().type)) {
+                    function->return_type = grab();
+                }
+                else {
+                    try_grab(TokenType::int64, "expected a return type");
+                }
+            }
+
+            try_grab(TokenType::open_curly_bracket, "expected '{'");
+            function->scope = parse_scope();
+            m_semantics.end_function();
+
+            return function;
+        }
+
+        Node::Expression* parse_condition() {
+            try_grab(TokenType::open_parenthesis, "expected '('");
+            auto expression = parse_expression();
+            if (!expression.has_value()) {
+                if (auto token = seek()) {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                }
+                else {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                }
+            }
+            try_grab(TokenType::close_parenthesis, "expected ')'");
+
+            return expression.value_or(nullptr);
+        }
+
         std::optional<Node::StmtIfNext*> parse_if_next() {
             if (auto token_elif = try_grab(TokenType::elif)) {
                 try_grab(TokenType::open_parenthesis, "expected '('");
@@ -325,10 +420,10 @@ class Parser {
                 }
                 else {
                     if (auto token = seek()) {
-                        error_expected(m_filename, "expected primary expression", token.value());
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
                     }
                     else {
-                        error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
                     }
                 }
 
@@ -363,6 +458,16 @@ class Parser {
         }
 
         std::optional<Node::Statement*> parse_statement() {
+            std::optional<Token> first_token = seek();
+            auto statement = parse_statement_node();
+            if (statement.has_value() && first_token.has_value()) {
+                statement.value()->line_no = first_token.value().line_no;
+            }
+
+            return statement;
+        }
+
+        std::optional<Node::Statement*> parse_statement_node() {
             if (auto token_exit = try_grab(TokenType::exit)) {
                 auto exit_statement = m_allocator.alloc<Node::StmtExit>();
 
@@ -382,10 +487,10 @@ class Parser {
                 }
                 else {
                     if (auto token = seek()) {
-                        error_expected(m_filename, "expected primary expression", token.value());
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
                     }
                     else {
-                        error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
                     }
                 }
 
@@ -398,22 +503,55 @@ class Parser {
                 return statement;
             }
 
+            else if (auto token_print = try_grab(TokenType::print)) {
+                auto print_statement = m_allocator.alloc<Node::StmtPrint>();
+
+                try_grab(TokenType::open_parenthesis, "expected '('");
+
+                if (auto node_expr = parse_expression()) {
+                    print_statement->expr = node_expr.value();
+                }
+                else if (auto token = seek()) {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                }
+                else {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                }
+
+                try_grab(TokenType::close_parenthesis, "expected ')'");
+
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = print_statement;
+                return statement;
+            }
+
             else if (auto token_mut = try_grab(TokenType::mut)) {
-                auto mut_statement = m_allocator.alloc<Node::StmtMut>();
+                auto mut_statement = m_allocator.emplace<Node::StmtMut>();
                 auto identifier = try_grab(TokenType::identifier, "expected an identifier");
 
                 if (identifier.has_value()) {
-                    if (m_variables.is_valid(identifier.value().value.value(), m_current_scope)) {
+                    if (m_semantics.can_declare(identifier.value())) {
                         mut_statement->identifier = identifier.value();
-                        m_variables.declare_variable(identifier.value().value.value(), m_current_scope);
 
                         try_grab(TokenType::colon, "expected ':'");
 
-                        if (identifier.has_value()) {
-                            try_grab(TokenType::int64, "no type declaration for identifier '" + mut_statement->identifier.value.value() + "'");
+                        if (seek().has_value() && is_type(seek().value().type)) {
+                            mut_statement->type = grab();
                         }
                         else {
-                            try_grab(TokenType::int64,"no type declaration");
+                            try_grab(TokenType::int64, "no type declaration for identifier '" + mut_statement->identifier.value.value() + "'");
+                        }
+
+                        if (try_grab(TokenType::open_square_bracket)) {
+                            mut_statement->length = parse_array_length(mut_statement);
+                            try_grab(TokenType::close_square_bracket, "expected ']'");
+                        }
+                        m_semantics.declare(identifier.value(), mut_statement->type.type, mut_statement->length.value_or(0));
+
+                        if (mut_statement->length.has_value() && seek().has_value() && seek().value().type == TokenType::equals) {
+                            m_semantics.array_initializer(identifier.value());
                         }
 
                         if (auto equals = try_grab(TokenType::equals)) {
@@ -421,9 +559,9 @@ class Parser {
                                 mut_statement->expr = node_expr.value();
                             } else {
                                 if (auto token = seek()) {
-                                    error_expected(m_filename, "expected primary expression", token.value());
+                                    m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
                                 } else {
-                                    error_expected(m_filename, "expected primary expression", "before the end of input",
+                                    m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input",
                                                    m_curr_line, m_curr_col);
                                 }
                             }
@@ -432,11 +570,10 @@ class Parser {
                         if (seek().has_value() && (seek().value().type == TokenType::identifier || seek().value().type == TokenType::int_lit
                                                 || seek().value().type == TokenType::open_parenthesis)) {
                             auto token = seek();
-                            error_expected(m_filename, "expected '='", token.value());
+                            m_diagnostics.error_expected(m_filename, "expected '='", token.value());
                         }
                     }
                     else {
-                        error_identifier(m_filename, "multiple definitions of identifier", identifier.value());
                         while(seek().has_value() && !is_statement(seek().value().type)) {
                             grab();
                         }
@@ -455,30 +592,42 @@ class Parser {
                 return statement;
             }
 
-            else if (auto token_identifier = try_grab(TokenType::identifier)) {
-                auto identifier_statement = m_allocator.alloc<Node::StmtIdent>();
-                identifier_statement->identifier = token_identifier.value();
-                if (m_variables.exists(token_identifier.value().value.value(), m_current_scope)) {
-                    try_grab(TokenType::equals, "expected '='");
+            else if (seek().has_value() && seek().value().type == TokenType::identifier
+                     && seek(1).has_value() && seek(1).value().type == TokenType::open_parenthesis) {
+                auto call_statement = m_allocator.alloc<Node::StmtCall>();
+                call_statement->call = parse_call(grab());
 
-                    if (auto node_expr = parse_expression()) {
-                        identifier_statement->expr = node_expr.value();
-                    }
-                    else {
-                        if (auto token = seek()) {
-                            error_expected(m_filename, "expected primary expression", token.value());
-                        }
-                        else {
-                            error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
-                        }
-                    }
-                }
-                else {
-                    error_identifier(m_filename, "identifier not declared in this scope",token_identifier.value());
-                    while(seek().has_value() && !is_statement(seek().value().type)) {
-                        grab();
-                    }
-                }
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = call_statement;
+                return statement;
+            }
+
+            else if (seek().has_value() && seek().value().type == TokenType::identifier
+                     && seek(1).has_value() && seek(1).value().type == TokenType::open_square_bracket) {
+                auto index_statement = parse_element_assignment(grab());
+
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = index_statement;
+                return statement;
+            }
+
+            else if (seek().has_value() && seek().value().type == TokenType::identifier
+                     && m_semantics.is_array(seek().value().value.value())) {
+                auto array_statement = parse_array_assignment(grab());
+
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = array_statement;
+                return statement;
+            }
+
+            else if (auto token_identifier = try_grab(TokenType::identifier)) {
+                auto identifier_statement = parse_assignment(token_identifier.value());
 
                 try_grab(TokenType::semi_colon, "expected ';'");
 
@@ -503,10 +652,10 @@ class Parser {
                 }
                 else {
                     if (auto token = seek()) {
-                        error_expected(m_filename, "expected primary expression", token.value());
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
                     }
                     else {
-                        error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                        m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
                     }
                 }
 
@@ -526,6 +675,117 @@ class Parser {
 
             }
 
+            else if (auto token_profile = try_grab(TokenType::profile)) {
+                auto profile_statement = m_allocator.emplace<Node::StmtProfile>();
+                if (auto name = try_grab(TokenType::string_lit, "expected the name of the region")) {
+                    profile_statement->name = name.value();
+                }
+                try_grab(TokenType::open_curly_bracket, "expected '{'");
+                profile_statement->scope = parse_scope();
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = profile_statement;
+                return statement;
+            }
+
+            else if (auto token_parallel = try_grab(TokenType::parallel)) {
+                auto parallel_statement = m_allocator.alloc<Node::StmtParallel>();
+
+                try_grab(TokenType::open_parenthesis, "expected '('");
+                if (auto expression = parse_expression()) {
+                    parallel_statement->count = expression.value();
+                }
+                else if (auto token = seek()) {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                }
+                else {
+                    m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                }
+                try_grab(TokenType::close_parenthesis, "expected ')'");
+                try_grab(TokenType::open_curly_bracket, "expected '{'");
+
+                // The count is worked out before the workers start, outside of the block
+                const bool outer_parallel = m_semantics.begin_parallel(token_parallel.value());
+                parallel_statement->scope = parse_scope();
+                m_semantics.end_parallel(outer_parallel);
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = parallel_statement;
+                return statement;
+            }
+
+            else if (auto token_while = try_grab(TokenType::while_)) {
+                auto while_statement = m_allocator.alloc<Node::StmtWhile>();
+                while_statement->expr = parse_condition();
+                try_grab(TokenType::open_curly_bracket, "expected '{'");
+                while_statement->scope = parse_scope();
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = while_statement;
+                return statement;
+            }
+
+            else if (auto token_for = try_grab(TokenType::for_)) {
+                auto for_statement = m_allocator.alloc<Node::StmtFor>();
+                try_grab(TokenType::open_parenthesis, "expected '('");
+
+                // Variables declared in the initializer belong to a scope around the loop
+                m_semantics.begin_scope();
+                if (seek().has_value() && (seek().value().type == TokenType::mut || seek().value().type == TokenType::identifier)) {
+                    for_statement->init = parse_statement();
+                }
+                else {
+                    try_grab(TokenType::semi_colon, "expected ';'");
+                }
+
+                if (seek().has_value() && seek().value().type != TokenType::semi_colon) {
+                    for_statement->expr = parse_expression();
+                    if (!for_statement->expr.has_value()) {
+                        if (auto token = seek()) {
+                            m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                        }
+                        else {
+                            m_diagnostics.error_expected(m_filename, "expected primary expression", "before the end of input", m_curr_line, m_curr_col);
+                        }
+                    }
+                }
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                if (auto identifier = try_grab(TokenType::identifier)) {
+                    for_statement->step = parse_assignment(identifier.value());
+                }
+                try_grab(TokenType::close_parenthesis, "expected ')'");
+                try_grab(TokenType::open_curly_bracket, "expected '{'");
+
+                for_statement->scope = parse_scope();
+                m_semantics.end_scope();
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = for_statement;
+                return statement;
+            }
+
+            else if (auto token_return = try_grab(TokenType::return_)) {
+                auto return_statement = m_allocator.emplace<Node::StmtReturn>();
+                return_statement->token = token_return.value();
+                if (seek().has_value() && seek().value().type != TokenType::semi_colon) {
+                    return_statement->expr = parse_expression();
+                    if (!return_statement->expr.has_value()) {
+                        if (auto token = seek()) {
+                            m_diagnostics.error_expected(m_filename, "expected primary expression", token.value());
+                        }
+                    }
+                }
+
+                m_semantics.return_statement(token_return.value(), return_statement->expr.has_value());
+
+                try_grab(TokenType::semi_colon, "expected ';'");
+
+                auto statement = m_allocator.alloc<Node::Statement>();
+                statement->var = return_statement;
+                return statement;
+            }
+
             else if (auto token_semi = try_grab(TokenType::semi_colon)) {
                 grab();
             }
@@ -535,32 +795,51 @@ class Parser {
 
         std::pair<Node::Program, Variables> parse_program() {
             Node::Program program;
-            while(seek().has_value()) {
-                if (auto statement = parse_statement()) {
+            while(seek().has_value() && !m_diagnostics.truncated()) {
+                if (auto token_fn = try_grab(TokenType::fn)) {
+                    program.functions.push_back(parse_function());
+                }
+                else if (auto statement = parse_statement()) {
                     program.statements.push_back(statement.value());
                 }
                 else {
-                    std::cerr << "cer: error: invalid statement" << std::endl;
-                    exit(EXIT_FAILURE);
+                    if (auto token = seek()) {
+                        m_diagnostics.error_expected(m_filename, "invalid statement", token.value());
+                    }
+                    break;
                 }
             }
 
             std::pair<Node::Program, Variables> pair;
             pair.first = program;
-            pair.second = m_variables;
+            pair.second = m_semantics.variables();
 
             return pair;
         }
 
+        // Every node of the tree lives in the parser's arena
+        [[nodiscard]] size_t nodes() const {
+            return m_allocator.allocations();
+        }
+
+        [[nodiscard]] size_t arena_used() const {
+            return m_allocator.used();
+        }
+
+        [[nodiscard]] const Diagnostics& diagnostics() const {
+            return m_diagnostics;
+        }
+
     private:
         int m_curr_col;
         int m_curr_line;
-        int m_current_scope;
-        Variables m_variables;
+        bool m_array_expression = false;
         size_t m_curr_index;
         const std::string m_filename;
+        Diagnostics m_diagnostics;
         ArenaAllocator m_allocator;
         const std::vector<Token> m_tokens;
+        Semantics m_semantics;
 
         [[nodiscard]] inline std::optional<Token> seek(int offset = 0) const {
             if (m_curr_index + offset >= m_tokens.size()) {
@@ -575,10 +854,10 @@ class Parser {
             }
             else {
                 if (auto token = seek()) {
-                    error_expected(m_filename, error_msg, token.value());
+                    m_diagnostics.error_expected(m_filename, error_msg, token.value());
                 }
                 else {
-                    error_expected(m_filename, error_msg, "before the end of input", m_curr_line, m_curr_col);
+                    m_diagnostics.error_expected(m_filename, error_msg, "before the end of input", m_curr_line, m_curr_col);
                 }
             }
 
@@ -593,6 +872,26 @@ class Parser {
             return {};
         }
 
+        std::optional<size_t> parse_array_length(const Node::StmtMut *mut_statement) {
+            auto length = try_grab(TokenType::int_lit, "expected the array length");
+            if (!length.has_value()) {
+                return {};
+            }
+
+            return m_semantics.array_length(mut_statement->identifier, mut_statement->type.type,
+                                            static_cast<uint64_t>(length.value().int_value));
+        }
+
+        // Where the semantic checks go wrong, on the token they are about
+        void report(const std::string &message, const Token &token, const std::optional<std::string> &keyword) {
+            if (keyword.has_value()) {
+                m_diagnostics.error_token(m_filename, message, token, keyword.value());
+            }
+            else {
+                m_diagnostics.error_identifier(m_filename, message, token);
+            }
+        }
+
         inline Token grab() {
             Token token = m_tokens.at(m_curr_index++);
             m_curr_line = token.line_no;
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <set>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "cerium.hpp"
+#include "parser.hpp"
+#include "astwalk.hpp"
+#include "codegen.hpp"
+#include "inliner.hpp"
+#include "profile.hpp"
+#include "peephole.hpp"
+#include "reassociate.hpp"
+
+
+// A pass of the optimizer. Transforms rewrite the tree, analyses only read it, codegen passes are decisions the
+// code generator makes as it lowers the tree, and assembly passes rewrite what it generated
+struct Pass {
+    enum class Kind {
+        transform,
+        analysis,
+        codegen,
+        assembly,
+    };
+
+    std::string name;
+    Kind kind;
+    std::vector<std::string> dependencies{}; // Run before this one, and are pulled into any pipeline it is in
+};
+
+// Picks the passes of an optimization level and runs them. Every pass runs in the order of the registry, after what
+// it depends on. Analyses that are due at the same point share one traversal of the tree, so each one that is
+// turned on costs its own work and not another walk over the whole program
+class PassManager {
+    public:
+        // What the analyses found, which code generation takes
+        struct Analyses {
+            Inliner inliner;
+            std::optional<Profile> profile{};
+        };
+
+        // Every pass there is, in the order they run
+        static const std::vector<Pass>& registry() {
+            static const std::vector<Pass> passes = {
+                { .name = "reassociate", .kind = Pass::Kind::transform },
+                { .name = "call-graph", .kind = Pass::Kind::analysis },
+                { .name = "profile-blocks", .kind = Pass::Kind::analysis },
+                { .name = "inline", .kind = Pass::Kind::codegen, .dependencies = { "call-graph" } },
+                { .name = "hoist-invariants", .kind = Pass::Kind::codegen },
+                { .name = "strength-reduce", .kind = Pass::Kind::codegen },
+                { .name = "if-convert", .kind = Pass::Kind::codegen },
+                { .name = "align-loops", .kind = Pass::Kind::codegen },
+                { .name = "codegen", .kind = Pass::Kind::codegen, .dependencies = { "call-graph" } },
+                { .name = "peephole", .kind = Pass::Kind::assembly, .dependencies = { "codegen" } },
+            };
+
+            return passes;
+        }
+
+        // What each level asks for, the passes they depend on come along. -Os leaves out what makes the code
+        // larger for speed, and only inlines what makes it smaller
+        static std::vector<std::string> pipeline(OptLevel level) {
+            switch (level) {
+                case OptLevel::O0:
+                    return { "codegen" };
+                case OptLevel::O1:
+                    return { "hoist-invariants", "if-convert", "codegen", "peephole" };
+                case OptLevel::O2:
+                    return { "reassociate", "inline", "hoist-invariants", "strength-reduce", "if-convert", "align-loops",
+                             "codegen", "peephole" };
+                case OptLevel::Os:
+                    return { "reassociate", "inline", "hoist-invariants", "if-convert", "codegen", "peephole" };
+            }
+
+            return {};
+        }
+
+        // Profiles number the blocks of the program whatever the level, -fprofile-use has to agree with the
+        // instrumented build on them
+        PassManager(OptLevel level, bool profiling) : m_level(level) {
+            std::vector<std::string> pending = pipeline(level);
+            if (profiling) {
+                pending.emplace_back("profile-blocks");
+            }
+            while (!pending.empty()) {
+                std::string pass_name = std::move(pending.back());
+                pending.pop_back();
+                if (!m_enabled.insert(pass_name).second) {
+                    continue;
+                }
+                const size_t position = index(pass_name);
+                for (const std::string &dependency : registry()[position].dependencies) {
+                    if (index(dependency) >= position) {
+                        throw std::logic_error("pass '" + pass_name + "' runs before '" + dependency + "', which it depends on");
+                    }
+                    pending.push_back(dependency);
+                }
+            }
+        }
+
+        [[nodiscard]] bool enabled(const std::string &pass_name) const {
+            return m_enabled.contains(pass_name);
+        }
+
+        // Runs the transforms, which rewrite the tree in place, and then every analysis in one traversal
+        [[nodiscard]] Analyses analyze(const Node::Program &program) {
+            if (enabled("reassociate")) {
+                time("reassociate", Pass::Kind::transform, [&]() {
+                    Reassociation reassociation(program);
+                    return "chains rebalanced: " + std::to_string(reassociation.chains());
+                });
+            }
+
+            Analyses analyses{ .inliner = Inliner(program, enabled("inline") ? inline_policy() : InlinePolicy::never) };
+            std::vector<Walk::Hooks> hooks;
+            std::vector<std::string> fused;
+            if (enabled("call-graph")) {
+                hooks.push_back(analyses.inliner.hooks());
+                fused.emplace_back("call-graph");
+            }
+            if (enabled("profile-blocks")) {
+                analyses.profile = Profile();
+                hooks.push_back(analyses.profile->hooks());
+                fused.emplace_back("profile-blocks");
+            }
+            if (!hooks.empty()) {
+                time(fused.front(), Pass::Kind::analysis, [&]() {
+                    Walk::program(program, hooks);
+                    return std::string();
+                });
+                for (size_t analysis = 1; analysis < fused.size(); analysis++) {
+                    m_timings.push_back({ .name = fused[analysis], .kind = kind_name(Pass::Kind::analysis),
+                                          .note = "fused into " + fused.front() });
+                }
+            }
+
+            return analyses;
+        }
+
+        // Generates the program with the codegen passes that are turned on, then runs the assembly passes over it
+        [[nodiscard]] std::string generate(const Node::Program &program, CodeGenOptions options, Analyses analyses) {
+            options.optimizations = {
+                .hoist_invariants = enabled("hoist-invariants"),
+                .strength_reduction = enabled("strength-reduce"),
+                .if_conversion = enabled("if-convert"),
+                .align_loops = enabled("align-loops"),
+            };
+            options.inliner = std::move(analyses.inliner);
+            for (const Pass &pass : registry()) {
+                if (pass.kind == Pass::Kind::codegen && pass.name != "codegen" && enabled(pass.name)) {
+                    m_timings.push_back({ .name = pass.name, .kind = kind_name(pass.kind), .note = "in codegen" });
+                }
+            }
+
+            std::string assembly;
+            time("codegen", Pass::Kind::codegen, [&]() {
+                // The parser has checked every variable is declared before it is used, and the generator declares
+                // each one again as it comes to it, so it needs none of the parser's
+                CodeGenerator generator(program, Variables{}, std::move(options));
+                assembly = generator.generate_program();
+                return std::string();
+            });
+            if (enabled("peephole")) {
+                time("peephole", Pass::Kind::assembly, [&]() {
+                    size_t rewrites = 0;
+                    assembly = Peephole::run(assembly, rewrites);
+                    return "pushes folded into pops: " + std::to_string(rewrites);
+                });
+            }
+
+            return assembly;
+        }
+
+        [[nodiscard]] const std::vector<PassTiming>& timings() const {
+            return m_timings;
+        }
+
+    private:
+        OptLevel m_level;
+        std::set<std::string> m_enabled;
+        std::vector<PassTiming> m_timings;
+
+        static size_t index(const std::string &pass_name) {
+            const std::vector<Pass> &passes = registry();
+            auto pass = std::find_if(passes.begin(), passes.end(), [&](const Pass &candidate) { return candidate.name == pass_name; });
+            if (pass == passes.end()) {
+                throw std::logic_error("no pass named '" + pass_name + "'");
+            }
+
+            return static_cast<size_t>(pass - passes.begin());
+        }
+
+        static std::string kind_name(Pass::Kind kind) {
+            switch (kind) {
+                case Pass::Kind::transform:
+                    return "transform";
+                case Pass::Kind::analysis:
+                    return "analysis";
+                case Pass::Kind::codegen:
+                    return "codegen";
+                case Pass::Kind::assembly:
+                    return "assembly";
+            }
+
+            return "";
+        }
+
+        [[nodiscard]] InlinePolicy inline_policy() const {
+            return m_level == OptLevel::Os ? InlinePolicy::size : InlinePolicy::speed;
+        }
+
+        // Runs a pass and records how long it took, with whatever it says about what it did
+        template <typename Body> void time(const std::string &pass_name, Pass::Kind kind, Body body) {
+            auto start = std::chrono::steady_clock::now();
+            std::string note = body();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            m_timings.push_back({ .name = pass_name, .kind = kind_name(kind), .milliseconds = elapsed.count(), .note = std::move(note) });
+        }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+
+// Rewrites the generated assembly a pair of adjacent lines at a time. The code generator is a stack machine that
+// pushes every value it computes, and more often than not the very next instruction pops it again. A push straight
+// into a pop is a move, or nothing at all when both name the same register. Labels, directives and line markers
+// are never part of a pair, so nothing that jumps into the code can tell the difference
+class Peephole {
+    public:
+        [[nodiscard]] static std::string run(std::string_view assembly, size_t &rewrites) {
+            std::string output;
+            output.reserve(assembly.size());
+            std::string_view pending; // A push that is held back to see what follows it
+            while (!assembly.empty()) {
+                const size_t end = assembly.find('\n');
+                const std::string_view line = assembly.substr(0, end == std::string_view::npos ? assembly.size() : end + 1);
+                assembly.remove_prefix(line.size());
+
+                if (!pending.empty()) {
+                    if (auto move = fold(operand(pending, "\tpush "), operand(line, "\tpop "))) {
+                        output += move.value();
+                        pending = {};
+                        rewrites++;
+                        continue;
+                    }
+                    output += pending;
+                    pending = {};
+                }
+                if (!operand(line, "\tpush ").empty()) {
+                    pending = line;
+                    continue;
+                }
+                output += line;
+            }
+            output += pending;
+
+            return output;
+        }
+
+    private:
+        // What follows the instruction on its line, or nothing when the line is some other instruction
+        static std::string_view operand(std::string_view line, std::string_view instruction) {
+            if (!line.starts_with(instruction) || !line.ends_with('\n')) {
+                return {};
+            }
+            line.remove_prefix(instruction.size());
+            line.remove_suffix(1);
+
+            return line;
+        }
+
+        static bool is_register(std::string_view operand) {
+            return !operand.empty() && operand.find_first_of("[ ,") == std::string_view::npos
+                   && operand.front() >= 'a' && operand.front() <= 'z';
+        }
+
+        static bool is_memory(std::string_view operand) {
+            return operand.starts_with("QWORD [") && operand.ends_with(']');
+        }
+
+        // A push reads a memory operand before it moves rsp down, and a pop writes one after it has moved rsp back
+        // up, so either addresses the same memory the move does with rsp where it was
+        static std::optional<std::string> fold(std::string_view pushed, std::string_view popped) {
+            if (pushed.empty() || popped.empty()) {
+                return {};
+            }
+            if (is_register(pushed) && pushed == popped) {
+                return "";
+            }
+            if ((is_register(pushed) && (is_register(popped) || is_memory(popped))) || (is_memory(pushed) && is_register(popped))) {
+                return "\tmov " + std::string(popped) + ", " + std::string(pushed) + "\n";
+            }
+
+            return {};
+        }
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <variant>
+#include <optional>
+
+#include "parser.hpp"
+#include "astwalk.hpp"
+
+
+// How often each block of a program ran: every arm of an if chain, including the arm a chain without an else
+// takes when none of its conditions hold, and every loop body. Blocks are numbered in source order, so a
+// profile only fits the exact source it was generated from, which the source hash in its header checks
+//
+// The file a -fprofile-generate build writes at _exit is the magic, the source hash and the number of counters,
+// followed by the counters themselves, all as little endian 64 bit values
+class Profile {
+    public:
+        inline static const std::string magic = "CERPROF1";
+        static constexpr size_t header_size = 24;
+
+        // The blocks are numbered by the traversal hooks() is given to, which other analyses can share
+        Profile() = default;
+
+        // A profile that walks the program by itself to number its blocks
+        static Profile analyze(const Node::Program &program) {
+            Profile profile;
+            Walk::program(program, { profile.hooks() });
+
+            return profile;
+        }
+
+        // Only good for one traversal, the hooks hold on to the profile
+        [[nodiscard]] Walk::Hooks hooks() {
+            return {
+                .statement = [this](const Node::Statement *statement) {
+                    if (auto if_statement = std::get_if<Node::StmtIf*>(&statement->var)) {
+                        Walk::if_arms(*if_statement, [&](const Node::Scope *scope) {
+                            add_block(scope);
+                        });
+                        if (!has_else(*if_statement)) {
+                            add_block(*if_statement);
+                        }
+                    }
+                    else if (auto while_statement = std::get_if<Node::StmtWhile*>(&statement->var)) {
+                        add_block((*while_statement)->scope);
+                    }
+                    else if (auto for_statement = std::get_if<Node::StmtFor*>(&statement->var)) {
+                        add_block((*for_statement)->scope);
+                    }
+                },
+            };
+        }
+
+        // Blocks are the scope of an arm or loop body, or the if statement itself for the implicit arm
+        [[nodiscard]] std::optional<size_t> counter(const void *block) const {
+            auto iterator = m_counters.find(block);
+            if (iterator == m_counters.end()) {
+                return {};
+            }
+
+            return iterator->second;
+        }
+
+        [[nodiscard]] size_t counters() const {
+            return m_counters.size();
+        }
+
+        [[nodiscard]] bool has_counts() const {
+            return !m_counts.empty();
+        }
+
+        [[nodiscard]] uint64_t count(const void *block) const {
+            std::optional<size_t> index = counter(block);
+            if (!index.has_value() || m_counts.empty()) {
+                return 0;
+            }
+
+            return m_counts[index.value()];
+        }
+
+        // Reads the counts a run of the instrumented program wrote, returns why they can't be used if they can't
+        [[nodiscard]] std::optional<std::string> load(const std::string &filename, uint64_t source_hash) {
+            std::ifstream file(filename, std::ios::binary);
+            if (!file.is_open()) {
+                return "failed to open the profile '" + filename + "'";
+            }
+
+            std::string file_magic(magic.size(), '\0');
+            uint64_t file_hash = 0;
+            uint64_t file_counters = 0;
+            file.read(file_magic.data(), static_cast<std::streamsize>(file_magic.size()));
+            file.read(reinterpret_cast<char*>(&file_hash), sizeof(file_hash));
+            file.read(reinterpret_cast<char*>(&file_counters), sizeof(file_counters));
+            if (!file || file_magic != magic) {
+                return "'" + filename + "' is not a profile";
+            }
+            if (file_hash != source_hash || file_counters != m_counters.size()) {
+                return "the profile '" + filename + "' was generated from a different version of the source";
+            }
+
+            std::vector<uint64_t> counts(file_counters);
+            file.read(reinterpret_cast<char*>(counts.data()), static_cast<std::streamsize>(counts.size() * sizeof(uint64_t)));
+            if (!file) {
+                return "the profile '" + filename + "' is truncated";
+            }
+            m_counts = std::move(counts);
+
+            return {};
+        }
+
+        // 64 bit FNV-1a
+        static uint64_t hash(const std::string &source) {
+            uint64_t hash = 0xcbf29ce484222325;
+            for (unsigned char character : source) {
+                hash ^= character;
+                hash *= 0x100000001b3;
+            }
+
+            return hash;
+        }
+
+        static bool has_else(const Node::StmtIf *if_statement) {
+            std::optional<Node::StmtIfNext*> next = if_statement->next;
+            while (next.has_value()) {
+                auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var);
+                if (elif_statement == nullptr) {
+                    return true;
+                }
+                next = (*elif_statement)->next;
+            }
+
+            return false;
+        }
+
+    private:
+        std::map<const void*, size_t> m_counters;
+        std::vector<uint64_t> m_counts;
+
+        void add_block(const void *block) {
+            m_counters.emplace(block, m_counters.size());
+        }
+};
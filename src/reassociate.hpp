@@ -0,0 +1,441 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <variant>
+#include <optional>
+#include <algorithm>
+#include <type_traits>
+
+#include "parser.hpp"
+
+
+// Rebuilds chains of one associative and commutative operator, like a + b + c + d, which the parser leaves left
+// deep, into balanced trees, so the operations that don't depend on each other can run at the same time. Runs of
+// fewer operands stay left deep, where every right operand is a single load. The literals of a chain are folded
+// into one that goes last, at the top, where it becomes an immediate. The other operands keep their order, so
+// calls still happen in the order they are written.
+//
+// Adds and multiplies of narrow operands run at 32 bits and are truncated at every step, so a chain is only
+// rebuilt when no regrouping can change the width any step runs at: when every operand is narrow or a literal,
+// or when none of them is narrow. Bitwise operations always run at 64 bits, so their chains always are.
+//
+// The tree is rewritten in place, reusing the chain's own nodes, so nothing is allocated
+class Reassociation {
+    public:
+        explicit Reassociation(const Node::Program &program) {
+            for (const Node::Function *function : program.functions) {
+                m_return_types[function->identifier.value.value()] = function->return_type.has_value()
+                                                                     ? function->return_type.value().type : TokenType::int64;
+            }
+
+            m_types.emplace_back();
+            statements(program.statements);
+            for (const Node::Function *function : program.functions) {
+                m_types = { {} };
+                for (const Node::Parameter &parameter : function->params) {
+                    m_types.back()[parameter.identifier.value.value()] = parameter.type.type;
+                }
+                scope(function->scope);
+            }
+        }
+
+        // Chains that were rebuilt
+        [[nodiscard]] size_t chains() const {
+            return m_chains;
+        }
+
+    private:
+        // Width of an operand that isn't known, which keeps its chain as it is
+        static constexpr int unknown_width = -1;
+        // Fewer operands than this gain nothing from balancing, the generator is a stack machine and a subtree on
+        // the right costs more moves than the operations it lets overlap save
+        static constexpr size_t min_balanced_operands = 4;
+
+        std::vector<std::map<std::string, TokenType>> m_types; // Innermost scope last
+        std::map<std::string, TokenType> m_return_types;
+        size_t m_chains = 0;
+
+        void statements(const std::vector<Node::Statement*> &statement_list) {
+            for (Node::Statement *statement_node : statement_list) {
+                statement(statement_node);
+            }
+        }
+
+        void scope(const Node::Scope *scope_node) {
+            m_types.emplace_back();
+            statements(scope_node->stmts);
+            m_types.pop_back();
+        }
+
+        void statement(Node::Statement *statement_node) {
+            struct StatementVisitor {
+                Reassociation &pass;
+
+                void operator() (Node::StmtExit *exit_statement) const {
+                    pass.expression(exit_statement->expr);
+                }
+
+                void operator() (Node::StmtPrint *print_statement) const {
+                    pass.expression(print_statement->expr);
+                }
+
+                void operator() (Node::StmtMut *mut_statement) const {
+                    if (mut_statement->expr.has_value()) {
+                        pass.expression(mut_statement->expr.value());
+                    }
+                    pass.m_types.back()[mut_statement->identifier.value.value()] = mut_statement->type.type;
+                }
+
+                void operator() (Node::StmtIdent *identifier_statement) const {
+                    pass.expression(identifier_statement->expr);
+                }
+
+                void operator() (Node::StmtIndex *index_statement) const {
+                    pass.expression(index_statement->index);
+                    pass.expression(index_statement->expr);
+                }
+
+                // Array expressions are not values, and run elementwise at the width of the array
+                void operator() (Node::StmtArray*) const {}
+
+                void operator() (Node::StmtCall *call_statement) const {
+                    for (Node::Expression *argument : call_statement->call->args) {
+                        pass.expression(argument);
+                    }
+                }
+
+                void operator() (Node::StmtReturn *return_statement) const {
+                    if (return_statement->expr.has_value()) {
+                        pass.expression(return_statement->expr.value());
+                    }
+                }
+
+                void operator() (Node::Scope *scope_node) const {
+                    pass.scope(scope_node);
+                }
+
+                void operator() (Node::StmtProfile *profile_statement) const {
+                    pass.scope(profile_statement->scope);
+                }
+
+                void operator() (Node::StmtParallel *parallel_statement) const {
+                    pass.expression(parallel_statement->count);
+                    pass.scope(parallel_statement->scope);
+                }
+
+                void operator() (Node::StmtIf *if_statement) const {
+                    pass.expression(if_statement->expr);
+                    pass.scope(if_statement->scope);
+                    std::optional<Node::StmtIfNext*> next = if_statement->next;
+                    while (next.has_value()) {
+                        if (auto elif_statement = std::get_if<Node::StmtElif*>(&next.value()->var)) {
+                            pass.expression((*elif_statement)->expr);
+                            pass.scope((*elif_statement)->scope);
+                            next = (*elif_statement)->next;
+                        }
+                        else {
+                            pass.scope(std::get<Node::StmtElse*>(next.value()->var)->scope);
+                            next = {};
+                        }
+                    }
+                }
+
+                void operator() (Node::StmtWhile *while_statement) const {
+                    pass.expression(while_statement->expr);
+                    pass.scope(while_statement->scope);
+                }
+
+                // The loop variable lives in a scope around the body
+                void operator() (Node::StmtFor *for_statement) const {
+                    pass.m_types.emplace_back();
+                    if (for_statement->init.has_value()) {
+                        pass.statement(for_statement->init.value());
+                    }
+                    if (for_statement->expr.has_value()) {
+                        pass.expression(for_statement->expr.value());
+                    }
+                    if (for_statement->step.has_value()) {
+                        pass.expression(for_statement->step.value()->expr);
+                    }
+                    pass.scope(for_statement->scope);
+                    pass.m_types.pop_back();
+                }
+            };
+
+            std::visit(StatementVisitor{ .pass = *this }, statement_node->var);
+        }
+
+        void expression(Node::Expression *expression_node) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression_node->var)) {
+                std::visit([&](auto *operation) {
+                    using Operation = std::remove_cvref_t<decltype(*operation)>;
+                    if constexpr (is_reassociable<Operation>) {
+                        chain<Operation>(expression_node);
+                    }
+                    else {
+                        expression(operation->left_side);
+                        expression(operation->right_side);
+                    }
+                }, (*binary_expression)->bin_expr);
+                return;
+            }
+
+            Node::Term *term = std::get<Node::Term*>(expression_node->var);
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&term->var)) {
+                expression((*expression_term)->expr);
+            }
+            else if (auto index_term = std::get_if<Node::TermIndex*>(&term->var)) {
+                expression((*index_term)->index);
+            }
+            else if (auto bit_not = std::get_if<Node::BitNot*>(&term->var)) {
+                expression((*bit_not)->expr);
+            }
+            else if (auto call_term = std::get_if<Node::TermCall*>(&term->var)) {
+                for (Node::Expression *argument : (*call_term)->args) {
+                    expression(argument);
+                }
+            }
+            else if (auto builtin_term = std::get_if<Node::TermBuiltin*>(&term->var)) {
+                for (Node::Expression *argument : (*builtin_term)->args) {
+                    expression(argument);
+                }
+            }
+        }
+
+        template <typename Operation> static constexpr bool is_reassociable =
+            std::is_same_v<Operation, Node::BinAdd> || std::is_same_v<Operation, Node::BinMultiply>
+            || std::is_same_v<Operation, Node::BitAnd> || std::is_same_v<Operation, Node::BitOr>
+            || std::is_same_v<Operation, Node::BitXor>;
+
+        template <typename Operation> static constexpr bool is_bitwise =
+            std::is_same_v<Operation, Node::BitAnd> || std::is_same_v<Operation, Node::BitOr>
+            || std::is_same_v<Operation, Node::BitXor>;
+
+        // The operation at the top of an expression, looking through parentheses, when it is the one given
+        template <typename Operation> static Operation* as_operation(const Node::Expression *expression_node) {
+            if (auto term = std::get_if<Node::Term*>(&expression_node->var)) {
+                if (auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var)) {
+                    return as_operation<Operation>((*expression_term)->expr);
+                }
+                return nullptr;
+            }
+            auto operation = std::get_if<Operation*>(&std::get<Node::BinExpr*>(expression_node->var)->bin_expr);
+
+            return operation != nullptr ? *operation : nullptr;
+        }
+
+        // The innermost expression of an operand written in parentheses, which is the node the chain reuses
+        static Node::Expression* unwrap(Node::Expression *expression_node) {
+            if (auto term = std::get_if<Node::Term*>(&expression_node->var)) {
+                if (auto expression_term = std::get_if<Node::TermExpr*>(&(*term)->var)) {
+                    return unwrap((*expression_term)->expr);
+                }
+            }
+
+            return expression_node;
+        }
+
+        // Collects the operands of a chain from left to right, and the nodes of the operation itself, top first
+        template <typename Operation> static void flatten(Node::Expression *expression_node, std::vector<Node::Expression*> &operands,
+                                                          std::vector<Node::Expression*> &nodes) {
+            Operation *operation = as_operation<Operation>(expression_node);
+            if (operation == nullptr) {
+                operands.push_back(expression_node);
+                return;
+            }
+            nodes.push_back(unwrap(expression_node));
+            flatten<Operation>(operation->left_side, operands, nodes);
+            flatten<Operation>(operation->right_side, operands, nodes);
+        }
+
+        static std::optional<int64_t> literal(const Node::Expression *expression_node) {
+            if (auto term = std::get_if<Node::Term*>(&expression_node->var)) {
+                if (auto int_term = std::get_if<Node::TermInt*>(&(*term)->var)) {
+                    return (*int_term)->int_lit.int_value;
+                }
+            }
+
+            return {};
+        }
+
+        template <typename Operation> static int64_t fold(int64_t left, int64_t right) {
+            const auto left_bits = static_cast<uint64_t>(left);
+            const auto right_bits = static_cast<uint64_t>(right);
+            if constexpr (std::is_same_v<Operation, Node::BinAdd>) {
+                return static_cast<int64_t>(left_bits + right_bits);
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BinMultiply>) {
+                return static_cast<int64_t>(left_bits * right_bits);
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BitAnd>) {
+                return left & right;
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BitOr>) {
+                return left | right;
+            }
+            else {
+                return left ^ right;
+            }
+        }
+
+        template <typename Operation> static int64_t identity() {
+            if constexpr (std::is_same_v<Operation, Node::BinMultiply>) {
+                return 1;
+            }
+            else if constexpr (std::is_same_v<Operation, Node::BitAnd>) {
+                return -1;
+            }
+
+            return 0;
+        }
+
+        template <typename Operation> void chain(Node::Expression *root) {
+            std::vector<Node::Expression*> operands;
+            std::vector<Node::Expression*> nodes;
+            flatten<Operation>(root, operands, nodes);
+            for (Node::Expression *operand : operands) {
+                expression(operand);
+            }
+
+            int chain_width = 0;
+            bool narrow = false;
+            std::vector<Node::Expression*> leaves;
+            std::vector<Node::Expression*> literals;
+            for (Node::Expression *operand : operands) {
+                const int operand_width = width(operand);
+                if (operand_width == unknown_width) {
+                    return;
+                }
+                chain_width = std::max(chain_width, operand_width);
+                narrow = narrow || operand_width == 32;
+                (literal(operand).has_value() ? literals : leaves).push_back(operand);
+            }
+            if (!is_bitwise<Operation> && narrow && chain_width == 64) {
+                return;
+            }
+            const bool literal_last = literals.size() == 1 && operands.back() == literals.front();
+            if (leaves.size() < min_balanced_operands && (literals.empty() || literal_last)) {
+                return;
+            }
+
+            std::optional<Node::Expression*> folded;
+            if (!literals.empty()) {
+                int64_t value = literal(literals.front()).value();
+                for (size_t index = 1; index < literals.size(); index++) {
+                    value = fold<Operation>(value, literal(literals[index]).value());
+                }
+                // A chain that runs at 32 bits only ever keeps the low half, and a literal past 32 bits would
+                // widen it
+                if (!is_bitwise<Operation> && chain_width == 32) {
+                    value = static_cast<int32_t>(static_cast<uint32_t>(value));
+                }
+                int rebuilt_width = value <= INT32_MAX ? 0 : 64;
+                for (const Node::Expression *leaf : leaves) {
+                    rebuilt_width = std::max(rebuilt_width, width(leaf));
+                }
+                // The chain's width decides the width of whatever it is part of, so it has to stay the same
+                if (rebuilt_width != chain_width) {
+                    return;
+                }
+                if (value != identity<Operation>() || leaves.empty()) {
+                    Node::TermInt *int_term = std::get<Node::TermInt*>(std::get<Node::Term*>(literals.front()->var)->var);
+                    int_term->int_lit.int_value = value;
+                    int_term->int_lit.value = std::to_string(value);
+                    folded = literals.front();
+                }
+            }
+
+            m_chains++;
+            if (leaves.empty() || (leaves.size() == 1 && !folded.has_value())) {
+                root->var = (leaves.empty() ? folded.value() : leaves.front())->var;
+                return;
+            }
+            size_t next_node = 0;
+            if (!folded.has_value()) {
+                build<Operation>(leaves, 0, leaves.size(), nodes, next_node);
+                return;
+            }
+            Operation *top = std::get<Operation*>(std::get<Node::BinExpr*>(nodes[next_node++]->var)->bin_expr);
+            top->left_side = build<Operation>(leaves, 0, leaves.size(), nodes, next_node);
+            top->right_side = folded.value();
+        }
+
+        // Builds the leaves from begin to end into a tree out of the chain's nodes, the top one first so whatever
+        // refers to the chain still does. Runs long enough are split in half, shorter ones are built left deep
+        template <typename Operation> Node::Expression* build(const std::vector<Node::Expression*> &leaves, size_t begin, size_t end,
+                                                              const std::vector<Node::Expression*> &nodes, size_t &next_node) {
+            if (end - begin == 1) {
+                return leaves[begin];
+            }
+            Node::Expression *node = nodes[next_node++];
+            Operation *operation = std::get<Operation*>(std::get<Node::BinExpr*>(node->var)->bin_expr);
+            const size_t middle = end - begin >= min_balanced_operands ? begin + (end - begin) / 2 : end - 1;
+            operation->left_side = build<Operation>(leaves, begin, middle, nodes, next_node);
+            operation->right_side = build<Operation>(leaves, middle, end, nodes, next_node);
+
+            return node;
+        }
+
+        // The width the code generator evaluates an expression at, 0 for a literal that takes the width around it
+        int width(const Node::Expression *expression_node) const {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression_node->var)) {
+                return std::visit([&](const auto *operation) {
+                    using Operation = std::remove_cvref_t<decltype(*operation)>;
+                    if constexpr (std::is_same_v<Operation, Node::CmpEqual> || std::is_same_v<Operation, Node::CmpNotEqual>
+                                  || std::is_same_v<Operation, Node::CmpLess> || std::is_same_v<Operation, Node::CmpLessEqual>
+                                  || std::is_same_v<Operation, Node::CmpGreater> || std::is_same_v<Operation, Node::CmpGreaterEqual>
+                                  || std::is_same_v<Operation, Node::LogicAnd> || std::is_same_v<Operation, Node::LogicOr>) {
+                        return 32;
+                    }
+                    else if constexpr (std::is_same_v<Operation, Node::ShiftLeft> || std::is_same_v<Operation, Node::ShiftRight>) {
+                        return width(operation->left_side);
+                    }
+                    else {
+                        const int left = width(operation->left_side);
+                        const int right = width(operation->right_side);
+                        return left == unknown_width || right == unknown_width ? unknown_width : std::max(left, right);
+                    }
+                }, (*binary_expression)->bin_expr);
+            }
+
+            const Node::Term *term = std::get<Node::Term*>(expression_node->var);
+            if (auto int_term = std::get_if<Node::TermInt*>(&term->var)) {
+                return (*int_term)->int_lit.int_value <= INT32_MAX ? 0 : 64;
+            }
+            if (auto identifier_term = std::get_if<Node::TermIdent*>(&term->var)) {
+                return variable_width((*identifier_term)->identifier.value.value());
+            }
+            if (auto index_term = std::get_if<Node::TermIndex*>(&term->var)) {
+                return variable_width((*index_term)->identifier.value.value());
+            }
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&term->var)) {
+                return width((*expression_term)->expr);
+            }
+            if (auto bit_not = std::get_if<Node::BitNot*>(&term->var)) {
+                return width((*bit_not)->expr);
+            }
+            if (auto call_term = std::get_if<Node::TermCall*>(&term->var)) {
+                auto return_type = m_return_types.find((*call_term)->identifier.value.value());
+                if (return_type == m_return_types.end()) {
+                    return unknown_width;
+                }
+                return return_type->second == TokenType::int64 ? 64 : 32;
+            }
+
+            // Booleans and builtins
+            return 32;
+        }
+
+        int variable_width(const std::string &name) const {
+            for (auto scope_types = m_types.rbegin(); scope_types != m_types.rend(); scope_types++) {
+                if (auto type = scope_types->find(name); type != scope_types->end()) {
+                    return type->second == TokenType::int64 ? 64 : 32;
+                }
+            }
+
+            return unknown_width;
+        }
+};
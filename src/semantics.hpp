@@ -0,0 +1,317 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#include "ast.hpp"
+#include "token.hpp"
+#include "varaibles.hpp"
+
+
+// The rules a program follows beyond its grammar: names are declared before they are used and only once in a
+// scope, arrays and values are each used as such, calls pass as many arguments as the function takes, arrays fit
+// the stack, and return and worker() only appear where they mean something. The parser checks a program against
+// them as it reads the tokens, and the binary AST reader checks the tree it reads from a file, which cer may not
+// have written. Both go through here, so they can't disagree on what a program is.
+//
+// Whoever uses it keeps it told of the scopes, functions and parallel blocks it goes in and out of, in the order
+// they appear in the source. Every problem goes to the report function with the token it is about, and the keyword
+// when that token is one
+class Semantics {
+    public:
+        using Report = std::function<void(const std::string &message, const Token &token, const std::optional<std::string> &keyword)>;
+
+        // Builtins and how many arguments they take
+        inline static const std::map<std::string, size_t> builtins = { { "popcount", 1 }, { "clz", 1 }, { "worker", 0 } };
+
+        // Registers a whole array expression may need, one per level of nesting
+        static constexpr size_t max_array_expression_depth = 8;
+        // Arrays live in the stack frame, and stacks are 8 MiB, the main one by default and those of parallel
+        // workers always. The arrays of a function, or of the top level, get half of that
+        static constexpr uint64_t max_frame_array_bytes = 4 * 1024 * 1024;
+
+        explicit Semantics(Report report) : m_report(std::move(report)) {}
+
+        void begin_scope() {
+            m_variables.scope_push({});
+            m_current_scope++;
+        }
+
+        void end_scope() {
+            for (const std::string &identifier : m_variables.get_top()) {
+                m_variables.delete_variable(identifier);
+            }
+            m_variables.scope_pop();
+            m_current_scope--;
+        }
+
+        [[nodiscard]] bool is_declared(const std::string &identifier) {
+            return m_variables.exists(identifier, m_current_scope);
+        }
+
+        // The variable a name refers to here, nullptr when there is none
+        [[nodiscard]] const Variable* variable(const std::string &identifier) {
+            if (!is_declared(identifier)) {
+                return nullptr;
+            }
+
+            return &m_variables.get_variable(identifier, m_current_scope)->second;
+        }
+
+        [[nodiscard]] bool is_array(const std::string &identifier) {
+            const Variable *declared = variable(identifier);
+            return declared != nullptr && declared->length != 0;
+        }
+
+        [[nodiscard]] const Variables& variables() const {
+            return m_variables;
+        }
+
+        // Makes the function callable, from anywhere after this
+        void declare_function(const Node::Function *function) {
+            const std::string &identifier = function->identifier.value.value();
+            if (builtins.contains(identifier)) {
+                report("function name is reserved for a builtin", function->identifier);
+            }
+            else if (m_functions.contains(identifier)) {
+                report("multiple definitions of function", function->identifier);
+            }
+            else {
+                m_functions[identifier] = function;
+            }
+        }
+
+        // Functions only see their own parameters and locals, never the variables of the code around them
+        void begin_function(const Node::Function *function) {
+            m_outer_variables = std::exchange(m_variables, Variables{});
+            m_outer_scope = std::exchange(m_current_scope, 0);
+            m_outer_array_bytes = std::exchange(m_array_bytes, 0);
+            m_function = function;
+            begin_scope();
+        }
+
+        void end_function() {
+            end_scope();
+            m_function = nullptr;
+            m_variables = std::move(m_outer_variables);
+            m_current_scope = m_outer_scope;
+            m_array_bytes = m_outer_array_bytes;
+        }
+
+        void declare_parameter(const Token &identifier) {
+            if (m_variables.is_valid(identifier.value.value(), m_current_scope)) {
+                m_variables.declare_variable(identifier.value.value(), m_current_scope);
+            }
+            else {
+                report("multiple definitions of parameter", identifier);
+            }
+        }
+
+        // Whether a variable of the name can be declared in this scope, which it can't twice
+        bool can_declare(const Token &identifier) {
+            if (!m_variables.is_valid(identifier.value.value(), m_current_scope)) {
+                report("multiple definitions of identifier", identifier);
+                return false;
+            }
+
+            return true;
+        }
+
+        void declare(const Token &identifier, TokenType type, size_t length) {
+            m_variables.declare_variable(identifier.value.value(), m_current_scope, type, length);
+        }
+
+        // The length of an array, when it has one it can have
+        std::optional<size_t> array_length(const Token &identifier, TokenType type, uint64_t length) {
+            if (length == 0) {
+                report("array length must be at least 1", identifier);
+                return {};
+            }
+            if (type == TokenType::boolean) {
+                report("arrays can only hold int16, int32 or int64", identifier);
+            }
+            // Saturates rather than overflows, whatever is past the budget is as bad as anything else past it
+            const uint64_t bytes = std::min(length, max_frame_array_bytes + 1) * type_size(type);
+            m_array_bytes = std::min(m_array_bytes + bytes, max_frame_array_bytes + 1);
+            if (m_array_bytes > max_frame_array_bytes) {
+                report("arrays take more than the 4 MiB of stack a function or the top level may use", identifier);
+                return {};
+            }
+
+            return static_cast<size_t>(length);
+        }
+
+        void array_initializer(const Token &identifier) {
+            report("arrays are zero initialized and can't have an initializer", identifier);
+        }
+
+        // A name used as an operand, which is an array exactly when it is in an array expression
+        void value(const Token &identifier, bool array_expression) {
+            const Variable *declared = variable(identifier.value.value());
+            if (declared == nullptr) {
+                report("identifier not declared in this scope", identifier);
+            }
+            else if (declared->length != 0 && !array_expression) {
+                report("array used as a value, index it to use an element", identifier);
+            }
+            else if (declared->length == 0 && array_expression) {
+                report("only arrays can be used in an array expression", identifier);
+            }
+        }
+
+        void assignment(const Token &identifier) {
+            const Variable *declared = variable(identifier.value.value());
+            if (declared == nullptr) {
+                report("identifier not declared in this scope", identifier);
+            }
+            else if (declared->length != 0) {
+                report("arrays can't be assigned here", identifier);
+            }
+        }
+
+        // An element of an array, with the index when there is one to check
+        void index(const Token &identifier, const Node::Expression *index, bool array_expression) {
+            const Variable *declared = variable(identifier.value.value());
+            if (declared == nullptr) {
+                report("identifier not declared in this scope", identifier);
+            }
+            else if (declared->length == 0) {
+                report("subscripted value is not an array", identifier);
+            }
+            else if (array_expression) {
+                report("array elements can't be used in an array expression", identifier);
+            }
+            else if (index != nullptr) {
+                // Constant indices are checked here, the rest are not checked at all
+                auto term = std::get_if<Node::Term*>(&index->var);
+                auto int_term = term != nullptr ? std::get_if<Node::TermInt*>(&(*term)->var) : nullptr;
+                if (int_term != nullptr && static_cast<uint64_t>((*int_term)->int_lit.int_value) >= declared->length) {
+                    report("array index out of bounds", identifier);
+                }
+            }
+        }
+
+        // The whole expression assigned to an array, whose names were already checked one by one
+        void array_expression(const Node::Expression *expression, const Token &target) {
+            const Variable *declared = variable(target.value.value());
+            if (declared != nullptr && array_expression_depth(expression, *declared, target) > max_array_expression_depth) {
+                report("array expression is nested too deeply", target);
+            }
+        }
+
+        void call(const Token &identifier, size_t arguments) {
+            auto iterator = m_functions.find(identifier.value.value());
+            if (iterator == m_functions.end()) {
+                report("function not declared", identifier);
+            }
+            else if (iterator->second->params.size() != arguments) {
+                report("wrong number of arguments to function", identifier);
+            }
+        }
+
+        // A call whose value is used
+        void call_value(const Token &identifier) {
+            auto iterator = m_functions.find(identifier.value.value());
+            if (iterator != m_functions.end() && !iterator->second->return_type.has_value()) {
+                report("function does not return a value", identifier);
+            }
+        }
+
+        void builtin(const Token &identifier, size_t arguments) {
+            auto builtin = builtins.find(identifier.value.value());
+            if (builtin == builtins.end()) {
+                report("not a builtin", identifier);
+            }
+            else if (builtin->second != arguments) {
+                report("wrong number of arguments to builtin", identifier);
+            }
+            if (identifier.value.value() == "worker" && !m_parallel) {
+                report("worker() outside of a parallel block", identifier);
+            }
+        }
+
+        void return_statement(const Token &keyword, bool has_value) {
+            if (m_function == nullptr) {
+                report("return statement outside of a function", keyword, "return");
+            }
+            else if (m_parallel) {
+                report("return statement inside a parallel block", keyword, "return");
+            }
+            else if (m_function->return_type.has_value() && !has_value) {
+                report("return statement without a value in a function with a return type", keyword, "return");
+            }
+            else if (!m_function->return_type.has_value() && has_value) {
+                report("return statement with a value in a function without a return type", keyword, "return");
+            }
+        }
+
+        // Around the scope of a parallel block, after its count. Returns whether there already was one around it
+        bool begin_parallel(const Token &keyword) {
+            if (m_parallel) {
+                report("parallel blocks can't be nested", keyword, "parallel");
+            }
+
+            return std::exchange(m_parallel, true);
+        }
+
+        void end_parallel(bool outer_parallel) {
+            m_parallel = outer_parallel;
+        }
+
+    private:
+        Report m_report;
+        Variables m_variables;
+        int m_current_scope = 0;
+        std::map<std::string, const Node::Function*> m_functions;
+        const Node::Function *m_function = nullptr; // Whose body is being checked, nullptr at the top level
+        bool m_parallel = false; // Inside the scope of a parallel block
+        uint64_t m_array_bytes = 0; // Of every array in the function, or at the top level, so far
+        Variables m_outer_variables; // Of the top level, while a function is checked
+        int m_outer_scope = 0;
+        uint64_t m_outer_array_bytes = 0;
+
+        void report(const std::string &message, const Token &token, const std::optional<std::string> &keyword = {}) {
+            m_report(message, token, keyword);
+        }
+
+        // Checks that an array expression only combines arrays shaped like the target with operators that work
+        // elementwise, and returns how many registers evaluating it takes
+        size_t array_expression_depth(const Node::Expression *expression, const Variable &target, const Token &identifier) {
+            if (auto binary_expression = std::get_if<Node::BinExpr*>(&expression->var)) {
+                return std::visit([&](const auto *operation) -> size_t {
+                    using Operation = std::remove_cvref_t<decltype(*operation)>;
+                    if constexpr (!std::is_same_v<Operation, Node::BinAdd> && !std::is_same_v<Operation, Node::BinSubtract>
+                                  && !std::is_same_v<Operation, Node::BitAnd> && !std::is_same_v<Operation, Node::BitOr>
+                                  && !std::is_same_v<Operation, Node::BitXor>) {
+                        report("only '+', '-', '&', '|' and '^' work on whole arrays", identifier);
+                    }
+                    return std::max(array_expression_depth(operation->left_side, target, identifier),
+                                    array_expression_depth(operation->right_side, target, identifier) + 1);
+                }, (*binary_expression)->bin_expr);
+            }
+
+            auto term = std::get<Node::Term*>(expression->var);
+            if (auto expression_term = std::get_if<Node::TermExpr*>(&term->var)) {
+                return array_expression_depth((*expression_term)->expr, target, identifier);
+            }
+            if (auto identifier_term = std::get_if<Node::TermIdent*>(&term->var)) {
+                // Undeclared names and scalars were already reported with the term
+                const Variable *operand = variable((*identifier_term)->identifier.value.value());
+                if (operand != nullptr && operand->length != 0 && (operand->length != target.length || operand->type != target.type)) {
+                    report("array expression mixes arrays of different lengths or types", (*identifier_term)->identifier);
+                }
+                return 1;
+            }
+            if (!std::holds_alternative<Node::TermIndex*>(term->var)) {
+                report("only arrays can be used in an array expression", identifier);
+            }
+
+            return 1;
+        }
+};
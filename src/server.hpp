@@ -0,0 +1,267 @@
+#pragma once
+
+#include <iostream>
+#include <streambuf>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <optional>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "driver.hpp"
+
+
+// cer --server runs cer commands for clients over a Unix socket, so a build that runs cer thousands of times only
+// starts one compiler. A client sends the directory it runs in and its arguments, each as a 32 bit length and the
+// bytes. The server answers with frames of a channel byte, a 32 bit length and the bytes, stdout and stderr as they
+// are written and the exit code last
+class CompileServer {
+    public:
+        static std::string default_socket() {
+            if (const char *path = std::getenv("CER_SERVER")) {
+                return path;
+            }
+
+            return "/tmp/cerium-" + std::to_string(getuid()) + ".sock";
+        }
+
+        // Serves until it is killed, one thread per client. The compiles share nothing but the heap and the spare
+        // parser arenas, which stay mapped from one compile to the next
+        static int serve(const std::string &path) {
+            sockaddr_un address{};
+            if (path.size() >= sizeof(address.sun_path)) {
+                std::cerr << "cer: error: socket path '" << path << "' is too long" << std::endl;
+                return 1;
+            }
+            if (int running = connect_to(path); running >= 0) {
+                close(running);
+                std::cerr << "cer: error: a server is already listening on '" << path << "'" << std::endl;
+                return 1;
+            }
+            // Whatever is left there is from a server that didn't get to clean up
+            unlink(path.c_str());
+
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+            int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            mode_t mask = umask(0077);
+            bool bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            umask(mask);
+            if (!bound || listen(listener, SOMAXCONN) != 0) {
+                std::cerr << "cer: error: can't listen on '" << path << "': " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+            std::cerr << "cer: listening on " << path << std::endl;
+
+            while (true) {
+                int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    std::cerr << "cer: error: accept failed: " << std::strerror(errno) << std::endl;
+                    return 1;
+                }
+                std::thread(handle, client).detach();
+            }
+        }
+
+        // Runs the command on the server and copies its output here, or returns nothing when there is no server to
+        // run it on, and the caller compiles it itself
+        static std::optional<int> forward(const std::string &path, int argc, const char *const *argv) {
+            int fd = connect_to(path);
+            if (fd < 0) {
+                return {};
+            }
+
+            bool sent = write_string(fd, std::filesystem::current_path().string());
+            const auto count = static_cast<uint32_t>(argc);
+            sent = sent && write_all(fd, &count, sizeof(count));
+            for (int arg = 0; arg < argc && sent; arg++) {
+                sent = write_string(fd, argv[arg]);
+            }
+
+            uint8_t channel = 0;
+            while (sent && read_all(fd, &channel, sizeof(channel))) {
+                std::optional<std::string> text = read_string(fd);
+                if (!text.has_value()) {
+                    break;
+                }
+                if (channel == Channel::status && text->size() == sizeof(int32_t)) {
+                    int32_t code = 0;
+                    std::memcpy(&code, text->data(), sizeof(code));
+                    close(fd);
+                    return code;
+                }
+                (channel == Channel::out ? std::cout : std::cerr) << text.value() << std::flush;
+            }
+            close(fd);
+            std::cerr << "cer: error: lost the connection to the server on '" << path << "'" << std::endl;
+
+            return 1;
+        }
+
+    private:
+        enum Channel : uint8_t {
+            status = 0,
+            out = 1,
+            err = 2,
+        };
+
+        static bool write_all(int fd, const void *data, size_t size) {
+            const auto *bytes = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+                if (written <= 0) {
+                    return false;
+                }
+                bytes += written;
+                size -= static_cast<size_t>(written);
+            }
+
+            return true;
+        }
+
+        static bool read_all(int fd, void *data, size_t size) {
+            auto *bytes = static_cast<char*>(data);
+            while (size > 0) {
+                ssize_t got = read(fd, bytes, size);
+                if (got <= 0) {
+                    return false;
+                }
+                bytes += got;
+                size -= static_cast<size_t>(got);
+            }
+
+            return true;
+        }
+
+        static bool write_string(int fd, const std::string &text) {
+            const auto length = static_cast<uint32_t>(text.size());
+            return write_all(fd, &length, sizeof(length)) && write_all(fd, text.data(), text.size());
+        }
+
+        static std::optional<std::string> read_string(int fd) {
+            uint32_t length = 0;
+            if (!read_all(fd, &length, sizeof(length))) {
+                return {};
+            }
+            std::string text(length, '\0');
+            if (!read_all(fd, text.data(), length)) {
+                return {};
+            }
+
+            return text;
+        }
+
+        static bool write_frame(int fd, Channel channel, const std::string &text) {
+            return write_all(fd, &channel, sizeof(channel)) && write_string(fd, text);
+        }
+
+        // An ostream buffer that sends what is written to it as frames, a line at a time when it is flushed with
+        // std::endl, so diagnostics reach the client while the compile is still going
+        class FrameBuffer : public std::streambuf {
+            public:
+                FrameBuffer(int fd, Channel channel) : m_fd(fd), m_channel(channel) {}
+
+            protected:
+                int_type overflow(int_type character) override {
+                    if (character != traits_type::eof()) {
+                        m_pending.push_back(traits_type::to_char_type(character));
+                    }
+                    if (m_pending.size() >= flush_size) {
+                        sync();
+                    }
+
+                    return traits_type::not_eof(character);
+                }
+
+                std::streamsize xsputn(const char *text, std::streamsize count) override {
+                    m_pending.append(text, static_cast<size_t>(count));
+                    if (m_pending.size() >= flush_size) {
+                        sync();
+                    }
+
+                    return count;
+                }
+
+                int sync() override {
+                    if (!m_pending.empty()) {
+                        write_frame(m_fd, m_channel, m_pending);
+                        m_pending.clear();
+                    }
+
+                    return 0;
+                }
+
+            private:
+                static constexpr size_t flush_size = 64 * 1024;
+
+                int m_fd;
+                Channel m_channel;
+                std::string m_pending;
+        };
+
+        static void handle(int client) {
+            std::optional<std::string> directory = read_string(client);
+            uint32_t argc = 0;
+            if (!directory.has_value() || !read_all(client, &argc, sizeof(argc))) {
+                close(client);
+                return;
+            }
+
+            std::vector<std::string> args;
+            for (uint32_t arg = 0; arg < argc; arg++) {
+                std::optional<std::string> text = read_string(client);
+                if (!text.has_value()) {
+                    close(client);
+                    return;
+                }
+                args.push_back(std::move(text.value()));
+            }
+            std::vector<const char*> argv;
+            for (const std::string &arg : args) {
+                argv.push_back(arg.c_str());
+            }
+            argv.push_back(nullptr);
+
+            FrameBuffer out_buffer(client, Channel::out);
+            FrameBuffer err_buffer(client, Channel::err);
+            std::ostream out(&out_buffer);
+            std::ostream err(&err_buffer);
+            int exit_code = drive(static_cast<int>(args.size()), argv.data(), directory.value(), out, err);
+            out.flush();
+            err.flush();
+
+            const auto code = static_cast<int32_t>(exit_code);
+            write_frame(client, Channel::status, std::string(reinterpret_cast<const char*>(&code), sizeof(code)));
+            close(client);
+        }
+
+        static int connect_to(const std::string &path) {
+            sockaddr_un address{};
+            if (path.size() >= sizeof(address.sun_path)) {
+                return -1;
+            }
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                return -1;
+            }
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                close(fd);
+                return -1;
+            }
+
+            return fd;
+        }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <variant>
+#include <optional>
+
+#include "parser.hpp"
+#include "astwalk.hpp"
+
+
+// The x86-64 microarchitecture levels, each one has everything the one before it has
+enum class TargetLevel {
+    x86_64 = 1, // SSE2
+    x86_64_v2,  // POPCNT, SSE4.2
+    x86_64_v3,  // AVX2, BMI1, BMI2, LZCNT
+    x86_64_v4,  // AVX-512, which nothing uses yet
+};
+
+// What the generated code may assume about the CPU it runs on, set with -march
+struct Target {
+    TargetLevel level = TargetLevel::x86_64;
+    bool multi = false; // Hot regions get a variant per level that helps them, picked once at startup
+
+    static std::optional<Target> from_march(const std::string &march) {
+        if (march == "x86-64") {
+            return Target{};
+        }
+        if (march == "x86-64-v2") {
+            return Target{ .level = TargetLevel::x86_64_v2 };
+        }
+        if (march == "x86-64-v3") {
+            return Target{ .level = TargetLevel::x86_64_v3 };
+        }
+        if (march == "x86-64-v4") {
+            return Target{ .level = TargetLevel::x86_64_v4 };
+        }
+        if (march == "native") {
+            return Target{ .level = native_level() };
+        }
+        if (march == "multi") {
+            return Target{ .multi = true };
+        }
+
+        return {};
+    }
+
+    // The level of the CPU the compiler itself is running on
+    static TargetLevel native_level() {
+        if (__builtin_cpu_supports("x86-64-v4")) {
+            return TargetLevel::x86_64_v4;
+        }
+        if (__builtin_cpu_supports("x86-64-v3")) {
+            return TargetLevel::x86_64_v3;
+        }
+        if (__builtin_cpu_supports("x86-64-v2")) {
+            return TargetLevel::x86_64_v2;
+        }
+
+        return TargetLevel::x86_64;
+    }
+
+    // Levels a region is worth emitting a variant for, best first and always ending with the baseline. Only
+    // instructions the region would actually use count, a region that needs none of them gets a single variant
+    static std::vector<TargetLevel> variants(const Node::Statement *region) {
+        bool uses_v2 = false;
+        bool uses_v3 = false;
+        Walk::statement_tree(region, [&](const Node::Statement *statement) {
+            uses_v3 = uses_v3 || std::holds_alternative<Node::StmtArray*>(statement->var);
+            Walk::statement_expressions(statement, [&](const Node::Expression *expression) {
+                Walk::subexpressions(expression, [&](const Node::Expression *subexpression) {
+                    TargetLevel level = required_level(subexpression);
+                    uses_v2 = uses_v2 || level == TargetLevel::x86_64_v2;
+                    uses_v3 = uses_v3 || level == TargetLevel::x86_64_v3;
+                });
+            });
+        });
+
+        std::vector<TargetLevel> levels;
+        if (uses_v3) {
+            levels.push_back(TargetLevel::x86_64_v3);
+        }
+        if (uses_v2) {
+            levels.push_back(TargetLevel::x86_64_v2);
+        }
+        levels.push_back(TargetLevel::x86_64);
+
+        return levels;
+    }
+
+    private:
+        // The lowest level with a better instruction for an expression than the baseline has
+        static TargetLevel required_level(const Node::Expression *expression) {
+            if (auto term = std::get_if<Node::Term*>(&expression->var)) {
+                if (auto builtin_term = std::get_if<Node::TermBuiltin*>(&(*term)->var)) {
+                    const std::string &name = (*builtin_term)->identifier.value.value();
+                    if (name == "popcount") {
+                        return TargetLevel::x86_64_v2;
+                    }
+                    return name == "clz" ? TargetLevel::x86_64_v3 : TargetLevel::x86_64;
+                }
+                return TargetLevel::x86_64;
+            }
+
+            auto binary_expression = std::get<Node::BinExpr*>(expression->var);
+            if (auto bitwise_and = std::get_if<Node::BitAnd*>(&binary_expression->bin_expr)) {
+                return is_bit_not((*bitwise_and)->left_side) || is_bit_not((*bitwise_and)->right_side) ? TargetLevel::x86_64_v3
+                                                                                                     : TargetLevel::x86_64;
+            }
+            // Shifts by a literal have an immediate form everywhere, only shifts by a variable amount need shlx
+            if (auto shift_left = std::get_if<Node::ShiftLeft*>(&binary_expression->bin_expr)) {
+                return is_literal((*shift_left)->right_side) ? TargetLevel::x86_64 : TargetLevel::x86_64_v3;
+            }
+            if (auto shift_right = std::get_if<Node::ShiftRight*>(&binary_expression->bin_expr)) {
+                return is_literal((*shift_right)->right_side) ? TargetLevel::x86_64 : TargetLevel::x86_64_v3;
+            }
+
+            return TargetLevel::x86_64;
+        }
+
+        static bool is_literal(const Node::Expression *expression) {
+            auto term = std::get_if<Node::Term*>(&expression->var);
+            return term != nullptr && std::holds_alternative<Node::TermInt*>((*term)->var);
+        }
+
+        static bool is_bit_not(const Node::Expression *expression) {
+            auto term = std::get_if<Node::Term*>(&expression->var);
+            return term != nullptr && std::holds_alternative<Node::BitNot*>((*term)->var);
+        }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+
+
+// Heap allocations made so far, counted by the operator new main.cpp replaces
+inline std::atomic<size_t> heap_allocations = 0;
+
+// Where the time and memory of a compile go, phase by phase, for -ftime-report. CPU time includes the children
+// the phase waited for, so nasm and ld are counted too
+class TimeReport {
+    public:
+        void start(std::string phase) {
+            m_phase = std::move(phase);
+            m_wall_start = std::chrono::steady_clock::now();
+            m_cpu_start = cpu_milliseconds();
+            m_allocations_start = heap_allocations.load(std::memory_order_relaxed);
+        }
+
+        void stop() {
+            std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - m_wall_start;
+            m_phases.push_back({ .name = m_phase, .wall_ms = wall.count(), .cpu_ms = cpu_milliseconds() - m_cpu_start,
+                                 .allocations = heap_allocations.load(std::memory_order_relaxed) - m_allocations_start,
+                                 .peak_rss_kb = peak_rss_kb() });
+        }
+
+        // Sizes of what the phases produced, printed under the table
+        void count(std::string what, size_t value) {
+            m_counts.emplace_back(std::move(what), value);
+        }
+
+        void print(std::ostream &out) const {
+            Phase total{ .name = "total" };
+            out << "cer: time report" << std::endl;
+            out << std::left << std::setw(12) << "  phase" << std::right << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms"
+                << std::setw(14) << "allocations" << std::setw(14) << "peak rss kB" << std::endl;
+            for (const Phase &phase : m_phases) {
+                print_phase(out, phase);
+                total.wall_ms += phase.wall_ms;
+                total.cpu_ms += phase.cpu_ms;
+                total.allocations += phase.allocations;
+                total.peak_rss_kb = std::max(total.peak_rss_kb, phase.peak_rss_kb);
+            }
+            print_phase(out, total);
+
+            for (const auto &[what, value] : m_counts) {
+                out << "  " << what << ": " << value << std::endl;
+            }
+        }
+
+    private:
+        struct Phase {
+            std::string name;
+            double wall_ms = 0;
+            double cpu_ms = 0;
+            size_t allocations = 0;
+            long peak_rss_kb = 0;
+        };
+
+        std::string m_phase;
+        std::chrono::steady_clock::time_point m_wall_start;
+        double m_cpu_start = 0;
+        size_t m_allocations_start = 0;
+        std::vector<Phase> m_phases;
+        std::vector<std::pair<std::string, size_t>> m_counts;
+
+        static void print_phase(std::ostream &out, const Phase &phase) {
+            out << "  " << std::left << std::setw(10) << phase.name << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << phase.wall_ms << std::setw(12) << phase.cpu_ms
+                << std::setw(14) << phase.allocations << std::setw(14) << phase.peak_rss_kb << std::endl;
+        }
+
+        static double cpu_milliseconds() {
+            double milliseconds = 0;
+            for (int who : { RUSAGE_SELF, RUSAGE_CHILDREN }) {
+                rusage usage{};
+                getrusage(who, &usage);
+                milliseconds += static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+                              + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+            }
+
+            return milliseconds;
+        }
+
+        // Of the compiler itself, the assembler and linker run in processes of their own
+        static long peak_rss_kb() {
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            return usage.ru_maxrss;
+        }
+};
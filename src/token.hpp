@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <optional>
+#include <cstdint>
+
 enum class TokenType {
     exit,
     mut,
@@ -8,6 +12,7 @@ enum class TokenType {
     int32,
     int64,
     int_lit,
+    string_lit,
     boolean,
     identifier,
     colon,
@@ -19,6 +24,12 @@ enum class TokenType {
     elif,
     while_,
     for_,
+    fn,
+    return_,
+    profile,
+    print,
+    parallel,
+    comma,
     plus,
     minus,
     equals,
@@ -28,6 +39,16 @@ enum class TokenType {
     tilde,
     caret,
     ampersand,
+    double_equals,
+    not_equals,
+    less_than,
+    less_equals,
+    greater_than,
+    greater_equals,
+    double_ampersand,
+    double_pipe,
+    shift_left,
+    shift_right,
     postfix_add,
     postfix_sub,
     prefix_add,
@@ -47,6 +68,7 @@ struct Token {
     int line_no{};
     int column_no{};
     std::optional<std::string> value{};
+    int64_t int_value = 0; // Of an int_lit, parsed once by the tokenizer
 };
 
 inline std::string get_token(Token token ) {
@@ -74,6 +96,9 @@ inline std::string get_token(Token token ) {
         case TokenType::int_lit:
             token_name = token.value.value();
             break;
+        case TokenType::string_lit:
+            token_name = "\"" + token.value.value() + "\"";
+            break;
         case TokenType::boolean:
             token_name = "bool";
             break;
@@ -107,6 +132,24 @@ inline std::string get_token(Token token ) {
         case TokenType::for_:
             token_name = "for";
             break;
+        case TokenType::fn:
+            token_name = "fn";
+            break;
+        case TokenType::return_:
+            token_name = "return";
+            break;
+        case TokenType::profile:
+            token_name = "profile";
+            break;
+        case TokenType::print:
+            token_name = "print";
+            break;
+        case TokenType::parallel:
+            token_name = "parallel";
+            break;
+        case TokenType::comma:
+            token_name = ",";
+            break;
         case TokenType::plus:
             token_name = "+";
             break;
@@ -134,6 +177,36 @@ inline std::string get_token(Token token ) {
         case TokenType::ampersand:
             token_name = "&";
             break;
+        case TokenType::double_equals:
+            token_name = "==";
+            break;
+        case TokenType::not_equals:
+            token_name = "!=";
+            break;
+        case TokenType::less_than:
+            token_name = "<";
+            break;
+        case TokenType::less_equals:
+            token_name = "<=";
+            break;
+        case TokenType::greater_than:
+            token_name = ">";
+            break;
+        case TokenType::greater_equals:
+            token_name = ">=";
+            break;
+        case TokenType::double_ampersand:
+            token_name = "&&";
+            break;
+        case TokenType::double_pipe:
+            token_name = "||";
+            break;
+        case TokenType::shift_left:
+            token_name = "<<";
+            break;
+        case TokenType::shift_right:
+            token_name = ">>";
+            break;
         case TokenType::postfix_add:
             token_name = "++";
             break;
@@ -174,37 +247,74 @@ inline std::string get_token(Token token ) {
     return token_name;
 }
 
-int operator_precedence(TokenType type) {
+inline int operator_precedence(TokenType type) {
     switch(type) {
+        case TokenType::double_pipe:
+            return 1;
+
+        case TokenType::double_ampersand:
+            return 2;
+
+        case TokenType::double_equals:
+        case TokenType::not_equals:
+        case TokenType::less_than:
+        case TokenType::less_equals:
+        case TokenType::greater_than:
+        case TokenType::greater_equals:
+            return 3;
+
         case TokenType::pipe:
+            return 4;
 
-            return 1;
         case TokenType::caret:
+            return 5;
 
-            return 2;
         case TokenType::ampersand:
+            return 6;
 
-            return 3;
+        case TokenType::shift_left:
+        case TokenType::shift_right:
+            return 7;
 
         case TokenType::plus:
         case TokenType::minus:
-            return 4;
+            return 8;
 
         case TokenType::star:
         case TokenType::forward_slash:
         case TokenType::modulus:
-            return 5;
+            return 9;
 
         default:
             return 0;
     }
 };
 
-bool is_statement(TokenType type) {
+inline bool is_type(TokenType type) {
+    switch(type) {
+        case TokenType::int16:
+        case TokenType::int32:
+        case TokenType::int64:
+        case TokenType::boolean:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+inline bool is_statement(TokenType type) {
     switch(type) {
         case TokenType::if_:
         case TokenType::elif:
         case TokenType::else_:
+        case TokenType::while_:
+        case TokenType::for_:
+        case TokenType::fn:
+        case TokenType::return_:
+        case TokenType::profile:
+        case TokenType::print:
+        case TokenType::parallel:
         case TokenType::mut:
         case TokenType::constant:
         case TokenType::identifier:
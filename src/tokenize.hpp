@@ -10,8 +10,9 @@
 
 class Tokenizer {
     public:
-        inline explicit Tokenizer(std::string src_code, std::string filename) : m_src_code(std::move(src_code))
-                                                                              , m_filename(std::move(filename)) {
+        inline explicit Tokenizer(std::string src_code, std::string filename, size_t error_limit = 0) : m_src_code(std::move(src_code))
+                                                                                                  , m_filename(std::move(filename))
+                                                                                                  , m_diagnostics(error_limit) {
             m_curr_index = 0;
             line_count = 1;
             column_count = 1;
@@ -20,7 +21,7 @@ class Tokenizer {
         inline std::vector<Token> tokenize() {
             std::string buff;
             std::vector<Token> tokens;
-            while (seek().has_value()) {
+            while (seek().has_value() && !m_diagnostics.truncated()) {
                 if (std::isalpha(seek().value())) {
                     int col = column_count;
 //                    buff.push_back(grab());
@@ -37,6 +38,14 @@ class Tokenizer {
                         tokens.push_back({ .type = TokenType::mut, .line_no = line_count, .column_no = col });
                         buff.clear();
                     }
+                    else if (buff == "int16") {
+                        tokens.push_back({ .type = TokenType::int16, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "int32") {
+                        tokens.push_back({ .type = TokenType::int32, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
                     else if (buff == "int64") {
                         tokens.push_back({ .type = TokenType::int64, .line_no = line_count, .column_no = col });
                         buff.clear();
@@ -65,6 +74,34 @@ class Tokenizer {
                         tokens.push_back({ .type = TokenType::elif, .line_no = line_count, .column_no = col });
                         buff.clear();
                     }
+                    else if (buff == "while") {
+                        tokens.push_back({ .type = TokenType::while_, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "for") {
+                        tokens.push_back({ .type = TokenType::for_, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "fn") {
+                        tokens.push_back({ .type = TokenType::fn, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "return") {
+                        tokens.push_back({ .type = TokenType::return_, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "profile") {
+                        tokens.push_back({ .type = TokenType::profile, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "print") {
+                        tokens.push_back({ .type = TokenType::print, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
+                    else if (buff == "parallel") {
+                        tokens.push_back({ .type = TokenType::parallel, .line_no = line_count, .column_no = col });
+                        buff.clear();
+                    }
                     else {
                         tokens.push_back({ .type = TokenType::identifier, .line_no = line_count, .column_no = col, .value = buff });
                         buff.clear();
@@ -74,12 +111,42 @@ class Tokenizer {
                 else if (std::isdigit(seek().value())) {
                     int col = column_count;
 //                    buff.push_back(grab());
+                    int64_t value = 0;
+                    bool too_large = false;
                     while (seek().has_value() && std::isdigit(seek().value())) {
+                        const int digit = seek().value() - '0';
+                        too_large = too_large || value > (INT64_MAX - digit) / 10;
+                        value = too_large ? 0 : value * 10 + digit;
                         buff.push_back(grab());
                         column_count++;
                     }
+                    if (too_large) {
+                        m_diagnostics.error_expected(m_filename, "integer literal is too large for int64", buff, line_count, col);
+                    }
 
-                    tokens.push_back({ .type = TokenType::int_lit, .line_no = line_count, .column_no = col, .value = buff });
+                    tokens.push_back({ .type = TokenType::int_lit, .line_no = line_count, .column_no = col, .value = buff,
+                                       .int_value = value });
+                    buff.clear();
+                }
+
+                // Strings have no escapes and end on the same line they start on
+                else if (seek().value() == '"') {
+                    int col = column_count;
+                    grab();
+                    column_count++;
+                    while (seek().has_value() && seek().value() != '"' && seek().value() != '\n') {
+                        buff.push_back(grab());
+                        column_count++;
+                    }
+
+                    if (seek().has_value() && seek().value() == '"') {
+                        grab();
+                        column_count++;
+                    }
+                    else {
+                        m_diagnostics.error_expected(m_filename, "unterminated string", "\"" + buff, line_count, col);
+                    }
+                    tokens.push_back({ .type = TokenType::string_lit, .line_no = line_count, .column_no = col, .value = buff });
                     buff.clear();
                 }
 
@@ -87,8 +154,66 @@ class Tokenizer {
                     switch (seek().value()) {
                         case '=':
                             grab();
-                            tokens.push_back({ .type = TokenType::equals, .line_no = line_count, .column_no = column_count });
-                            column_count++;
+                            if (seek().has_value() && seek().value() == '=') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::double_equals, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                tokens.push_back({ .type = TokenType::equals, .line_no = line_count, .column_no = column_count });
+                                column_count++;
+                            }
+                            break;
+
+                        case '!':
+                            if (seek(1).has_value() && seek(1).value() == '=') {
+                                grab();
+                                grab();
+                                tokens.push_back({ .type = TokenType::not_equals, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                Token token = { .type = TokenType::identifier, .line_no = line_count, .column_no = column_count, .value = "!" };
+                                m_diagnostics.error_token(m_filename, "unexpected character", token, "!");
+                                grab();
+                                column_count++;
+                            }
+                            break;
+
+                        case '<':
+                            grab();
+                            if (seek().has_value() && seek().value() == '<') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::shift_left, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else if (seek().has_value() && seek().value() == '=') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::less_equals, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                tokens.push_back({ .type = TokenType::less_than, .line_no = line_count, .column_no = column_count });
+                                column_count++;
+                            }
+                            break;
+
+                        case '>':
+                            grab();
+                            if (seek().has_value() && seek().value() == '>') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::shift_right, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else if (seek().has_value() && seek().value() == '=') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::greater_equals, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                tokens.push_back({ .type = TokenType::greater_than, .line_no = line_count, .column_no = column_count });
+                                column_count++;
+                            }
                             break;
 
                         case '+':
@@ -133,7 +258,7 @@ class Tokenizer {
                                 }
 
                                 if (not_terminated) {
-                                    error_expected(m_filename, "unterminated comment", "/*", line, col);
+                                    m_diagnostics.error_expected(m_filename, "unterminated comment", "/*", line, col);
                                 }
                             }
                             else {
@@ -168,14 +293,28 @@ class Tokenizer {
 
                         case '|':
                             grab();
-                            tokens.push_back({ .type = TokenType::pipe, .line_no = line_count, .column_no = column_count });
-                            column_count++;
+                            if (seek().has_value() && seek().value() == '|') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::double_pipe, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                tokens.push_back({ .type = TokenType::pipe, .line_no = line_count, .column_no = column_count });
+                                column_count++;
+                            }
                             break;
 
                         case '&':
                             grab();
-                            tokens.push_back({ .type = TokenType::ampersand, .line_no = line_count, .column_no = column_count });
-                            column_count++;
+                            if (seek().has_value() && seek().value() == '&') {
+                                grab();
+                                tokens.push_back({ .type = TokenType::double_ampersand, .line_no = line_count, .column_no = column_count });
+                                column_count += 2;
+                            }
+                            else {
+                                tokens.push_back({ .type = TokenType::ampersand, .line_no = line_count, .column_no = column_count });
+                                column_count++;
+                            }
                             break;
 
                         case '(':
@@ -220,6 +359,12 @@ class Tokenizer {
                             column_count++;
                             break;
 
+                        case ',':
+                            grab();
+                            tokens.push_back({ .type = TokenType::comma, .line_no = line_count, .column_no = column_count });
+                            column_count++;
+                            break;
+
                         case ';':
                             grab();
                             tokens.push_back({ .type = TokenType::semi_colon, .line_no = line_count, .column_no = column_count });
@@ -241,8 +386,9 @@ class Tokenizer {
 
                         default:
                             Token token = { .type = TokenType::identifier, .line_no = line_count, .column_no = column_count, .value = std::string(1, seek().value()) };
-                            error_token(m_filename, "unexpected character", token, std::string(1, seek().value()));
-                            exit(EXIT_FAILURE);
+                            m_diagnostics.error_token(m_filename, "unexpected character", token, std::string(1, seek().value()));
+                            grab();
+                            column_count++;
                     }
                 }
             }
@@ -251,12 +397,17 @@ class Tokenizer {
         return tokens;
     }
 
+        [[nodiscard]] const Diagnostics& diagnostics() const {
+            return m_diagnostics;
+        }
+
     private:
         int line_count;
         int column_count;
         size_t m_curr_index;
         const std::string m_src_code;
         const std::string m_filename;
+        Diagnostics m_diagnostics;
 
         [[nodiscard]] inline std::optional<char> seek(int offset = 0) const {
             if (m_curr_index + offset >= m_src_code.length()){
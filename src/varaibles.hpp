@@ -4,10 +4,28 @@
 #include <stack>
 #include <vector>
 
+#include "token.hpp"
+
 struct Variable {
-    size_t stack_location;
+    size_t stack_location = 0;
+    TokenType type = TokenType::int64;
+    size_t length = 0; // Number of elements for arrays, 0 for everything else
 };
 
+// Size in bytes of a variable of the given type, which is also its alignment on the stack
+inline size_t type_size(TokenType type) {
+    switch(type) {
+        case TokenType::boolean:
+            return 1;
+        case TokenType::int16:
+            return 2;
+        case TokenType::int32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
 class Variables {
     public:
         inline Variables() = default;
@@ -22,15 +40,19 @@ class Variables {
                 }
             }
 
-            return false;
+            return m_outer != nullptr && m_outer->exists(identifier, current_scope);
         }
 
         inline bool is_valid(std::string identifier, int scope) {
             return !m_variables_map.contains(generate_name(identifier, scope));
         }
 
-        inline void declare_variable(std::string identifier, int scope) {
-            m_variables_map.insert({ generate_name(identifier, scope), Variable {} });
+        inline void declare_variable(std::string identifier, int scope, TokenType type = TokenType::int64, size_t length = 0) {
+            std::string variable_name = generate_name(identifier, scope);
+            m_variables_map.insert({ variable_name, Variable { .type = type, .length = length } });
+            if (scope != 0) {
+                m_scopes.top().push_back(variable_name);
+            }
         }
 
         std::map<std::string, Variable>::iterator get_variable(const std::string& identifier, int current_scope) {
@@ -41,13 +63,24 @@ class Variables {
                     return iterator;
                 }
             }
+            if (m_outer != nullptr) {
+                return m_outer->get_variable(identifier, current_scope);
+            }
 
             return {};
         }
 
-        inline void add_variable(std::string identifier, size_t stack_location, int scope) {
+        // Variables to look in after these ones, which are only ever read through this table. The top level regions
+        // code generation splits a program into all share the one table of top level variables this way
+        void set_outer(Variables *outer) {
+            m_outer = outer;
+        }
+
+        inline void add_variable(std::string identifier, size_t stack_location, TokenType type, int scope, size_t length = 0) {
             std::string variable_name = generate_name(identifier, scope);
             m_variables_map[variable_name].stack_location = stack_location;
+            m_variables_map[variable_name].type = type;
+            m_variables_map[variable_name].length = length;
             if (scope != 0) {
                 m_scopes.top().push_back(variable_name);
             }
@@ -73,6 +106,7 @@ class Variables {
     private:
         std::stack<std::vector<std::string>> m_scopes{};
         std::map<std::string, Variable> m_variables_map{};
+        Variables *m_outer = nullptr;
 
         inline static std::string generate_name(std::string identifier, int scope) {
             return identifier + "_sc_" + std::to_string(scope);
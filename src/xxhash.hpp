@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+
+// XXH64, which hashes at memory speed. The build cache uses it to key outputs by everything that went into them
+class XXHash64 {
+    public:
+        [[nodiscard]] static uint64_t hash(const void *data, size_t size, uint64_t seed = 0) {
+            const auto *bytes = static_cast<const unsigned char*>(data);
+            const unsigned char *end = bytes + size;
+            uint64_t hash;
+
+            if (size >= 32) {
+                uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+                while (end - bytes >= 32) {
+                    for (uint64_t &lane : lanes) {
+                        lane = round(lane, read64(bytes));
+                        bytes += 8;
+                    }
+                }
+                hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+                for (uint64_t lane : lanes) {
+                    hash = (hash ^ round(0, lane)) * prime1 + prime4;
+                }
+            }
+            else {
+                hash = seed + prime5;
+            }
+            hash += size;
+
+            while (end - bytes >= 8) {
+                hash ^= round(0, read64(bytes));
+                hash = rotate(hash, 27) * prime1 + prime4;
+                bytes += 8;
+            }
+            if (end - bytes >= 4) {
+                hash ^= static_cast<uint64_t>(read32(bytes)) * prime1;
+                hash = rotate(hash, 23) * prime2 + prime3;
+                bytes += 4;
+            }
+            while (bytes < end) {
+                hash ^= *bytes * prime5;
+                hash = rotate(hash, 11) * prime1;
+                bytes++;
+            }
+
+            hash ^= hash >> 33;
+            hash *= prime2;
+            hash ^= hash >> 29;
+            hash *= prime3;
+            hash ^= hash >> 32;
+
+            return hash;
+        }
+
+        [[nodiscard]] static uint64_t hash(const std::string &text, uint64_t seed = 0) {
+            return hash(text.data(), text.size(), seed);
+        }
+
+    private:
+        static constexpr uint64_t prime1 = 0x9E3779B185EBCA87;
+        static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4F;
+        static constexpr uint64_t prime3 = 0x165667B19E3779F9;
+        static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63;
+        static constexpr uint64_t prime5 = 0x27D4EB2F165667C5;
+
+        static uint64_t rotate(uint64_t value, int bits) {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        static uint64_t round(uint64_t accumulator, uint64_t input) {
+            accumulator += input * prime2;
+            return rotate(accumulator, 31) * prime1;
+        }
+
+        static uint64_t read64(const unsigned char *bytes) {
+            uint64_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+
+        static uint32_t read32(const unsigned char *bytes) {
+            uint32_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+};
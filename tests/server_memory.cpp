@@ -0,0 +1,86 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <filesystem>
+#include <unistd.h>
+
+#include "driver.hpp"
+#include "server.hpp"
+
+
+// Compiles the same program on a server over and over, and fails when the server's memory keeps growing. The
+// server lives for as long as it is asked to compile, so nothing a compile allocates may outlive it
+
+// Resident memory of this process, where the server runs on a thread of its own
+size_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Lots of names and statements, so every compile builds a tree that owns many strings and vectors
+std::string program(size_t size) {
+    std::stringstream source;
+    source << "fn twice(value: int64): int64 {\n    return value + value;\n}\n";
+    for (size_t index = 0; index < size; index++) {
+        source << "mut variable" << index << ": int64 = twice(" << index << ");\n";
+        source << "if (variable" << index << " > 7) {\n    variable" << index << " = variable" << index << " - 1;\n}\n";
+    }
+    source << "exit(variable0);\n";
+
+    return source.str();
+}
+
+int main() {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / ("cer-server-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    const std::string source = (directory / "program.crm").string();
+    std::ofstream(source) << program(400);
+    const std::string socket = (directory / "server.sock").string();
+
+    std::thread(CompileServer::serve, socket).detach();
+    const char *argv[] = { "cer", "--emit=asm", source.c_str() };
+    // The assembly isn't what is being tested
+    std::streambuf *out = std::cout.rdbuf(nullptr);
+    auto compile = [&]() {
+        return CompileServer::forward(socket, 3, argv);
+    };
+    for (int attempt = 0; attempt < 100 && !compile().has_value(); attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // The first compiles fill the spare arenas and the heap, after those memory has to stay where it is
+    constexpr int warm_up = 10;
+    constexpr int compiles = 100;
+    constexpr size_t allowed_growth = 1024 * 1024;
+    for (int index = 0; index < warm_up; index++) {
+        compile();
+    }
+    const size_t before = resident_bytes();
+    for (int index = 0; index < compiles; index++) {
+        if (compile() != 0) {
+            std::cout.rdbuf(out);
+            std::cerr << "server_memory: compile " << index << " failed" << std::endl;
+            return 1;
+        }
+    }
+    const size_t after = resident_bytes();
+    std::cout.rdbuf(out);
+    std::filesystem::remove_all(directory);
+
+    std::cout << "server_memory: " << before / 1024 << " KiB before " << compiles << " compiles, " << after / 1024
+              << " KiB after" << std::endl;
+    if (after > before + allowed_growth) {
+        std::cerr << "server_memory: the server grew by " << (after - before) / 1024 << " KiB" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}